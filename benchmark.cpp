@@ -0,0 +1,246 @@
+/****************************************************************************
+**
+** Headless benchmark.  See benchmark.h.
+**
+** GPU times come from GL_TIME_ELAPSED timer queries.  Reading a query's
+** result right away would make the CPU wait for the GPU to catch up, and
+** that wait would be counted in the next frame's CPU time, so a ring of
+** queries is kept in flight and each result is read BENCH_QUERIES frames
+** after it was issued.
+**
+****************************************************************************/
+
+#include "benchmark.h"
+#include "scenerenderer.h"
+#include "geometryengine.h"
+
+#include <QElapsedTimer>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLTimerQuery>
+#include <QSaveFile>
+#include <QTextStream>
+#include <math.h>
+
+#include <iostream>
+using namespace std;
+
+#define BENCH_WARMUP 30           // frames drawn before measuring starts, so first-use costs in the driver aren't counted
+#define BENCH_QUERIES 4           // timer queries in flight
+#define BENCH_PATH_RADIUS 0.6f    // radius of the camera's circuit, as a fraction of WORLD_DIM
+#define BENCH_LOOK_IN 30.0f       // degrees the camera looks in towards the middle of the world, away from its heading
+#define BENCH_LOOK_DOWN -0.1f     // y of the look direction before normalizing
+
+// Where the camera is on frame i of n, and where it's looking.  It walks a circle around the middle of the world at
+// eye height (or just above the water), counterclockwise, looking a little inwards and down.
+static void cameraPath(GeometryEngine *geometry, int i, int n, QVector3D &eye, QVector3D &lookDir)
+{
+    float a = 2.0f * float(M_PI) * i / n;
+    float r = BENCH_PATH_RADIUS * WORLD_DIM;
+    float x = r * cos(a), z = r * sin(a);
+    eye = QVector3D(x, geometry->getHeight(x, z) + EYE_HEIGHT, z);
+
+    QVector3D heading(-sin(a), 0.0f, cos(a));
+    QVector3D inwards(-cos(a), 0.0f, -sin(a));
+    float turn = BENCH_LOOK_IN * float(M_PI) / 180.0f;
+    lookDir = heading * cos(turn) + inwards * sin(turn);
+    lookDir.setY(BENCH_LOOK_DOWN);
+    lookDir.normalize();
+}
+
+// Draw the warm-up and measured frames into the current framebuffer
+static void measure(sceneRenderer &scene, QOpenGLFunctions *gl, int frames, QVector<benchmarkFrame> &results)
+{
+    QOpenGLTimerQuery queries[BENCH_QUERIES];
+    bool timed = true;
+    for (int q = 0; q < BENCH_QUERIES; q++)
+        timed = timed && queries[q].create();
+    if (!timed)
+        cout << "No GPU timer queries; GPU times will be -1" << endl;
+
+    results.resize(frames);
+    QElapsedTimer timer;
+    for (int i = -BENCH_WARMUP; i < frames; i++)
+    {
+        QVector3D eye, lookDir;
+        cameraPath(scene.geometry(), i < 0 ? 0 : i, frames, eye, lookDir);
+
+        if (i < 0)
+        {
+            scene.render(eye, lookDir);
+            gl->glFlush();
+            continue;
+        }
+
+        // Collect the result of the query this frame is about to reuse
+        QOpenGLTimerQuery &query = queries[i % BENCH_QUERIES];
+        if (timed && i >= BENCH_QUERIES)
+            results[i - BENCH_QUERIES].gpuMs = query.waitForResult() / 1.0e6;
+
+        timer.start();
+        if (timed)
+            query.begin();
+        scene.render(eye, lookDir);
+        if (timed)
+            query.end();
+        gl->glFlush();
+
+        benchmarkFrame &f = results[i];
+        f.cpuMs = timer.nsecsElapsed() / 1.0e6;
+        f.gpuMs = -1.0;
+        const renderStats &rs = scene.getStats();
+        f.draws = rs.commands;
+        f.glCalls = rs.glCalls;
+        f.triangles = rs.triangles;
+    }
+
+    // The last few frames' queries are still outstanding
+    for (int i = MAX(frames - BENCH_QUERIES, 0); timed && i < frames; i++)
+        results[i].gpuMs = queries[i % BENCH_QUERIES].waitForResult() / 1.0e6;
+    gl->glFinish();
+
+    for (int q = 0; q < BENCH_QUERIES; q++)
+        queries[q].destroy();
+}
+
+int runBenchmark(const benchmarkOptions &options)
+{
+    // The default format (set in main()) asks for the core profile the shaders need
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!context.create())
+    {
+        cerr << "Can't create an OpenGL context" << endl;
+        return 1;
+    }
+    QOffscreenSurface surface;
+    surface.setFormat(context.format());
+    surface.create();
+    if (!context.makeCurrent(&surface))
+    {
+        cerr << "Can't make the OpenGL context current on an offscreen surface" << endl;
+        return 1;
+    }
+    QOpenGLFunctions *gl = context.functions();
+    QString renderer = QString::fromLatin1((const char *)gl->glGetString(GL_RENDERER));
+    cout << "Benchmarking on " << renderer.toStdString() << ", " << options.width << "x" << options.height << ", "
+         << options.frames << " frames, depth pre-pass " << (options.depthPrepass ? "on" : "off")
+         << (options.heightTexture ? ", land height texture" : "") << (options.streaming ? ", streaming world" : "")
+         << endl;
+
+    int rc = 0;
+    {
+        QOpenGLFramebufferObject fbo(QSize(options.width, options.height),
+                                     QOpenGLFramebufferObject::CombinedDepthStencil);
+        fbo.bind();
+        gl->glViewport(0, 0, options.width, options.height);
+
+        sceneRenderer scene(options.seed, options.useCache);
+        scene.setDepthPrepass(options.depthPrepass);
+        scene.setHeightTexture(options.heightTexture);
+        scene.setStreaming(options.streaming);
+        QElapsedTimer loadTime;
+        loadTime.start();
+        scene.resize(options.width, options.height);
+        if (!scene.initialize())
+        {
+            cerr << "Can't build the shaders" << endl;
+            rc = 1;
+        }
+        else if (!scene.finishLoading())
+        {
+            cerr << "Can't load the world" << endl;
+            rc = 1;
+        }
+        else
+        {
+            cout << "World loaded after " << loadTime.elapsed() << " ms" << endl;
+
+            QVector<benchmarkFrame> results;
+            QElapsedTimer runTime;
+            runTime.start();
+            measure(scene, gl, options.frames, results);
+            qint64 ms = runTime.elapsed();
+
+            double cpu = 0.0, gpu = 0.0;
+            for (int i = 0; i < results.size(); i++)
+            {
+                cpu += results[i].cpuMs;
+                gpu += results[i].gpuMs;
+            }
+            cout << options.frames << " frames in " << ms << " ms (including warm-up): average CPU "
+                 << cpu / results.size() << " ms";
+            if (results[0].gpuMs >= 0.0)
+                cout << ", GPU " << gpu / results.size() << " ms";
+            cout << " per frame" << endl;
+
+            if (!writeBenchmarkResults(options.output, options, renderer, results))
+                rc = 1;
+        }
+        scene.release();
+        fbo.release();
+    }
+    context.doneCurrent();
+    return rc;
+}
+
+bool writeBenchmarkResults(const QString &fileName, const benchmarkOptions &options, const QString &renderer,
+                           const QVector<benchmarkFrame> &frames)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        cerr << "Can't write benchmark results to " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    QTextStream out(&file);
+    if (fileName.endsWith(".json", Qt::CaseInsensitive))
+    {
+        QString name = renderer;
+        name.replace("\\", "\\\\").replace("\"", "\\\"");
+        out << "{\n"
+            << "  \"seed\": " << options.seed << ",\n"
+            << "  \"width\": " << options.width << ",\n"
+            << "  \"height\": " << options.height << ",\n"
+            << "  \"depth_prepass\": " << (options.depthPrepass ? "true" : "false") << ",\n"
+            << "  \"height_texture\": " << (options.heightTexture ? "true" : "false") << ",\n"
+            << "  \"streaming\": " << (options.streaming ? "true" : "false") << ",\n"
+            << "  \"renderer\": \"" << name << "\",\n"
+            << "  \"frames\": [\n";
+        for (int i = 0; i < frames.size(); i++)
+        {
+            const benchmarkFrame &f = frames[i];
+            out << "    {\"frame\": " << i << ", \"cpu_ms\": " << f.cpuMs << ", \"gpu_ms\": ";
+            if (f.gpuMs < 0.0)
+                out << "null";
+            else
+                out << f.gpuMs;
+            out << ", \"draws\": " << f.draws << ", \"gl_calls\": " << f.glCalls << ", \"triangles\": " << f.triangles
+                << "}" << (i + 1 < frames.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+    else
+    {
+        out << "frame,cpu_ms,gpu_ms,draws,gl_calls,triangles\n";
+        for (int i = 0; i < frames.size(); i++)
+        {
+            const benchmarkFrame &f = frames[i];
+            out << i << "," << f.cpuMs << "," << f.gpuMs << "," << f.draws << "," << f.glCalls << "," << f.triangles
+                << "\n";
+        }
+    }
+    out.flush();
+
+    if (!file.commit())
+    {
+        cerr << "Can't write benchmark results to " << fileName.toStdString() << endl;
+        return false;
+    }
+    cout << "Results written to " << fileName.toStdString() << endl;
+    return true;
+}
@@ -0,0 +1,53 @@
+/****************************************************************************
+**
+** Headless benchmark.  Renders the world into an offscreen framebuffer
+** (so it needs no window or display, and runs on Mesa's llvmpipe software
+** renderer) while the camera flies a fixed circuit over the world.  Each
+** frame's CPU time, GPU time, draw calls and triangles are written out as
+** CSV, or as JSON if the output file name ends in .json.  With the same
+** seed and frame count, every run draws exactly the same frames.
+**
+****************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QVector>
+
+#define BENCH_SEED 1         // world used when no seed is given
+#define BENCH_FRAMES 600     // frames measured; the camera makes one circuit in this many frames
+#define BENCH_WIDTH 1280     // framebuffer size
+#define BENCH_HEIGHT 720
+#define BENCH_OUTPUT "benchmark.csv"
+
+struct benchmarkOptions
+{
+    quint32 seed;
+    bool useCache;
+    bool depthPrepass; // draw the trees' depth before shading them
+    bool heightTexture; // draw the land from a height texture
+    bool streaming;     // endless world, generated around the camera
+    int frames;
+    int width, height;
+    QString output; // .json for JSON, anything else for CSV
+};
+
+// Measurements of one frame
+struct benchmarkFrame
+{
+    double cpuMs;  // time spent building and issuing the frame
+    double gpuMs;  // time the GPU spent on it, or -1 if the driver has no timer queries
+    int draws;     // draw commands
+    int glCalls;
+    int triangles;
+};
+
+// Run the benchmark and write the results.  Needs a QGuiApplication.  Returns the process exit code.
+int runBenchmark(const benchmarkOptions &options);
+
+// Write the per-frame results as CSV, or as JSON if fileName ends in .json
+bool writeBenchmarkResults(const QString &fileName, const benchmarkOptions &options, const QString &renderer,
+                           const QVector<benchmarkFrame> &frames);
+
+#endif // BENCHMARK_H
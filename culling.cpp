@@ -0,0 +1,206 @@
+/****************************************************************************
+**
+** View frustum culling.  A frustum is extracted from a combined projection *
+** view matrix, and a quadtree of axis-aligned bounding boxes over the XZ
+** plane lets whole groups of objects be accepted or rejected at once.
+**
+** Plane extraction follows Gribb & Hartmann, "Fast Extraction of Viewing
+** Frustum Planes from the World-View-Projection Matrix" (2001)
+**
+****************************************************************************/
+
+#include "culling.h"
+#include <algorithm> // for std::partition
+#include <float.h>   // for FLT_MAX
+
+viewFrustum::viewFrustum(const QMatrix4x4 &viewProjection)
+{
+    QVector4D r0 = viewProjection.row(0);
+    QVector4D r1 = viewProjection.row(1);
+    QVector4D r2 = viewProjection.row(2);
+    QVector4D r3 = viewProjection.row(3);
+
+    plane[0] = r3 + r0; // left
+    plane[1] = r3 - r0; // right
+    plane[2] = r3 + r1; // bottom
+    plane[3] = r3 - r1; // top
+    plane[4] = r3 + r2; // near
+    plane[5] = r3 - r2; // far
+}
+
+// Classify a box against the frustum.  A box that is only partly inside may occasionally be reported as intersecting
+// when it is really just outside a corner of the frustum; that is harmless (it just gets drawn).
+cullResult viewFrustum::testBox(const QVector3D &min, const QVector3D &max) const
+{
+    cullResult result = CULL_INSIDE;
+    for (int i = 0; i < 6; i++)
+    {
+        const QVector4D &p = plane[i];
+
+        // The box corner furthest along the plane normal, and the one furthest against it
+        QVector3D pos(p.x() >= 0 ? max.x() : min.x(), p.y() >= 0 ? max.y() : min.y(), p.z() >= 0 ? max.z() : min.z());
+        QVector3D neg(p.x() >= 0 ? min.x() : max.x(), p.y() >= 0 ? min.y() : max.y(), p.z() >= 0 ? min.z() : max.z());
+
+        if (QVector3D::dotProduct(p.toVector3D(), pos) + p.w() < 0.0f)
+            return CULL_OUTSIDE;
+        if (QVector3D::dotProduct(p.toVector3D(), neg) + p.w() < 0.0f)
+            result = CULL_INTERSECT;
+    }
+    return result;
+}
+
+// Build the tree over a set of object bounding boxes.  Objects are identified by their position in the arrays.
+void cullQuadtree::build(const QVector<QVector3D> &boxMin, const QVector<QVector3D> &boxMax)
+{
+    itemMin = boxMin;
+    itemMax = boxMax;
+    item.resize(boxMin.size());
+    for (int i = 0; i < item.size(); i++)
+        item[i] = i;
+
+    node.clear();
+    if (!item.isEmpty())
+        buildNode(0, item.size(), 0);
+
+    // Where each object ended up in the item array, for update()
+    itemPosition.resize(item.size());
+    for (int i = 0; i < item.size(); i++)
+        itemPosition[item[i]] = i;
+}
+
+int cullQuadtree::buildNode(int first, int count, int depth)
+{
+    int n = node.size();
+    node.resize(n + 1);
+
+    // Bounds of all the objects in this node
+    QVector3D min = itemMin[item[first]];
+    QVector3D max = itemMax[item[first]];
+    for (int i = first + 1; i < first + count; i++)
+    {
+        const QVector3D &a = itemMin[item[i]];
+        const QVector3D &b = itemMax[item[i]];
+        min = QVector3D(qMin(min.x(), a.x()), qMin(min.y(), a.y()), qMin(min.z(), a.z()));
+        max = QVector3D(qMax(max.x(), b.x()), qMax(max.y(), b.y()), qMax(max.z(), b.z()));
+    }
+
+    cullNode nd;
+    nd.min = min;
+    nd.max = max;
+    nd.first = first;
+    nd.count = count;
+    nd.leaf = (count <= CULL_LEAF_SIZE || depth >= CULL_MAX_DEPTH);
+    for (int q = 0; q < 4; q++)
+        nd.child[q] = -1;
+
+    if (!nd.leaf)
+    {
+        // Split into quadrants around the middle of the node, sorting each object by the center of its box
+        float midX = (min.x() + max.x()) / 2.0f;
+        float midZ = (min.z() + max.z()) / 2.0f;
+        auto west = [&](int i) { return itemMin[i].x() + itemMax[i].x() < 2.0f * midX; };
+        auto north = [&](int i) { return itemMin[i].z() + itemMax[i].z() < 2.0f * midZ; };
+
+        int *begin = item.data() + first;
+        int *end = begin + count;
+        int *splitX = std::partition(begin, end, west);
+        int *splitNW = std::partition(begin, splitX, north);
+        int *splitNE = std::partition(splitX, end, north);
+        int *bound[5] = {begin, splitNW, splitX, splitNE, end};
+
+        for (int q = 0; q < 4; q++)
+        {
+            int c = bound[q + 1] - bound[q];
+            if (c)
+            {
+                int child = buildNode(bound[q] - item.data(), c, depth + 1);
+                nd.child[q] = child;
+            }
+        }
+    }
+
+    // node may have been reallocated by the recursion, so store by index at the end
+    node[n] = nd;
+    return n;
+}
+
+// Change an object's bounding box, and the bounds of the nodes above it
+void cullQuadtree::update(int object, const QVector3D &boxMin, const QVector3D &boxMax)
+{
+    itemMin[object] = boxMin;
+    itemMax[object] = boxMax;
+    refitNode(0, itemPosition[object]);
+}
+
+// Recompute the bounds of node n, and of its child that covers the given position in the item array
+void cullQuadtree::refitNode(int n, int position)
+{
+    cullNode &nd = node[n];
+    QVector3D min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    auto grow = [&](const QVector3D &a, const QVector3D &b) {
+        min = QVector3D(qMin(min.x(), a.x()), qMin(min.y(), a.y()), qMin(min.z(), a.z()));
+        max = QVector3D(qMax(max.x(), b.x()), qMax(max.y(), b.y()), qMax(max.z(), b.z()));
+    };
+
+    if (nd.leaf)
+    {
+        for (int i = nd.first; i < nd.first + nd.count; i++)
+            grow(itemMin[item[i]], itemMax[item[i]]);
+    }
+    else
+    {
+        for (int q = 0; q < 4; q++)
+        {
+            int c = nd.child[q];
+            if (c < 0)
+                continue;
+            if (position >= node[c].first && position < node[c].first + node[c].count)
+                refitNode(c, position);
+            grow(node[c].min, node[c].max);
+        }
+    }
+    nd.min = min;
+    nd.max = max;
+}
+
+// Append the numbers of all objects whose bounding box is at least partly inside the frustum
+void cullQuadtree::query(const viewFrustum &frustum, QVector<int> &visible) const
+{
+    if (!node.isEmpty())
+        queryNode(0, frustum, visible);
+}
+
+void cullQuadtree::queryNode(int n, const viewFrustum &frustum, QVector<int> &visible) const
+{
+    const cullNode &nd = node[n];
+    cullResult r = frustum.testBox(nd.min, nd.max);
+    if (r == CULL_OUTSIDE)
+        return;
+    if (r == CULL_INSIDE)
+    {
+        // Everything below here is visible.  No further tests needed.
+        collectNode(n, visible);
+        return;
+    }
+
+    if (nd.leaf)
+    {
+        for (int i = nd.first; i < nd.first + nd.count; i++)
+            if (frustum.testBox(itemMin[item[i]], itemMax[item[i]]) != CULL_OUTSIDE)
+                visible << item[i];
+    }
+    else
+    {
+        for (int q = 0; q < 4; q++)
+            if (nd.child[q] >= 0)
+                queryNode(nd.child[q], frustum, visible);
+    }
+}
+
+void cullQuadtree::collectNode(int n, QVector<int> &visible) const
+{
+    // Children always cover a contiguous range of the item array, so the whole subtree can be taken in one go
+    const cullNode &nd = node[n];
+    for (int i = nd.first; i < nd.first + nd.count; i++)
+        visible << item[i];
+}
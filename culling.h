@@ -0,0 +1,78 @@
+/****************************************************************************
+**
+** View frustum culling.  A frustum is extracted from a combined projection *
+** view matrix, and a quadtree of axis-aligned bounding boxes over the XZ
+** plane lets whole groups of objects be accepted or rejected at once.
+**
+** Plane extraction follows Gribb & Hartmann, "Fast Extraction of Viewing
+** Frustum Planes from the World-View-Projection Matrix" (2001)
+**
+****************************************************************************/
+
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+
+#define CULL_LEAF_SIZE 16 // Maximum number of objects in a quadtree leaf
+#define CULL_MAX_DEPTH 12 // Maximum depth of the quadtree (guards against many objects at the same spot)
+
+enum cullResult
+{
+    CULL_OUTSIDE,
+    CULL_INTERSECT,
+    CULL_INSIDE
+};
+
+class viewFrustum
+{
+public:
+    viewFrustum(const QMatrix4x4 &viewProjection);
+    cullResult testBox(const QVector3D &min, const QVector3D &max) const;
+
+private:
+    QVector4D plane[6]; // xyz = inward facing normal, w = distance
+};
+
+// Counters for one frame of culling
+struct cullStats
+{
+    int treesVisible, treesCulled;
+    int tilesVisible, tilesCulled;
+    bool waterVisible;
+};
+
+// A static quadtree over a set of objects, each represented by its bounding box.  The objects can't move to another
+// part of the tree, but their boxes can change a little (a tile being raised, a tree moving with the ground) with
+// update().
+class cullQuadtree
+{
+public:
+    void build(const QVector<QVector3D> &boxMin, const QVector<QVector3D> &boxMax);
+    void query(const viewFrustum &frustum, QVector<int> &visible) const;
+    void update(int object, const QVector3D &boxMin, const QVector3D &boxMax);
+
+private:
+    struct cullNode
+    {
+        QVector3D min, max; // bounds of everything below this node
+        int child[4];       // -1 for an empty quadrant
+        int first, count;   // leaf nodes: range of objects in the item array
+        bool leaf;
+    };
+
+    int buildNode(int first, int count, int depth);
+    void queryNode(int n, const viewFrustum &frustum, QVector<int> &visible) const;
+    void collectNode(int n, QVector<int> &visible) const;
+    void refitNode(int n, int position);
+
+    QVector<cullNode> node;
+    QVector<int> item;         // object numbers, grouped by leaf
+    QVector<int> itemPosition; // position of each object in item
+    QVector<QVector3D> itemMin, itemMax;
+};
+
+#endif // CULLING_H
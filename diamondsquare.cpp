@@ -0,0 +1,120 @@
+/****************************************************************************
+**
+** Diamond-square terrain generator.  See diamondsquare.h.
+**
+** The grid is processed one step size at a time instead of recursively.  The
+** square pass sets the centers of the squares of the current size and always
+** has four corners to average.  The diamond pass sets the edge midpoints and
+** only has three neighbours on the outer rows and columns of the grid, so
+** those are handled separately and the interior loops run without any bounds
+** checks.
+**
+****************************************************************************/
+
+#include "diamondsquare.h"
+
+#include <QVector>
+#include <QThread>
+#include <QtConcurrent>
+
+// Hash the seed and grid coordinates into a random offset in [-0.5, 0.5).  Each point is written exactly once,
+// so its coordinates are enough to give it its own independent value.
+static inline float cellNoise(unsigned seed, int x, int z)
+{
+    unsigned h = seed ^ (unsigned(x) * 0x9E3779B1u) ^ (unsigned(z) * 0x85EBCA77u);
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return float(h >> 8) * (1.0f / 16777216.0f) - 0.5f;
+}
+
+// Run rowFunc(z) for z = first, first + stride, ... < last.  Large passes are split into bands of rows and
+// spread across the thread pool; small ones aren't worth the hand-off.
+template <class RowFunc>
+static void forEachRow(int first, int last, int stride, int pointsPerRow, RowFunc rowFunc)
+{
+    int rows = (last - first + stride - 1) / stride;
+    if (rows <= 0)
+        return;
+
+    if (rows * pointsPerRow < DS_SERIAL_POINTS || QThread::idealThreadCount() < 2)
+    {
+        for (int z = first; z < last; z += stride)
+            rowFunc(z);
+        return;
+    }
+
+    QVector<int> bands;
+    for (int r = 0; r < rows; r += DS_ROWS_PER_TASK)
+        bands.append(r);
+
+    QtConcurrent::blockingMap(bands, [=](const int &band) {
+        int end = qMin(band + DS_ROWS_PER_TASK, rows);
+        for (int r = band; r < end; r++)
+            rowFunc(first + r * stride);
+    });
+}
+
+// Set the center of every square of side 2*half.  Every center has all four corners inside the grid.
+static void squarePass(float *heights, int divs, int half, float amp, unsigned seed)
+{
+    int size = half * 2;
+    forEachRow(half, divs, size, divs / size, [=](int z) {
+        float *row = heights + z * divs;
+        const float *up = row - half * divs;
+        const float *dn = row + half * divs;
+        for (int x = half; x < divs; x += size)
+            row[x] = (up[x - half] + up[x + half] + dn[x - half] + dn[x + half] + amp * cellNoise(seed, x, z)) * 0.25f;
+    });
+}
+
+// Set the midpoint of every edge of the squares of side 2*half.  Points on the outer rows and columns of the
+// grid only have three neighbours.
+static void diamondPass(float *heights, int divs, int half, float amp, unsigned seed)
+{
+    int size = half * 2;
+    int last = divs - 1;
+    const float third = 1.0f / 3.0f;
+
+    // Top and bottom rows: left, right, and the one neighbour inside the grid
+    for (int x = half; x < last; x += size)
+    {
+        float *top = heights;
+        float *bot = heights + last * divs;
+        top[x] = (top[x - half] + top[x + half] + top[x + half * divs] + amp * cellNoise(seed, x, 0)) * third;
+        bot[x] = (bot[x - half] + bot[x + half] + bot[x - half * divs] + amp * cellNoise(seed, x, last)) * third;
+    }
+
+    forEachRow(half, last, half, divs / half, [=](int z) {
+        float *row = heights + z * divs;
+        const float *up = row - half * divs;
+        const float *dn = row + half * divs;
+        int x = half;
+
+        if ((z / half) & 1)
+        {
+            // Rows through the square centers start and end on the grid's left and right edges
+            row[0] = (row[half] + up[0] + dn[0] + amp * cellNoise(seed, 0, z)) * third;
+            row[last] = (row[last - half] + up[last] + dn[last] + amp * cellNoise(seed, last, z)) * third;
+            x = size;
+        }
+
+        for (; x < last; x += size)
+            row[x] = (row[x - half] + row[x + half] + up[x] + dn[x] + amp * cellNoise(seed, x, z)) * 0.25f;
+    });
+}
+
+void diamondSquare(float *heights, int divs, float roughness, unsigned seed, bool presetCenter)
+{
+    for (int half = (divs - 1) / 2; half >= 1; half /= 2)
+    {
+        float amp = half * roughness;
+
+        // skip the first square step if the center point is pre-set (allows biasing the shape of the terrain)
+        if (!(presetCenter && half == (divs - 1) / 2))
+            squarePass(heights, divs, half, amp, seed);
+        diamondPass(heights, divs, half, amp, seed);
+    }
+}
@@ -0,0 +1,32 @@
+/****************************************************************************
+**
+** Diamond-square terrain generator over a flat array of heights.  Every point
+** of a given step size depends only on points set by earlier steps, so each
+** pass runs across rows on all cores.  The random offset for a point is a
+** hash of the seed and its grid coordinates, so the result is the same for
+** any thread count or scheduling order.
+**
+** The algorithm was first introduced by Fournier, Fussell and Carpenter at
+** SIGGRAPH 1982:
+**   Fournier, Alain; Fussell, Don; Carpenter, Loren (June 1982). "Computer
+**   rendering of stochastic models". Communications of the ACM. 25 (6):
+**   371–384. doi:10.1145/358523.358553
+**   https://en.wikipedia.org/wiki/Diamond-square_algorithm
+**
+** Based on the example code found at:
+**   https://medium.com/@nickobrien/diamond-square-algorithm-explanation-and-c-implementation-5efa891e486f
+**
+****************************************************************************/
+
+#ifndef DIAMONDSQUARE_H
+#define DIAMONDSQUARE_H
+
+#define DS_ROWS_PER_TASK 16   // rows of a pass handed to one worker thread at a time
+#define DS_SERIAL_POINTS 4096 // passes with fewer points than this run on the calling thread
+
+// Fill in the heights of a divs x divs grid (divs must be 2^n+1).  The four corners, and the center when
+// presetCenter is true, must already be set.  A point set at step size s is offset by a random amount of
+// up to +/- s*roughness/2 before averaging.
+void diamondSquare(float *heights, int divs, float roughness, unsigned seed, bool presetCenter = false);
+
+#endif // DIAMONDSQUARE_H
@@ -0,0 +1,25 @@
+/****************************************************************************
+**
+** Fragment shader for the depth pre-pass.  Writes no color; it only makes
+** the same alpha cutout test as fmain.glsl, so that the depth buffer holds
+** exactly the tree fragments that will be seen.  The shading pass then
+** lights just those, with no discard to slow it down.  Used with
+** vmain.glsl.
+**
+****************************************************************************/
+
+#version 330 core
+
+#include "material.glsl"
+
+uniform sampler2DArray textures; // every surface texture, one per layer
+
+in vec2 v_texcoord;
+flat in float v_lodDistance; // distance to the tree, divided by its scale
+
+void main(void)
+{
+    material m = materials[materialIndex];
+    if (texture(textures, vec3(v_texcoord, m.layer)).a < 0.5 || lodHidden(m, v_lodDistance))
+        discard;
+}
@@ -0,0 +1,25 @@
+/****************************************************************************
+**
+** Fragment shader for the tree impostors.  The baked views are already
+** lit, so the color is used as it is.  The cutout and the cross-fade with
+** the last level of detail of the tree model work as in fmain.glsl.
+**
+****************************************************************************/
+
+#version 330 core
+
+#include "material.glsl"
+
+uniform sampler2D tex; // the baked views
+
+in vec2 v_texcoord;
+flat in float v_lodDistance; // distance to the tree, divided by its scale
+
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = texture(tex, v_texcoord);
+    if (fragColor.a < 0.5 || lodHidden(materials[materialIndex], v_lodDistance))
+        discard;
+}
@@ -9,42 +9,65 @@
 ** Technique for texture cutouts based on alpha-channel:
 **   https://en.wikibooks.org/wiki/GLSL_Programming/Unity/Transparent_Textures
 **
+** The cutouts are only compiled in when ALPHA_TEST is defined.  A shader
+** that can discard keeps the GPU from rejecting hidden fragments before
+** shading them, so opaque surfaces, and trees whose cutouts are already in
+** the depth buffer from fdepth.glsl, use the version without.
+**
 ****************************************************************************/
 
-uniform vec3 lightPosition;
-uniform sampler2D texture;
-uniform vec4 MatAmbient;
-uniform vec4 MatDiffuse;
-uniform vec4 MatSpecular;
-uniform float MatShininess;
+#version 330 core
+
+// Camera and light for the frame (see frameBlock in rendercommand.h)
+layout(std140) uniform frameData
+{
+    mat4 mvp_matrix;
+    mat4 mv_matrix;
+    mat3 normalMatrix;
+    vec4 lightPosition; // eye coordinates
+};
+
+#include "material.glsl"
+
+uniform sampler2DArray textures; // every surface texture, one per layer
+
+in vec2 v_texcoord;
+in vec3 N;
+in vec3 v;    
+flat in float v_lodDistance; // distance to the tree, divided by its scale
 
-varying vec2 v_texcoord;
-varying vec3 N;
-varying vec3 v;    
+out vec4 fragColor;
 
 void main (void)  
 {  
-    vec3 L = normalize(lightPosition - v);   
+    material m = materials[materialIndex];
+    vec4 texel = texture(textures, vec3(v_texcoord, m.layer));
+
+#ifdef ALPHA_TEST
+    // If the texture alpha is less than a threshold, then throw the fragment away, before any lighting is done for it.
+    // Cutouts are that simple.  fdepth.glsl makes the same test.  The same goes for pixels left to another level of
+    // detail.
+    if (texel.a < 0.5 || lodHidden(m, v_lodDistance))
+        discard;
+#endif
+
+    vec3 L = normalize(lightPosition.xyz - v);   
     vec3 E = normalize(-v); // we are in Eye Coordinates, so EyePos is (0,0,0)  
     vec3 R = normalize(-reflect(L,N));  
 
     //calculate Ambient Term:  
-    vec4 Iamb = MatAmbient;    
+    vec4 Iamb = m.MatAmbient;    
 
     //calculate Diffuse Term:  
-    vec4 Idiff = MatDiffuse * max(dot(N,L), 0.0);
+    vec4 Idiff = m.MatDiffuse * max(dot(N,L), 0.0);
     Idiff = clamp(Idiff, 0.0, 1.0);     
 
     // calculate Specular Term:
-    vec4 Ispec = MatSpecular 
-                * pow(max(dot(R,E),0.0),0.3*MatShininess);
+    vec4 Ispec = m.MatSpecular 
+                * pow(max(dot(R,E),0.0),0.3*m.MatShininess);
     Ispec = clamp(Ispec, 0.0, 1.0); 
 
     // write Total Color:  
-    gl_FragColor = (Iamb + Idiff + Ispec) * texture2D(texture,v_texcoord);
-
-    // If the fragment alpha is less than a threshold, then throw it away.  Cutouts are that simple.
-    if (gl_FragColor.a < 0.5)
-        discard;
+    fragColor = (Iamb + Idiff + Ispec) * texel;
 }
           
\ No newline at end of file
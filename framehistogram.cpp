@@ -0,0 +1,92 @@
+/****************************************************************************
+**
+** Frame-time histogram.  See framehistogram.h.
+**
+****************************************************************************/
+
+#include "framehistogram.h"
+
+#include <QSaveFile>
+#include <QTextStream>
+#include <QtGlobal>
+
+#include <iostream>
+using namespace std;
+
+frameHistogram::frameHistogram(float budgetMs) : budget(budgetMs)
+{
+    clear();
+}
+
+void frameHistogram::clear(void)
+{
+    bucket.fill(0, HISTOGRAM_BUCKETS);
+    samples = over = 0;
+    total = 0.0;
+    worst = 0.0f;
+}
+
+void frameHistogram::add(float ms)
+{
+    int i = qBound(0, int(ms / HISTOGRAM_BUCKET_MS), HISTOGRAM_BUCKETS - 1);
+    bucket[i]++;
+    samples++;
+    total += ms;
+    worst = qMax(worst, ms);
+    if (budget > 0.0f && ms > budget)
+        over++;
+}
+
+float frameHistogram::percentile(float p) const
+{
+    int target = qMax(1, int(p * samples + 0.5f)), seen = 0;
+    for (int i = 0; i < bucket.size(); i++)
+    {
+        seen += bucket[i];
+        if (seen >= target)
+            return i + 1 < bucket.size() ? (i + 1) * HISTOGRAM_BUCKET_MS : worst;
+    }
+    return worst;
+}
+
+QString frameHistogram::summary(const QString &name) const
+{
+    QString line = QString("%1 %2 x, avg %3, p50 %4, p99 %5, max %6 ms").arg(name, -8).arg(samples, 6)
+                       .arg(average(), 5, 'f', 2).arg(percentile(0.5f), 5, 'f', 1).arg(percentile(0.99f), 5, 'f', 1)
+                       .arg(longest(), 6, 'f', 1);
+    if (budget > 0.0f)
+        line += QString(", %1% over %2 ms").arg(samples ? 100.0 * over / samples : 0.0, 4, 'f', 1).arg(budget, 0, 'f', 1);
+    return line;
+}
+
+bool writeHistograms(const QString &fileName, const QStringList &names, const QVector<const frameHistogram *> &histograms)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        cerr << "Can't write histograms to " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "from_ms";
+    for (int h = 0; h < names.size(); h++)
+        out << "," << names[h];
+    out << "\n";
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        out << i * HISTOGRAM_BUCKET_MS;
+        for (int h = 0; h < histograms.size(); h++)
+            out << "," << histograms[h]->bucketCount(i);
+        out << "\n";
+    }
+    out.flush();
+
+    if (!file.commit())
+    {
+        cerr << "Can't write histograms to " << fileName.toStdString() << endl;
+        return false;
+    }
+    cout << "Histograms written to " << fileName.toStdString() << endl;
+    return true;
+}
@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Frame-time histogram.  Counts how many frames (or input events) took
+** each length of time, in buckets of HISTOGRAM_BUCKET_MS, along with how
+** many went over a budget.  Unlike the profiler's rolling window it keeps
+** everything since it was last cleared, so it shows the occasional long
+** frame that a short window would miss.
+**
+****************************************************************************/
+
+#ifndef FRAMEHISTOGRAM_H
+#define FRAMEHISTOGRAM_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#define HISTOGRAM_BUCKET_MS 0.5f   // width of each bucket
+#define HISTOGRAM_BUCKETS 200      // the last bucket also holds everything longer
+#define FRAME_BUDGET_MS (1000.0f / 60.0f) // frame time to count overruns against, unless told otherwise
+
+class frameHistogram
+{
+public:
+    explicit frameHistogram(float budgetMs = 0.0f); // a budget of 0 means none
+
+    void add(float ms);
+    void clear(void);
+
+    void setBudget(float ms) { budget = ms; } // doesn't recount what's already been added
+    float getBudget(void) const { return budget; }
+
+    int count(void) const { return samples; }
+    int overBudget(void) const { return over; }
+    float average(void) const { return samples ? float(total / samples) : 0.0f; }
+    float longest(void) const { return worst; }
+    float percentile(float p) const; // upper edge of the bucket holding the p'th fraction of the samples
+
+    // One line: count, average, p50/p99, longest, and the share over budget
+    QString summary(const QString &name) const;
+
+    int buckets(void) const { return bucket.size(); }
+    int bucketCount(int i) const { return bucket[i]; }
+
+private:
+    QVector<int> bucket;
+    float budget;
+    int samples, over;
+    double total;
+    float worst;
+};
+
+// Write histograms side by side, one row per bucket and one column per histogram
+bool writeHistograms(const QString &fileName, const QStringList &names, const QVector<const frameHistogram *> &histograms);
+
+#endif // FRAMEHISTOGRAM_H
@@ -7,13 +7,17 @@
 **
 ****************************************************************************/
 
-uniform sampler2D texture;
+#version 330 core
 
-varying vec2 v_texcoord;
+uniform sampler2D tex;
+
+in vec2 v_texcoord;
+
+out vec4 fragColor;
 
 void main()
 {
     // Set fragment color from texture
-    gl_FragColor = texture2D(texture, v_texcoord);
+    fragColor = texture(tex, v_texcoord);
 }
 
@@ -7,50 +7,226 @@
 
 #include <QVector2D>
 #include <QVector3D>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QOpenGLPixelTransferOptions>
+#include <QStandardPaths>
+#include <QtConcurrent>
 #include "geometryengine.h"
-#include <float.h> // for FLT_MAX
-#include <math.h>  // for sqrt()
+#include "diamondsquare.h"
+#include "meshfile.h"
+#include "meshsimplify.h"
+#include "poissondisk.h"
+#include <algorithm> // for std::sort()
+#include <float.h>  // for FLT_MAX
+#include <limits.h> // for INT_MAX
+#include <math.h>   // for sqrt()
+#include <string.h> // for memcpy()
 
 #include <iostream>
 using namespace std;
 
-GeometryEngine::GeometryEngine() : skyVertBuf(QOpenGLBuffer::VertexBuffer),
-                                   skyFacetsBuf(QOpenGLBuffer::IndexBuffer),
-                                   landVertBuf(QOpenGLBuffer::VertexBuffer),
-                                   landFacetsBuf(QOpenGLBuffer::IndexBuffer),
-                                   waterVertBuf(QOpenGLBuffer::VertexBuffer),
-                                   waterFacetsBuf(QOpenGLBuffer::IndexBuffer),
-                                   waterLevel(-WORLD_DIM),
-                                   tree("Spruce.obj")
+// The impostor views' cells must break evenly into pixels of the last mipmap level, with at least one of them for the
+// gutter (see bakeImpostors())
+static_assert(IMPOSTOR_GUTTER >= 1 << (IMPOSTOR_LEVELS - 1) &&
+                  (IMPOSTOR_SIZE + 2 * IMPOSTOR_GUTTER) % (1 << (IMPOSTOR_LEVELS - 1)) == 0,
+              "IMPOSTOR_GUTTER is too small for IMPOSTOR_LEVELS");
+
+// Hash of every parameter that affects world generation, so that cached worlds are regenerated when any of them change
+static quint64 worldParams(void)
+{
+    const float params[] = {WORLD_GEN_VERSION, LAND_DIVS, WORLD_DIM, TERRAIN_RANGE, TERRAIN_SMOOTH, WATER_LEVEL,
+                            WATER_START_PROX, EYE_HEIGHT, LAKE_RETRIES, TREE_COUNT, TREE_RANGE_L, TREE_RANGE_H,
+                            TREE_SINK, TREE_MIN_PROX, TREE_SPREAD, TREE_LINE, TREE_SLOPE_MAX, TREE_MAX_ATTEMPTS,
+                            POISSON_CANDIDATES, POISSON_RESEED_TRIES, POISSON_DENSITY_MIN};
+
+    // 64-bit FNV-1a
+    const unsigned char *p = (const unsigned char *)params;
+    quint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(params); i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Distance (divided by the tree's scale) at which trees switch to a level of detail from the one before.  Level
+// TREE_LODS is the impostors.
+static float treeLodDistance(int level)
+{
+    return level ? TREE_LOD_DISTANCE * float(1 << (level - 1)) : 0.0f;
+}
+
+GeometryEngine::GeometryEngine(quint32 seed, bool useCache) : skyVertBuf(QOpenGLBuffer::VertexBuffer),
+                                                              skyFacetsBuf(QOpenGLBuffer::IndexBuffer),
+                                                              landVertBuf(QOpenGLBuffer::VertexBuffer),
+                                                              landFacetsBuf(QOpenGLBuffer::IndexBuffer),
+                                                              landPatchBuf(QOpenGLBuffer::VertexBuffer),
+                                                              waterVertBuf(QOpenGLBuffer::VertexBuffer),
+                                                              waterFacetsBuf(QOpenGLBuffer::IndexBuffer),
+                                                              impostorVertBuf(QOpenGLBuffer::VertexBuffer),
+                                                              impostorFacetsBuf(QOpenGLBuffer::IndexBuffer),
+                                                              impostorInstBuf(QOpenGLBuffer::VertexBuffer),
+                                                              impostorTexture(0),
+                                                              treeGrid(WORLD_DIM, TREE_GRID_CELL),
+                                                              surfaceTexture(0),
+                                                              landHeightTexture(0),
+                                                              pager(0),
+                                                              waterLevel(-WORLD_DIM),
+                                                              waterMoved(false),
+                                                              worldSeed(seed),
+                                                              requestedSeed(seed),
+                                                              useCache(useCache),
+                                                              heightTexture(false),
+                                                              streaming(false)
 {
     initializeOpenGLFunctions();
+    compressTextures = textureCompressionSupported();
+
+    // Nothing has been culled yet
+    stats = {0, 0, TILE_COUNT * TILE_COUNT, 0, true};
+}
 
+// Pack a unit normal into GL_INT_2_10_10_10_REV:  x, y and z as 10-bit signed normalized integers, from the low bits up
+static GLuint packNormal(const QVector3D &normal)
+{
+    QVector3D n = normal.normalized();
+    GLuint x = GLuint(qRound(n.x() * 511.0f)) & 0x3ff;
+    GLuint y = GLuint(qRound(n.y() * 511.0f)) & 0x3ff;
+    GLuint z = GLuint(qRound(n.z() * 511.0f)) & 0x3ff;
+    return x | y << 10 | z << 20;
+}
+
+// Octahedral encoding of a unit normal (Meyer et al., "On Floating-Point Normal Vectors", 2010):  project it onto the
+// octahedron |x|+|y|+|z| = 1, unfold the lower half over the upper, and keep x and z.  The land's normals point
+// mostly up, so it's the y < 0 half that gets folded.  vland.glsl decodes it.
+static void packOctahedral(const QVector3D &normal, GLbyte out[2])
+{
+    float l1 = fabsf(normal.x()) + fabsf(normal.y()) + fabsf(normal.z());
+    float x = l1 > 0.0f ? normal.x() / l1 : 0.0f;
+    float z = l1 > 0.0f ? normal.z() / l1 : 0.0f;
+    if (normal.y() < 0.0f)
+    {
+        float fx = (1.0f - fabsf(z)) * (x < 0.0f ? -1.0f : 1.0f);
+        float fz = (1.0f - fabsf(x)) * (z < 0.0f ? -1.0f : 1.0f);
+        x = fx;
+        z = fz;
+    }
+    out[0] = GLbyte(qRound(x * 127.0f));
+    out[1] = GLbyte(qRound(z * 127.0f));
+}
+
+// Quantize a land height to 16 bits over -WORLD_DIM..WORLD_DIM
+static GLushort packHeight(float y)
+{
+    return GLushort(qRound(qBound(0.0f, (y + WORLD_DIM) / (WORLD_DIM * 2.0f), 1.0f) * 65535.0f));
+}
+
+// Quantize a tree model section for the GPU
+static QVector<treeVertexData> packTreeVertices(const vertexData *vertex, int vertexCount)
+{
+    QVector<treeVertexData> packed(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        packed[i].position = vertex[i].position;
+        packed[i].texCoord[0] = qfloat16(vertex[i].texCoord.x());
+        packed[i].texCoord[1] = qfloat16(vertex[i].texCoord.y());
+        packed[i].normal = packNormal(vertex[i].normal);
+    }
+    return packed;
+}
+
+// CPU side of loading.  Safe to run on a worker thread.
+void GeometryEngine::prepare(void)
+{
+    // The tree model and its textures don't depend on the world, so read them while the world is being made
+    QFuture<void> trees = QtConcurrent::run([this]() {
+        prepareTreeGeometry();
+        prepareTextures();
+    });
+
+    // The streaming world makes its pages as they're needed.  Only the ones around the start are made here.
+    if (streaming)
+    {
+        trees.waitForFinished();
+        prepareLandIndices();
+        preparePages();
+        return;
+    }
+
+    // Load the world from the cache if it has been generated before.  Otherwise generate it, and cache it for next time.
+    landHeight.resize(LAND_DIVS * LAND_DIVS);
+    landVerts.resize(LAND_DIVS * LAND_DIVS);
+    worldCache cache(requestedSeed, worldParams());
+    if (!useCache || !loadWorld(cache))
+    {
+        generateWorld(requestedSeed);
+        if (useCache)
+            saveWorld(cache);
+    }
+    prepareLandGeometry();
+
+    trees.waitForFinished();
+    prepareTreeInstances();
+}
+
+// GL side of loading.  Must run on the GL context's thread.
+bool GeometryEngine::upload(renderQueue &queue)
+{
     // Generate VBOs
     skyVertBuf.create();
     skyFacetsBuf.create();
     landVertBuf.create();
     landFacetsBuf.create();
+    landPatchBuf.create();
+    for (int l = 0; l < TILE_LODS; l++)
+        landInstBuf[l].create();
     waterVertBuf.create();
     waterFacetsBuf.create();
+    for (int l = 0; l < TREE_LODS; l++)
+        treeInstBuf[l].create();
+    impostorVertBuf.create();
+    impostorFacetsBuf.create();
+    impostorInstBuf.create();
 
     // Initialize the geometries and transfer them to the VBOs
     initSkyCubeGeometry();
     initLandGeometry();
     initWaterGeometry();
     initTreeGeometry();
-    placeTrees();
+    initTreeInstances();
+    initImpostorGeometry();
+    initTextures();
+    return initMeshes(queue);
 }
 
 GeometryEngine::~GeometryEngine()
 {
-    for (int i = 0; i < tree.data.section.size(); i++)
-        delete treeTexture[i];
+    delete surfaceTexture;
+    delete impostorTexture;
+    delete landHeightTexture;
+    delete pager;
+    skyMesh.destroy(this);
+    landMesh.destroy(this);
+    for (int l = 0; l < TILE_LODS; l++)
+        landPatchMesh[l].destroy(this);
+    waterMesh.destroy(this);
+    impostorMesh.destroy(this);
+    for (int i = 0; i < treeSectionMesh.size(); i++)
+        treeSectionMesh[i].destroy(this);
     skyVertBuf.destroy();
     skyFacetsBuf.destroy();
     landVertBuf.destroy();
     landFacetsBuf.destroy();
+    landPatchBuf.destroy();
+    for (int l = 0; l < TILE_LODS; l++)
+        landInstBuf[l].destroy();
     waterVertBuf.destroy();
     waterFacetsBuf.destroy();
+    for (int l = 0; l < TREE_LODS; l++)
+        treeInstBuf[l].destroy();
+    impostorVertBuf.destroy();
+    impostorFacetsBuf.destroy();
+    impostorInstBuf.destroy();
     for (int i = 0; i < treeVertBuf.size(); i++)
     {
         // It is safe to assume the vertex and facet buffer arrays are the same size
@@ -59,88 +235,290 @@ GeometryEngine::~GeometryEngine()
     }
 }
 
-// Initialize the geometry for a tree
-void GeometryEngine::initTreeGeometry()
+// Generate the terrain, water level, starting position and tree placements for a world
+void GeometryEngine::generateWorld(quint32 seed)
 {
-    // The obj loader has vertices, texture coordinates, and normal coordinates in three separate arrays which are indexed independently,
-    // reflecting the format of an obj file.  For OpenGL VBO's, this has to be consolidated into packed vertex arrays.
-
-    // Since the obj format potentially has multiple object sections with different materials on each section, set an array of dynamic
-    // arrays.  Each vertex / index pair will represent a single "object section" such as trunk, branches
-    int numSections = tree.data.section.size();
-
-    QVector<vertexData> vertex[numSections]; // Dynamically sized array of fixed-size arrays
-    QVector<GLushort> index[numSections];
+    // Look for a world with a lake in front of the starting position.  If there isn't one, delete this world and make
+    // another one.  Oh, the POWER!!!  Each retry uses the next seed, so a given seed always ends up with the same world.
+    bool foundLake = false;
+    for (int attempt = 0; attempt <= LAKE_RETRIES && !foundLake; attempt++)
+    {
+        worldSeed = seed + attempt;
+        generateTerrain();
+        buildLandVerts();
+        computeLandNormals();
 
-    facetChunk.clear();
+        // Dynamically set the water level
+        waterLevel = landAvg + WATER_LEVEL;
 
-    for (int i = 0; i < numSections; i++)
-    {
-        objectSection *s = &tree.data.section[i];
-        // Materials properties
-        materialData *mtl = &(s->mtl);
+        // Adjust starting position to be near the lake.
+        startPos = QVector3D(WORLD_DIM - 1.0f, 0.0f, WORLD_DIM - 1.0f);
+        foundLake = adjustViewerPos(startPos, QVector2D(-0.707106781, -0.707106781));
+    }
 
-        // Set up the texture for this section
-        treeTexture << new QOpenGLTexture(QImage(mtl->map_d_filename).mirrored());
-        treeTexture.last()->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
-        treeTexture.last()->setMagnificationFilter(QOpenGLTexture::Linear);
-        treeTexture.last()->setWrapMode(QOpenGLTexture::Repeat);
+    // No lake anywhere; just start among the trees
+    if (!foundLake)
+        startPos = QVector3D(WORLD_DIM - 1.0f, 0.0f, WORLD_DIM - 1.0f);
+    startPos.setY(getHeight(startPos.x(), startPos.z()) + EYE_HEIGHT);
 
-        // Iterate through the facets and build the packed vertex array to match it
-        facetChunkData fc = {0, 0};
-        facetChunk << QVector<facetChunkData>();
+    placeTrees();
+    cout << "Generated world " << worldSeed << (worldSeed != seed ? " (retried for a lake)" : "") << endl;
+}
 
-        for (int j = 0; j < s->f.size(); j++)
-        {
-            int i_v = s->f[j].v;      // Index into the obj vertex array
-            int i_vt = s->f[j].vt;    // Index into the obj texture coordinate array
-            int i_vn = s->f[j].vn;    // Index into the obj normal array
-            bool edge = s->f[j].edge; // true if this is the last vertex in a facet
+// Load a previously generated world from the cache.  Returns false if it isn't there.
+bool GeometryEngine::loadWorld(worldCache &cache)
+{
+    if (!cache.open(LAND_DIVS))
+        return false;
+
+    const worldInfo &info = cache.info();
+    worldSeed = info.seed;
+    landAvg = info.landAvg;
+    waterLevel = info.waterLevel;
+    startPos = QVector3D(info.startX, info.startY, info.startZ);
+
+    memcpy(landHeight.data(), cache.heights(), landHeight.size() * sizeof(float));
+    buildLandVerts();
+    const QVector3D *normals = cache.normals();
+    for (int i = 0; i < LAND_DIVS * LAND_DIVS; i++)
+        landVerts[i].normal = normals[i];
+
+    treeSpot.resize(cache.treeCount());
+    memcpy(treeSpot.data(), cache.trees(), treeSpot.size() * sizeof(QVector4D));
+    treeGrid.clear();
+    for (int i = 0; i < treeSpot.size(); i++)
+        treeGrid.insert(i, treeSpot[i].x(), treeSpot[i].z());
+
+    cout << "Loaded world " << worldSeed << " from " << cache.fileName().toStdString() << endl;
+    cache.close();
+    return true;
+}
 
-            vertexData vd = {tree.data.v[i_v - 1], tree.data.vt[i_vt - 1], tree.data.vn[i_vn - 1]};
+// Save the current world to the cache
+void GeometryEngine::saveWorld(worldCache &cache)
+{
+    QVector<QVector3D> normals(LAND_DIVS * LAND_DIVS);
+    for (int i = 0; i < LAND_DIVS * LAND_DIVS; i++)
+        normals[i] = landVerts[i].normal;
 
-            // If VBO size becomes an issue, optimize by adding code to search if a vertex set is already in the array, and
-            // re-use if it is.
+    worldInfo info = {worldSeed, landAvg, waterLevel, startPos.x(), startPos.y(), startPos.z()};
+    cache.save(LAND_DIVS, info, landHeight.constData(), normals.constData(), treeSpot.constData(), treeSpot.size());
+}
 
-            vertex[i] << vd;
-            index[i] << vertex[i].size() - 1;
-            fc.count++;
-            if (edge)
-            {
-                // repeat the first index of the chunk to close the poly
-                vertex[i] << vertex[i][fc.base];
-                index[i] << vertex[i].size() - 1;
-                fc.count++;
+// Read the tree model
+void GeometryEngine::prepareTreeGeometry()
+{
+    // Use the converted mesh file if there is one; it maps straight into the VBOs without any parsing.  Look next to
+    // the application (where objconvert puts it) and then in the cache.  Failing that, parse the obj, convert it, and
+    // save the result in the cache for next time.
+    QString objName = OBJ_RESOURCE_DIR TREE_OBJ;
+    QString meshName = QFileInfo(TREE_OBJ).completeBaseName() + ".mesh";
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    quint64 key = meshSourceKey(objName);
+
+    treeSections.clear();
+    if (!treeMesh.open(QCoreApplication::applicationDirPath() + "/obj/" + meshName, key) &&
+        !treeMesh.open(cacheDir + "/" + meshName, key))
+    {
+        cout << "Converting " << objName.toStdString() << endl;
+        wavefrontObj tree(TREE_OBJ);
+        buildMesh(tree.data, treeSections);
+        QDir().mkpath(cacheDir);
+        writeMeshFile(cacheDir + "/" + meshName, key, treeSections);
+    }
 
-                // end of a chunk.  Add it to the list.
-                facetChunk.last() << fc;
+    int numSections = treeMesh.sectionCount() ? treeMesh.sectionCount() : treeSections.size();
+    treeMaterial.clear();
+    for (int i = 0; i < numSections; i++)
+        treeMaterial << (treeMesh.sectionCount() ? treeMesh.material(i) : treeSections[i].mtl);
 
-                // start the next chunk
-                fc.base = vertex[i].size();
-                fc.count = 0;
-            }
+    // Bounding box of the tree model, and how far it spreads around the trunk
+    treeMin = QVector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+    treeMax = -treeMin;
+    treeRadius = 0.0f;
+    QVector<meshSection> full(numSections);
+    for (int i = 0; i < numSections; i++)
+    {
+        const vertexData *vertex = treeMesh.sectionCount() ? treeMesh.vertices(i) : treeSections[i].vertex.constData();
+        int vertexCount = treeMesh.sectionCount() ? treeMesh.vertexCount(i) : treeSections[i].vertex.size();
+        const GLuint *index = treeMesh.sectionCount() ? treeMesh.indices(i) : treeSections[i].index.constData();
+        int indexCount = treeMesh.sectionCount() ? treeMesh.indexCount(i) : treeSections[i].index.size();
+        for (int j = 0; j < vertexCount; j++)
+        {
+            const QVector3D &v = vertex[j].position;
+            treeMin = QVector3D(MIN(treeMin.x(), v.x()), MIN(treeMin.y(), v.y()), MIN(treeMin.z(), v.z()));
+            treeMax = QVector3D(MAX(treeMax.x(), v.x()), MAX(treeMax.y(), v.y()), MAX(treeMax.z(), v.z()));
+            treeRadius = MAX(treeRadius, sqrt(v.x() * v.x() + v.z() * v.z()));
         }
+        full[i].vertex = QVector<vertexData>(vertexCount);
+        memcpy(full[i].vertex.data(), vertex, vertexCount * sizeof(vertexData));
+        full[i].index = QVector<GLuint>(indexCount);
+        memcpy(full[i].index.data(), index, indexCount * sizeof(GLuint));
+    }
+
+    // Simplify the model for the farther levels of detail.  Each level starts again from the full model with a grid
+    // half as fine as the level before.
+    treeLodSections.clear();
+    for (int level = 1; level < TREE_LODS; level++)
+    {
+        QVector<meshSection> lod = full;
+        simplifyMesh(lod, treeMin, treeMax, TREE_SIMPLIFY_CELLS >> (level - 1));
+        cout << "Tree level of detail " << level << ": " << countTriangles(full) << " -> " << countTriangles(lod)
+             << " triangles" << endl;
+        treeLodSections << lod;
     }
+}
 
-    // Now create the VBOs and transfer the data
+// Transfer the tree model to the GPU
+void GeometryEngine::initTreeGeometry()
+{
     treeVertBuf.clear();
     treeFacetsBuf.clear();
-    for (int i = 0; i < numSections; i++)
+    int numSections = treeMaterial.size();
+    for (int b = 0; b < TREE_LODS * numSections; b++)
     {
+        // Each object section, such as trunk or branches, has its own material, vertex array, and index array.  Level 0
+        // is the model as loaded; the other levels were simplified from it.
+        int level = b / numSections, i = b % numSections;
+        const vertexData *vertex;
+        const GLuint *index;
+        int vertexCount, indexCount;
+        if (level)
+        {
+            const meshSection &lod = treeLodSections[b - numSections];
+            vertex = lod.vertex.constData();
+            vertexCount = lod.vertex.size();
+            index = lod.index.constData();
+            indexCount = lod.index.size();
+        }
+        else
+        {
+            vertex = treeMesh.sectionCount() ? treeMesh.vertices(i) : treeSections[i].vertex.constData();
+            vertexCount = treeMesh.sectionCount() ? treeMesh.vertexCount(i) : treeSections[i].vertex.size();
+            index = treeMesh.sectionCount() ? treeMesh.indices(i) : treeSections[i].index.constData();
+            indexCount = treeMesh.sectionCount() ? treeMesh.indexCount(i) : treeSections[i].index.size();
+        }
+
+        // Create the VBOs and transfer the data, quantized
+        QVector<treeVertexData> packed = packTreeVertices(vertex, vertexCount);
         treeVertBuf << QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
-        treeVertBuf[i].create();
-        treeVertBuf[i].bind();
-        treeVertBuf[i].allocate(vertex[i].constData(), vertex[i].size() * sizeof(vertex[i][0]));
+        treeVertBuf[b].create();
+        treeVertBuf[b].bind();
+        treeVertBuf[b].allocate(packed.constData(), packed.size() * sizeof(treeVertexData));
 
         treeFacetsBuf << QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
-        treeFacetsBuf[i].create();
-        treeFacetsBuf[i].bind();
-        treeFacetsBuf[i].allocate(index[i].constData(), index[i].size() * sizeof(index[i][0]));
+        treeFacetsBuf[b].create();
+        treeFacetsBuf[b].bind();
+        treeFacetsBuf[b].allocate(index, indexCount * sizeof(GLuint));
     }
+
+    // The data is in the GPU now
+    treeMesh.close();
+    treeSections.clear();
+    treeLodSections.clear();
 }
 
-// Initialize the geometry for the land grid.
-void GeometryEngine::initLandGeometry()
+// Open the cached texture for every layer of the surface texture, decoding and caching them in parallel if this is the
+// first run.  The tree sections' textures come from their materials, so the tree model has to be read first.
+void GeometryEngine::prepareTextures()
+{
+    QStringList names;
+    names << LAND_TEXTURE << WATER_TEXTURE;
+    for (int i = 0; i < treeMaterial.size(); i++)
+        names << OBJ_RESOURCE_DIR + treeMaterial[i].map_d_filename;
+
+    auto loadTexture = [this](const QString &name) {
+        QSharedPointer<textureFile> tex(new textureFile);
+        tex->load(name, compressTextures, TEXTURE_LAYER_SIZE);
+        return tex;
+    };
+    layerFile = QtConcurrent::blockingMapped<QVector<QSharedPointer<textureFile>>>(names, loadTexture);
+}
+
+// Transfer the surface textures to the GPU
+void GeometryEngine::initTextures()
+{
+    surfaceTexture = textureFile::uploadArray(layerFile);
+    surfaceTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
+    surfaceTexture->setMagnificationFilter(QOpenGLTexture::Linear);
+    surfaceTexture->setWrapMode(QOpenGLTexture::Repeat);
+
+    // The data is in the GPU now
+    layerFile.clear();
+}
+
+// Transfer the tree placements to the per-instance attribute buffers.  Each tree is drawn as one instance of the
+// tree model, or of the impostor; the shaders use xyz of the treeSpot as the location and w as the scale factor.
+void GeometryEngine::initTreeInstances()
+{
+    // Until the first cull, draw every tree at full detail
+    for (int l = 0; l <= TREE_LODS; l++)
+        lodSpots[l].resize(0);
+    lodSpots[0] = treeSpot;
+    for (int l = 0; l < TREE_LODS; l++)
+    {
+        treeInstBuf[l].bind();
+        treeInstBuf[l].setUsagePattern(QOpenGLBuffer::DynamicDraw);
+        treeInstBuf[l].allocate(lodSpots[l].constData(), lodSpots[l].size() * sizeof(QVector4D));
+    }
+    impostorInstBuf.bind();
+    impostorInstBuf.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    impostorInstBuf.allocate(0);
+    stats.treesVisible = treeSpot.size();
+}
+
+// Initialize the impostor: one upright quad the size of the tree's outline, which the shader turns to face the viewer
+void GeometryEngine::initImpostorGeometry()
+{
+    unlitVertexData vertices[] = {
+        {QVector3D(-treeRadius, treeMin.y(), 0.0f), QVector2D(0.0f, 0.0f)},
+        {QVector3D(treeRadius, treeMin.y(), 0.0f), QVector2D(1.0f, 0.0f)},
+        {QVector3D(-treeRadius, treeMax.y(), 0.0f), QVector2D(0.0f, 1.0f)},
+        {QVector3D(treeRadius, treeMax.y(), 0.0f), QVector2D(1.0f, 1.0f)},
+    };
+
+    GLushort indices[] = {0, 1, 2, 3};
+
+    impostorVertBuf.bind();
+    impostorVertBuf.allocate(vertices, sizeof(vertices));
+
+    impostorFacetsBuf.bind();
+    impostorFacetsBuf.allocate(indices, sizeof(indices));
+}
+
+// Build the culling quadtree over the trees
+void GeometryEngine::prepareTreeInstances()
+{
+    // Bounding box of each placed tree
+    QVector<QVector3D> boxMin(treeSpot.size()), boxMax(treeSpot.size());
+    for (int i = 0; i < treeSpot.size(); i++)
+    {
+        boxMin[i] = treeSpot[i].toVector3D() + treeMin * treeSpot[i].w();
+        boxMax[i] = treeSpot[i].toVector3D() + treeMax * treeSpot[i].w();
+    }
+    treeCull.build(boxMin, boxMax);
+}
+
+// Generate the terrain heights for worldSeed
+void GeometryEngine::generateTerrain(void)
+{
+    rngStream rng(worldSeed, RNG_TERRAIN);
+
+    // Seed the terrain generator with random heights at the 4 corners.
+    landHeight[Coord_2on1(0, 0)] = rng.uniform(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f);
+    landHeight[Coord_2on1(LAND_DIVS - 1, 0)] = rng.uniform(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f);
+    landHeight[Coord_2on1(0, LAND_DIVS - 1)] = rng.uniform(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f);
+    landHeight[Coord_2on1(LAND_DIVS - 1, LAND_DIVS - 1)] = rng.uniform(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f);
+
+    // Bias the terrain to be bowl shaped by forcing the center point to a very low altitude
+    landHeight[Coord_2on1(LAND_DIVS / 2, LAND_DIVS / 2)] = -TERRAIN_RANGE - 5.0f;
+
+    // Randomize the terrain heights
+    diamondSquare(landHeight.data(), LAND_DIVS, 1.0f / TERRAIN_SMOOTH, rng.next(), true);
+}
+
+// Build the land vertices from the terrain heights.  The normals are filled in separately.
+void GeometryEngine::buildLandVerts(void)
 {
     //
     // Build an array of vertices, texture coords, and normals in local memory
@@ -156,7 +534,7 @@ void GeometryEngine::initLandGeometry()
                 // Vertex
                 QVector3D(
                     -WORLD_DIM + (WORLD_DIM * 2.0f * xfrac),  // Vertex x
-                    -2.0f,                                    // Vertex y (default flat terrain will be refined below)
+                    landHeight[Coord_2on1(xi, zi)],           // Vertex y
                     -WORLD_DIM + (WORLD_DIM * 2.0f * zfrac)), // Vertex z
 
                 // Texture Coordinate
@@ -167,112 +545,274 @@ void GeometryEngine::initLandGeometry()
             };
         }
     }
+}
 
-    // Seed the terrain generator with random heights at the 4 corners.
-    landVerts[Coord_2on1(0, 0)].position.setY(Frand(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f));
-    landVerts[Coord_2on1(LAND_DIVS - 1, 0)].position.setY(Frand(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f));
-    landVerts[Coord_2on1(0, LAND_DIVS - 1)].position.setY(Frand(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f));
-    landVerts[Coord_2on1(LAND_DIVS - 1, LAND_DIVS - 1)].position.setY(Frand(-TERRAIN_RANGE) - (TERRAIN_RANGE / 2.0f));
-
-    // Bias the terrain to be bowl shaped by forcing the center point to a very low altitude
-    landVerts[Coord_2on1(LAND_DIVS / 2, LAND_DIVS / 2)].position.setY(-TERRAIN_RANGE - 5.0f);
-
-    // Randomize the terrain heights
-    diamondSquare(LAND_DIVS, true);
-
-    //
-    // Calculate normals, and also calculate the average elevation for use in determining the water level
-    //
+// Calculate normals, and also calculate the average elevation for use in determining the water level
+void GeometryEngine::computeLandNormals(void)
+{
     landAvg = 0.0;
     for (int zi = 0; zi < LAND_DIVS; zi++)
     {
         for (int xi = 0; xi < LAND_DIVS; xi++)
         {
-            QVector3D p = landVerts[Coord_2on1(xi, zi)].position;
-
-            // Calculate the direction vectors to the (2..4) adjacent grid points.  Handle "edge of the grid" cases with zero vectors
-            // because they will then drop out when used in a cross-product.  (default QVector3d with null constructor is a zero vector)
-            QVector3D va, vb, vc, vd;
-            if (zi)
-                va = landVerts[Coord_2on1(xi, zi - 1)].position - p;
-            if (xi < LAND_DIVS - 1)
-                vb = landVerts[Coord_2on1(xi + 1, zi)].position - p;
-            if (zi < LAND_DIVS - 1)
-                vc = landVerts[Coord_2on1(xi, zi + 1)].position - p;
-            if (xi)
-                vd = landVerts[Coord_2on1(xi - 1, zi)].position - p;
-
-            // Magnitude of the normal vector doesn't matter, so just do a sum to get a vector pointing in the average direction.
-            // Edge cases will drop out due to having one vector (edge) or both vectors (corner) being zero.
-            landVerts[Coord_2on1(xi, zi)].normal = QVector3D::crossProduct(vb, va) + QVector3D::crossProduct(vc, vb) +
-                                                   QVector3D::crossProduct(vd, vc) + QVector3D::crossProduct(vd, va);
-            landAvg += p.y();
+            landVerts[Coord_2on1(xi, zi)].normal = landNormal(xi, zi);
+            landAvg += landVerts[Coord_2on1(xi, zi)].position.y();
         }
     }
     landAvg /= LAND_DIVS * LAND_DIVS;
+}
 
+// Normal of the land at a grid point, from the positions of the points around it
+QVector3D GeometryEngine::landNormal(int xi, int zi)
+{
+    QVector3D p = landVerts[Coord_2on1(xi, zi)].position;
+
+    // Calculate the direction vectors to the (2..4) adjacent grid points.  Handle "edge of the grid" cases with zero vectors
+    // because they will then drop out when used in a cross-product.  (default QVector3d with null constructor is a zero vector)
+    QVector3D va, vb, vc, vd;
+    if (zi)
+        va = landVerts[Coord_2on1(xi, zi - 1)].position - p;
+    if (xi < LAND_DIVS - 1)
+        vb = landVerts[Coord_2on1(xi + 1, zi)].position - p;
+    if (zi < LAND_DIVS - 1)
+        vc = landVerts[Coord_2on1(xi, zi + 1)].position - p;
+    if (xi)
+        vd = landVerts[Coord_2on1(xi - 1, zi)].position - p;
+
+    // Magnitude of the normal vector doesn't matter, so just do a sum to get a vector pointing in the average direction.
+    // Edge cases will drop out due to having one vector (edge) or both vectors (corner) being zero.
+    return QVector3D::crossProduct(vb, va) + QVector3D::crossProduct(vc, vb) + QVector3D::crossProduct(vd, vc) +
+           QVector3D::crossProduct(vd, va);
+}
+
+// Build the vertex and index arrays for the land tiles
+void GeometryEngine::prepareLandGeometry()
+{
     //
-    // Now create the facets (index) array for the land grid
+    // Split the grid into square tiles.  The vertex buffer is laid out tile by tile (vertices on shared tile edges are
+    // repeated) so that every tile can be drawn with the same set of tile-local 16-bit index buffers simply by pointing
+    // the vertex attributes at the start of that tile.  Each vertex is just its quantized height and normal; vland.glsl
+    // works out x and z (and the texture coordinate) from the vertex's place in the buffer.  With the height texture
+    // there is no vertex buffer to lay out, only the heights, but the tiles' extents are still needed.
     //
-    GLuint indices[2 * LAND_DIVS * LAND_DIVS - 4];
-    GLuint *pi = indices; // Use a walking pointer to fill the facet array since we occasionally need to repeat some indices at strip boundaries
-
-    // Build the index list (facets) for a series of triangle strips
-    for (int zi = 0; zi < (LAND_DIVS - 1); zi++) // rows
+    landTileVerts.resize(heightTexture ? 0 : TILE_COUNT * TILE_COUNT * TILE_DIVS * TILE_DIVS);
+    landVertexData *pv = landTileVerts.data();
+    for (int tz = 0; tz < TILE_COUNT; tz++)
     {
-        for (int xi = 0; xi < LAND_DIVS; xi++) // columns
+        for (int tx = 0; tx < TILE_COUNT; tx++)
         {
-            *pi = xi + zi * LAND_DIVS;
-            pi++;
-            if (zi && !xi)
+            float minY = FLT_MAX, maxY = -FLT_MAX;
+            for (int lz = 0; lz < TILE_DIVS; lz++)
             {
-                // Repeat the first index to signify new row, except for row 0
-                *pi = *(pi - 1);
-                pi++;
+                for (int lx = 0; lx < TILE_DIVS; lx++)
+                {
+                    const vertexData &v = landVerts[Coord_2on1(tx * (TILE_DIVS - 1) + lx, tz * (TILE_DIVS - 1) + lz)];
+                    if (!heightTexture)
+                    {
+                        pv->height = packHeight(v.position.y());
+                        packOctahedral(v.normal, pv->normal);
+                        pv++;
+                    }
+                    minY = MIN(minY, v.position.y());
+                    maxY = MAX(maxY, v.position.y());
+                }
             }
 
-            *pi = xi + (zi + 1) * LAND_DIVS;
-            pi++;
+            // Remember the extents of the tile for choosing its level of detail
+            float tileSize = WORLD_DIM * 2.0f / TILE_COUNT;
+            tileMin[Tile_2on1(tx, tz)] = QVector3D(-WORLD_DIM + tx * tileSize, minY, -WORLD_DIM + tz * tileSize);
+            tileMax[Tile_2on1(tx, tz)] = QVector3D(-WORLD_DIM + (tx + 1) * tileSize, maxY, -WORLD_DIM + (tz + 1) * tileSize);
         }
-        if (zi < (LAND_DIVS - 2))
+    }
+
+    landHeightData.resize(heightTexture ? LAND_DIVS * LAND_DIVS : 0);
+    for (int i = 0; i < landHeightData.size(); i++)
+        landHeightData[i] = packHeight(landVerts[i].position.y());
+
+    prepareLandIndices();
+
+    // Build the culling quadtree over the tiles.  Until the first cull, every tile is drawn.
+    QVector<QVector3D> boxMin(TILE_COUNT * TILE_COUNT), boxMax(TILE_COUNT * TILE_COUNT);
+    for (int t = 0; t < TILE_COUNT * TILE_COUNT; t++)
+    {
+        boxMin[t] = tileMin[t];
+        boxMax[t] = tileMax[t];
+        visibleTiles << t;
+    }
+    tileCull.build(boxMin, boxMax);
+}
+
+// Create the facets (index) arrays for the land tiles.  Every level of detail gets 16 variants; one for each
+// combination of tile edges that have to be stitched to a coarser neighbor.  All of them are packed into a single
+// index buffer.
+void GeometryEngine::prepareLandIndices()
+{
+    landIndices.clear();
+    for (int lod = 0; lod < TILE_LODS; lod++)
+    {
+        for (int mask = 0; mask < 16; mask++)
         {
-            // Double the last index in a row to signify end of row, except for last row
-            *pi = *(pi - 1);
-            pi++;
+            landLod[lod][mask].offset = landIndices.size();
+            if (lod < TILE_LODS - 1 || mask == 0) // There is nothing coarser than the coarsest level to stitch to
+                buildTileIndices(lod, mask, landIndices);
+            landLod[lod][mask].count = landIndices.size() - landLod[lod][mask].offset;
         }
     }
+}
+
+// Start the streaming world:  find the place to start, by the water, and make the pages in view of it.  The pages'
+// bounding boxes take in their trees, so the tree model has to have been read.
+void GeometryEngine::preparePages()
+{
+    // The noise the land is made from averages out to 0, so the water is where it would be in a world of fixed size
+    worldSeed = requestedSeed;
+    landAvg = 0.0f;
+    waterLevel = landAvg + WATER_LEVEL;
+    pager = new worldPager(worldSeed, waterLevel, treeMin, treeMax);
+
+    // Look for the shore the same way generateWorld() does.  There's always more world, but this only searches the
+    // part the fixed size world would cover.
+    startPos = QVector3D(WORLD_DIM - 1.0f, 0.0f, WORLD_DIM - 1.0f);
+    if (!adjustViewerPos(startPos, QVector2D(-0.707106781, -0.707106781)))
+        startPos = QVector3D(WORLD_DIM - 1.0f, 0.0f, WORLD_DIM - 1.0f);
+    startPos.setY(getHeight(startPos.x(), startPos.z()) + EYE_HEIGHT);
+
+    // No page is in the height texture yet
+    windowPage.fill(QPoint(INT_MAX, INT_MAX), STREAM_PAGES * STREAM_PAGES);
 
+    pager->preload(startPos.x(), startPos.z(), STREAM_RADIUS);
+    cout << "Streaming world " << worldSeed << " (" << pager->pageCount() << " pages made around the start)" << endl;
+}
+
+// Transfer the land tiles to the VBOs
+void GeometryEngine::initLandGeometry()
+{
     landVertBuf.bind();
-    landVertBuf.allocate(landVerts, sizeof(landVerts));
+    landVertBuf.allocate(landTileVerts.constData(), landTileVerts.size() * sizeof(landVertexData));
 
     landFacetsBuf.bind();
-    landFacetsBuf.allocate(indices, sizeof(indices));
+    landFacetsBuf.allocate(landIndices.constData(), landIndices.size() * sizeof(GLushort));
+
+    if (heightTexture)
+    {
+        // One texel per grid point.  vland.glsl reads them with texelFetch(), so there's no filtering or mipmapping.
+        // The rows are an odd number of 16-bit texels long, so they aren't 4-byte aligned.  The streaming world's
+        // pages go in as they arrive (see uploadPage()).
+        QOpenGLPixelTransferOptions rows;
+        rows.setAlignment(2);
+        landHeightTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        landHeightTexture->setFormat(QOpenGLTexture::R16_UNorm);
+        landHeightTexture->setSize(streaming ? STREAM_WINDOW : LAND_DIVS, streaming ? STREAM_WINDOW : LAND_DIVS);
+        landHeightTexture->setMipLevels(1);
+        landHeightTexture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::UInt16);
+        if (!streaming)
+            landHeightTexture->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt16, landHeightData.constData(), &rows);
+        landHeightTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        landHeightTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+
+        // The patch every tile is drawn from:  just the tile's grid points, in the order the index buffers expect
+        QVector<patchVertexData> patch;
+        for (int lz = 0; lz < TILE_DIVS; lz++)
+            for (int lx = 0; lx < TILE_DIVS; lx++)
+                patch << patchVertexData{GLushort(lx), GLushort(lz)};
+        landPatchBuf.bind();
+        landPatchBuf.allocate(patch.constData(), patch.size() * sizeof(patchVertexData));
+    }
+
+    // The data is in the GPU now
+    landTileVerts = QVector<landVertexData>();
+    landHeightData = QVector<GLushort>();
+    landIndices = QVector<GLushort>();
 }
 
-// Initialize the geometry for the water.  This is just a simple flat planar surface with a repeating water texture
-void GeometryEngine::initWaterGeometry()
+// Add a triangle to an index list, unless stitching has collapsed it to a line or a point
+static void appendTriangle(QVector<GLushort> &indices, GLushort a, GLushort b, GLushort c)
 {
-    // Dynamically set the water level
-    waterLevel = landAvg + WATER_LEVEL;
+    if (a != b && a != c && b != c)
+        indices << a << b << c;
+}
 
-    vertexData vertices[] = {
-        // Vertex data for water surface plane
-        {QVector3D(-WORLD_DIM, waterLevel, -WORLD_DIM), QVector2D(0.0f, WATER_TEX_REPS), QVector3D(0.0f, 1.0f, 0.0f)},
-        {QVector3D(WORLD_DIM, waterLevel, -WORLD_DIM), QVector2D(WATER_TEX_REPS, WATER_TEX_REPS), QVector3D(0.0f, 1.0f, 0.0f)},
-        {QVector3D(-WORLD_DIM, waterLevel, WORLD_DIM), QVector2D(0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f)},
-        {QVector3D(WORLD_DIM, waterLevel, WORLD_DIM), QVector2D(WATER_TEX_REPS, 0.0f), QVector3D(0.0f, 1.0f, 0.0f)},
+// Append the triangle list for one terrain tile at the given level of detail (the tile is sampled every 2^lod grid
+// points).  Edges flagged in stitchMask border a tile that is one level coarser; the in-between vertices along those
+// edges are collapsed onto the coarser neighbor's vertices so that no cracks open up between the tiles.  Collapsing
+// leaves some degenerate triangles behind, which are simply not emitted.
+void GeometryEngine::buildTileIndices(int lod, int stitchMask, QVector<GLushort> &indices)
+{
+    const int step = 1 << lod;
+    const int last = TILE_DIVS - 1;
+
+    // Tile local vertex number, after any stitching collapse
+    auto vertexAt = [=](int lx, int lz) -> GLushort {
+        int coarse = step * 2;
+        if (((stitchMask & STITCH_N) && lz == 0) || ((stitchMask & STITCH_S) && lz == last))
+            lx -= lx % coarse;
+        if (((stitchMask & STITCH_W) && lx == 0) || ((stitchMask & STITCH_E) && lx == last))
+            lz -= lz % coarse;
+        return GLushort(lz * TILE_DIVS + lx);
     };
 
+    for (int lz = 0; lz < last; lz += step)
+    {
+        for (int lx = 0; lx < last; lx += step)
+        {
+            // Two triangles per grid cell
+            GLushort a = vertexAt(lx, lz);
+            GLushort b = vertexAt(lx + step, lz);
+            GLushort c = vertexAt(lx, lz + step);
+            GLushort d = vertexAt(lx + step, lz + step);
+
+            // Split the cells along diagonals that radiate out from the middle of the tile.  That way the corner cells are
+            // always split through the tile corner, which keeps collapsed triangles from folding over when two adjoining
+            // edges are both stitched.
+            if ((lx < last / 2) == (lz < last / 2))
+            {
+                appendTriangle(indices, a, c, d);
+                appendTriangle(indices, a, d, b);
+            }
+            else
+            {
+                appendTriangle(indices, a, c, b);
+                appendTriangle(indices, b, c, d);
+            }
+        }
+    }
+}
+
+// Initialize the geometry for the water.  This is just a simple flat planar surface with a repeating water texture
+void GeometryEngine::initWaterGeometry()
+{
     GLushort indices[] = {0, 2, 1, 3}; // That's it - 4 vertices
 
     waterVertBuf.bind();
-    waterVertBuf.allocate(vertices, sizeof(vertices));
+    waterVertBuf.allocate(4 * sizeof(vertexData));
+    updateWaterGeometry();
 
     waterFacetsBuf.bind();
     waterFacetsBuf.allocate(indices, sizeof(indices));
 }
 
-// Initialize the geometry for the sky cube
+// Put the water surface at waterLevel, as a square extent either side of (x, z).  The texture stays put in the world
+// wherever the square is, so the streaming world's water can follow the viewer around without its ripples moving.
+void GeometryEngine::updateWaterGeometry(float x, float z, float extent)
+{
+    float u0 = (x - extent + WORLD_DIM) / (WORLD_DIM * 2.0f) * WATER_TEX_REPS;
+    float u1 = (x + extent + WORLD_DIM) / (WORLD_DIM * 2.0f) * WATER_TEX_REPS;
+    float v0 = (WORLD_DIM - (z - extent)) / (WORLD_DIM * 2.0f) * WATER_TEX_REPS;
+    float v1 = (WORLD_DIM - (z + extent)) / (WORLD_DIM * 2.0f) * WATER_TEX_REPS;
+    vertexData vertices[] = {
+        // Vertex data for water surface plane
+        {QVector3D(x - extent, waterLevel, z - extent), QVector2D(u0, v0), QVector3D(0.0f, 1.0f, 0.0f)},
+        {QVector3D(x + extent, waterLevel, z - extent), QVector2D(u1, v0), QVector3D(0.0f, 1.0f, 0.0f)},
+        {QVector3D(x - extent, waterLevel, z + extent), QVector2D(u0, v1), QVector3D(0.0f, 1.0f, 0.0f)},
+        {QVector3D(x + extent, waterLevel, z + extent), QVector2D(u1, v1), QVector3D(0.0f, 1.0f, 0.0f)},
+    };
+
+    waterVertBuf.bind();
+    waterVertBuf.write(0, vertices, sizeof(vertices));
+}
+
+// Initialize the geometry for the sky cube.  It's made around the origin; for the streaming world vtexonly.glsl moves
+// it along with the eye.
 void GeometryEngine::initSkyCubeGeometry()
 {
     unlitVertexData vertices[] = {
@@ -329,273 +869,748 @@ void GeometryEngine::initSkyCubeGeometry()
     skyFacetsBuf.allocate(indices, sizeof(indices));
 }
 
-// Draw a single tree.  This assumes that the model-view matrix, model-view-perspective matrix, normal matrix, and
-// light position uniforms have already been mapped to the passed-in shader program.
-void GeometryEngine::drawTreeGeometry(QOpenGLShaderProgram *program)
+// Set up a vertex array object for every mesh, and the materials, for drawing through the render queue.  Returns
+// false if the materials don't all fit.
+bool GeometryEngine::initMeshes(renderQueue &queue)
 {
-    // Cycle through the "object sections"
-    for (int i = 0; i < treeFacetsBuf.size(); i++)
-    {
-        program->setUniformValue("texture", 0);
-        treeTexture[i]->bind();
+    skyMesh.create(this, skyVertBuf, skyFacetsBuf, LAYOUT_UNLIT);
+    if (heightTexture)
+        for (int l = 0; l < TILE_LODS; l++)
+            landPatchMesh[l].create(this, landPatchBuf, landFacetsBuf, LAYOUT_PATCH, &landInstBuf[l]);
+    else
+        landMesh.create(this, landVertBuf, landFacetsBuf, LAYOUT_LAND);
+    waterMesh.create(this, waterVertBuf, waterFacetsBuf, LAYOUT_LIT);
 
-        treeVertBuf[i].bind();
-        treeFacetsBuf[i].bind();
+    int numSections = treeMaterial.size();
+    treeSectionMesh.resize(treeVertBuf.size());
+    treeRenderMaterial.resize(treeVertBuf.size());
+    for (int b = 0; b < treeVertBuf.size(); b++)
+    {
+        // Each section is drawn once per tree at its level of detail, with the placement coming from that level's
+        // instance buffer.  The material tells the shaders the distances to fade the level in and out over.
+        int level = b / numSections, i = b % numSections;
+        treeSectionMesh[b].create(this, treeVertBuf[b], treeFacetsBuf[b], LAYOUT_TREE, &treeInstBuf[level]);
+        renderMaterial m = {LAYER_TREE + i, treeMaterial[i].Ka, treeMaterial[i].Kd, treeMaterial[i].Ks, treeMaterial[i].Ns,
+                            treeLodDistance(level), treeLodDistance(level + 1)};
+        if ((treeRenderMaterial[b] = queue.addMaterial(m)) < 0)
+            return false;
+    }
+    impostorMesh.create(this, impostorVertBuf, impostorFacetsBuf, LAYOUT_UNLIT, &impostorInstBuf);
+    renderMaterial impostor = {0, QVector4D(), QVector4D(), QVector4D(), 0.0f, treeLodDistance(TREE_LODS), 0.0f};
+    if ((impostorMaterial = queue.addMaterial(impostor)) < 0)
+        return false;
+
+    renderMaterial land = {LAYER_LAND, QVector4D(0.4f, 0.4f, 0.4f, 1.0f), QVector4D(1.0f, 1.0f, 1.0f, 1.0f),
+                           QVector4D(0.1f, 0.1f, 0.1f, 1.0f), 128.0f, 0.0f, 0.0f};
+    renderMaterial water = {LAYER_WATER, QVector4D(0.4f, 0.4f, 0.4f, 1.0f), QVector4D(1.0f, 1.0f, 1.0f, 1.0f),
+                            QVector4D(1.0f, 1.0f, 1.0f, 1.0f), 32.0f, 0.0f, 0.0f};
+    landMaterial = queue.addMaterial(land);
+    waterMaterial = queue.addMaterial(water);
+    return landMaterial >= 0 && waterMaterial >= 0;
+}
 
-        //
-        // Connect shader plumbing
-        //
+// Draw all of the visible trees in one pass using instanced rendering: one draw per object section, such as trunk or
+// branches, for each level of detail.  The per-tree translation and scale come from the level's instance buffer, so
+// the matrices should be the plain world view.  The program needs the cutout test to cross-fade the levels.
+void GeometryEngine::drawTreeGeometry(renderQueue &queue, QOpenGLShaderProgram *program)
+{
+    int numSections = treeMaterial.size();
+    for (int b = 0; b < treeSectionMesh.size(); b++)
+    {
+        GLsizei instances = lodSpots[b / numSections].size();
+        if (!instances)
+            continue; // None of the trees at this level are in view
+        drawCommand c = {0, program, surfaceTexture, &treeSectionMesh[b], treeRenderMaterial[b], GL_TRIANGLES,
+                         GL_UNSIGNED_INT, GLsizei(treeFacetsBuf[b].size() / sizeof(GLuint)), 0, 0, instances};
+        queue.submit(c);
+    }
+}
 
-        // Running calculation of offsets for each sub-element in the packed vertex array
-        quintptr offset = 0;
+// Draw the trees beyond the last level of detail as impostors: one textured quad each, turned to face the viewer
+void GeometryEngine::drawImpostorGeometry(renderQueue &queue, QOpenGLShaderProgram *program)
+{
+    GLsizei instances = lodSpots[TREE_LODS].size();
+    if (!instances || !impostorTexture)
+        return;
 
-        // vertex positions
-        int vertexLocation = program->attributeLocation("a_position");
-        program->enableAttributeArray(vertexLocation);
-        program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
-        offset += sizeof(QVector3D);
+    drawCommand c = {0, program, impostorTexture, &impostorMesh, impostorMaterial, GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT,
+                     4, 0, 0, instances};
+    queue.submit(c);
+}
 
-        // texture coordinates
-        int texcoordLocation = program->attributeLocation("a_texcoord");
-        program->enableAttributeArray(texcoordLocation);
-        program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(vertexData));
-        offset += sizeof(QVector2D);
+// Bake the impostor texture.  The tree is drawn at full detail from IMPOSTOR_VIEWS evenly spaced directions around
+// it, level with its base, each with an orthographic projection that just holds the impostor quad.  It's lit as it
+// would be in the world, so the impostors can show the baked color as it is.
+void GeometryEngine::bakeImpostors(renderQueue &queue, QOpenGLShaderProgram *program, const QVector3D &lightPos)
+{
+    // Each view sits in a cell with a transparent gutter on both sides.  The gutter is as wide as a pixel of the last
+    // mipmap level, and the cell is a whole number of them, so no mipmap pixel (or the pixels next to it that linear
+    // filtering reads) takes in any of a neighboring view.
+    int cell = IMPOSTOR_SIZE + 2 * IMPOSTOR_GUTTER;
+    int width = cell * IMPOSTOR_VIEWS, height = IMPOSTOR_SIZE;
+    impostorTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    impostorTexture->setSize(width, height);
+    impostorTexture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    impostorTexture->setMipLevels(IMPOSTOR_LEVELS);
+    impostorTexture->allocateStorage();
+
+    // Render straight into the texture, leaving whatever framebuffer is in use as it was
+    GLint previousFramebuffer, viewport[4];
+    GLfloat clearColor[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+    GLuint framebuffer, depth;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostorTexture->textureId(), 0);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+    {
+        // Clear to about the color of the branches, so the mipmaps don't darken the outline
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.1f, 0.15f, 0.1f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // One tree at the origin, at full size.  The camera is close enough that it isn't faded towards level 1.
+        QVector4D origin(0.0f, 0.0f, 0.0f, 1.0f);
+        treeInstBuf[0].bind();
+        treeInstBuf[0].allocate(&origin, sizeof(origin));
+
+        float distance = 2.0f * treeRadius;
+        QMatrix4x4 projection;
+        projection.ortho(-treeRadius, treeRadius, treeMin.y(), treeMax.y(), 0.0f, 2.0f * distance);
+
+        queue.beginFrame();
+        int numSections = treeMaterial.size();
+        for (int view = 0; view < IMPOSTOR_VIEWS; view++)
+        {
+            // The impostor shader picks the view by the angle of the direction to the viewer in the xz plane
+            float angle = 2.0f * 3.1415926f * view / IMPOSTOR_VIEWS;
+            QMatrix4x4 matrix;
+            matrix.lookAt(QVector3D(cos(angle), 0.0f, sin(angle)) * distance, QVector3D(0, 0, 0), QVector3D(0, 1, 0));
+            glViewport(view * cell + IMPOSTOR_GUTTER, 0, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+            queue.setFrame(projection, matrix, QVector3D(matrix * lightPos));
+            for (int i = 0; i < numSections; i++)
+            {
+                drawCommand c = {0, program, surfaceTexture, &treeSectionMesh[i], treeRenderMaterial[i], GL_TRIANGLES,
+                                 GL_UNSIGNED_INT, GLsizei(treeFacetsBuf[i].size() / sizeof(GLuint)), 0, 0, 1};
+                queue.submit(c);
+            }
+            queue.flush();
+        }
 
-        // normals
-        int normalLocation = program->attributeLocation("a_normal");
-        program->enableAttributeArray(normalLocation);
-        program->setAttributeBuffer(normalLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
+        // Put the trees back for drawing
+        initTreeInstances();
+    }
+    else
+    {
+        cerr << "Can't render the tree impostors; trees past the last level of detail won't be drawn" << endl;
+        delete impostorTexture;
+        impostorTexture = 0;
+    }
 
-        // Pass material properties into the shader
-        program->setUniformValue("MatAmbient", tree.data.section[i].mtl.Ka);
-        program->setUniformValue("MatDiffuse", tree.data.section[i].mtl.Kd);
-        program->setUniformValue("MatSpecular", tree.data.section[i].mtl.Ks);
-        program->setUniformValue("MatShininess", tree.data.section[i].mtl.Ns);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteFramebuffers(1, &framebuffer);
 
-        // Draw it (i.e., spew our chunks)
-        for (int j = 0; j < facetChunk[i].size(); j++)
-            // this works because the vertex array was built sequentially and doesn't need random indexing
-            glDrawArrays(GL_TRIANGLE_STRIP, facetChunk[i][j].base, facetChunk[i][j].count);
+    if (impostorTexture)
+    {
+        impostorTexture->generateMipMaps();
+        impostorTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+        impostorTexture->setMagnificationFilter(QOpenGLTexture::Linear);
+        impostorTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
     }
 }
 
-// Draw the skycube.  This assumes that the model-view matrix, model-view-perspective matrix, normal matrix, and
-// light position uniforms have already been mapped to the passed-in shader program.
-void GeometryEngine::drawSkyCubeGeometry(QOpenGLShaderProgram *program)
+// Work out which land tiles, trees, and water are inside the view frustum for this frame.  Only the visible trees are
+// copied into the tree instance buffers, one for each level of detail; the draw functions skip everything else.  The
+// visible tiles and trees are put in order from nearest to farthest from the eye, so that each one hides as much as
+// possible of what's drawn after it, and the GPU can skip shading the hidden fragments.  The streaming world culls its
+// pages instead of the tiles and trees (see cullPages()).
+void GeometryEngine::cull(const QMatrix4x4 &viewProjection, const QVector3D &eye)
 {
-    // Tell OpenGL which VBOs to use
-    skyVertBuf.bind();
-    skyFacetsBuf.bind();
+    viewFrustum frustum(viewProjection);
 
-    // Offset for position
-    quintptr offset = 0;
+    if (streaming)
+        cullPages(frustum, eye);
+    else
+    {
+        // Land tiles
+        visibleItems.resize(0);
+        tileCull.query(frustum, visibleItems);
+        visibleTiles = visibleItems;
+        std::sort(visibleTiles.begin(), visibleTiles.end(), [this, &eye](int a, int b) {
+            return ((tileMin[a] + tileMax[a]) * 0.5f - eye).lengthSquared() <
+                   ((tileMin[b] + tileMax[b]) * 0.5f - eye).lengthSquared();
+        });
+        stats.tilesVisible = visibleItems.size();
+        stats.tilesCulled = TILE_COUNT * TILE_COUNT - visibleItems.size();
+
+        // Water
+        stats.waterVisible = frustum.testBox(QVector3D(-WORLD_DIM, waterLevel, -WORLD_DIM),
+                                             QVector3D(WORLD_DIM, waterLevel, WORLD_DIM)) != CULL_OUTSIDE;
+
+        // Trees
+        visibleItems.resize(0);
+        treeCull.query(frustum, visibleItems);
+        visibleSpots.resize(visibleItems.size());
+        for (int i = 0; i < visibleItems.size(); i++)
+            visibleSpots[i] = treeSpot[visibleItems[i]];
+        stats.treesCulled = treeSpot.size() - visibleSpots.size();
+    }
+    std::sort(visibleSpots.begin(), visibleSpots.end(), [&eye](const QVector4D &a, const QVector4D &b) {
+        return (a.toVector3D() - eye).lengthSquared() < (b.toVector3D() - eye).lengthSquared();
+    });
+    stats.treesVisible = visibleSpots.size();
+
+    // Choose each tree's level of detail by its distance, relative to its size.  A tree within the cross-fade band of
+    // a switch distance goes in both levels, and the shaders split its pixels between them.
+    for (int l = 0; l <= TREE_LODS; l++)
+        lodSpots[l].resize(0);
+    for (int i = 0; i < visibleSpots.size(); i++)
+    {
+        const QVector4D &spot = visibleSpots[i];
+        float d = (spot.toVector3D() - eye).length() / spot.w();
+        for (int l = 0; l <= TREE_LODS; l++)
+            if (d >= treeLodDistance(l) * (1.0f - TREE_LOD_FADE / 2.0f) &&
+                (l == TREE_LODS || d < treeLodDistance(l + 1) * (1.0f + TREE_LOD_FADE / 2.0f)))
+                lodSpots[l] << spot;
+    }
 
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(unlitVertexData));
+    // Re-specify the buffers before writing so the driver doesn't have to wait for the previous frame to finish with them
+    for (int l = 0; l <= TREE_LODS; l++)
+    {
+        QOpenGLBuffer &buf = l < TREE_LODS ? treeInstBuf[l] : impostorInstBuf;
+        buf.bind();
+        buf.allocate(lodSpots[l].size() * sizeof(QVector4D));
+        buf.write(0, lodSpots[l].constData(), lodSpots[l].size() * sizeof(QVector4D));
+    }
+}
+
+// Bring in the streaming world's pages around the eye, and work out which are in view.  There are few enough pages in
+// range to test each one's box, so they need no quadtree; a page's trees go in or out together.  Any page that has
+// arrived since the last frame, or has lost its place in the height texture since it was last in range, is copied in.
+// A page is only drawn once the pages on all four sides of it are in the texture too, since vland.glsl reads their
+// heights for the normals along its edges; the outermost ring in range is loaded for its neighbors' sake, and isn't
+// drawn.  The water is a square around the eye that reaches the far plane.
+void GeometryEngine::cullPages(const viewFrustum &frustum, const QVector3D &eye)
+{
+    pager->update(eye.x(), eye.z(), STREAM_RADIUS);
+    const QVector<worldPage *> &pages = pager->inRange();
 
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
+    for (int i = 0; i < pages.size(); i++)
+        if (!pages[i]->resident)
+            uploadPage(pages[i]);
 
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(unlitVertexData));
+    auto resident = [this](int px, int pz) {
+        worldPage *page = pager->find(px, pz);
+        return page && page->resident;
+    };
 
-    glDrawElements(GL_TRIANGLE_STRIP, skyFacetsBuf.size() / sizeof(GLushort), GL_UNSIGNED_SHORT, NULL);
+    visiblePages.resize(0);
+    visibleSpots.resize(0);
+    int trees = 0;
+    for (int i = 0; i < pages.size(); i++)
+    {
+        worldPage *page = pages[i];
+        trees += page->trees.size();
+        if (frustum.testBox(page->boxMin, page->boxMax) == CULL_OUTSIDE ||
+            !resident(page->px - 1, page->pz) || !resident(page->px + 1, page->pz) ||
+            !resident(page->px, page->pz - 1) || !resident(page->px, page->pz + 1))
+            continue;
+        if (frustum.testBox(page->landMin, page->landMax) != CULL_OUTSIDE)
+            visiblePages << page;
+        visibleSpots << page->trees;
+    }
+    stats.tilesVisible = visiblePages.size();
+    stats.tilesCulled = pages.size() - visiblePages.size();
+    stats.treesCulled = trees - visibleSpots.size();
+
+    updateWaterGeometry(eye.x(), eye.z(), STREAM_RADIUS);
+    stats.waterVisible = frustum.testBox(QVector3D(eye.x() - STREAM_RADIUS, waterLevel, eye.z() - STREAM_RADIUS),
+                                         QVector3D(eye.x() + STREAM_RADIUS, waterLevel, eye.z() + STREAM_RADIUS)) !=
+                         CULL_OUTSIDE;
 }
 
-// Draw the water.  This assumes that the model-view matrix, model-view-perspective matrix, normal matrix, and
-// light position uniforms have already been mapped to the passed-in shader program.
-void GeometryEngine::drawWaterGeometry(QOpenGLShaderProgram *program)
+// Copy a page's heights into landHeightTexture.  The texture wraps around the world:  each page has its place at its
+// grid position modulo STREAM_WINDOW, which vland.glsl reads back the same way, so no table of places is needed.  The
+// pages in range all fit without sharing a place, and the page that had this one last is out of range.  A page at the
+// last column or row of the texture shares its far edge with the first one, so it goes in in pieces.
+void GeometryEngine::uploadPage(worldPage *page)
 {
-    // Tell OpenGL which VBOs to use
-    waterVertBuf.bind();
-    waterFacetsBuf.bind();
-
-    // Offset for position
-    quintptr offset = 0;
+    QPoint &place = windowPage[(page->pz & (STREAM_PAGES - 1)) * STREAM_PAGES + (page->px & (STREAM_PAGES - 1))];
+    worldPage *old = pager->find(place.x(), place.y());
+    if (old)
+        old->resident = false;
+    place = QPoint(page->px, page->pz);
+    page->resident = true;
+
+    QOpenGLPixelTransferOptions rows;
+    rows.setAlignment(2);
+    int gx = page->px * (TILE_DIVS - 1), gz = page->pz * (TILE_DIVS - 1);
+    for (int lz = 0, h; lz < TILE_DIVS; lz += h)
+    {
+        int z = (gz + lz) & (STREAM_WINDOW - 1);
+        h = MIN(TILE_DIVS - lz, STREAM_WINDOW - z);
+        for (int lx = 0, w; lx < TILE_DIVS; lx += w)
+        {
+            int x = (gx + lx) & (STREAM_WINDOW - 1);
+            w = MIN(TILE_DIVS - lx, STREAM_WINDOW - x);
+            QVector<GLushort> rect(w * h);
+            for (int j = 0; j < h; j++)
+                for (int i = 0; i < w; i++)
+                    rect[j * w + i] = packHeight(page->height[(lz + j) * TILE_DIVS + lx + i]);
+            landHeightTexture->setData(x, z, 0, w, h, 1, QOpenGLTexture::Red, QOpenGLTexture::UInt16, rect.constData(),
+                                       &rows);
+        }
+    }
+}
 
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
+// Draw the skycube
+void GeometryEngine::drawSkyCubeGeometry(renderQueue &queue, QOpenGLShaderProgram *program, QOpenGLTexture *texture)
+{
+    drawCommand c = {0, program, texture, &skyMesh, -1, GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT,
+                     GLsizei(skyFacetsBuf.size() / sizeof(GLushort)), 0, 0, 0};
+    queue.submit(c);
+}
 
-    // Offset for texture coordinate (aka uvs)
-    offset += sizeof(QVector3D);
+// Draw the water
+void GeometryEngine::drawWaterGeometry(renderQueue &queue, QOpenGLShaderProgram *program)
+{
+    if (!stats.waterVisible)
+        return;
 
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(vertexData));
+    drawCommand c = {0, program, surfaceTexture, &waterMesh, waterMaterial, GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT,
+                     GLsizei(waterFacetsBuf.size() / sizeof(GLushort)), 0, 0, 0};
+    queue.submit(c);
+}
 
-    // Offset for normals
-    offset += sizeof(QVector2D);
+// Choose the level of detail for every land tile based on its distance from the eye.  Neighboring tiles are kept within
+// one level of each other, which is all the stitched index sets can handle.
+void GeometryEngine::selectLandLod(const QVector3D &eye)
+{
+    for (int t = 0; t < TILE_COUNT * TILE_COUNT; t++)
+    {
+        // Distance from the eye to the closest point of the tile's bounding box
+        QVector3D closest(qBound(tileMin[t].x(), eye.x(), tileMax[t].x()),
+                          qBound(tileMin[t].y(), eye.y(), tileMax[t].y()),
+                          qBound(tileMin[t].z(), eye.z(), tileMax[t].z()));
+        float dist = (closest - eye).length();
+
+        // Drop one level of detail each time the distance doubles
+        int lod = 0;
+        for (float d = LOD_DISTANCE; dist > d && lod < TILE_LODS - 1; d *= 2.0f)
+            lod++;
+        tileLod[t] = lod;
+    }
 
-    // Tell OpenGL programmable pipeline how to locate vertex normal data
-    int normalLocation = program->attributeLocation("a_normal");
-    program->enableAttributeArray(normalLocation);
-    program->setAttributeBuffer(normalLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
+    // Pull down any tile that is more than one level coarser than a neighbor.  Each pass can only move a level
+    // difference by one tile, so repeat until nothing changes.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int tz = 0; tz < TILE_COUNT; tz++)
+        {
+            for (int tx = 0; tx < TILE_COUNT; tx++)
+            {
+                int &lod = tileLod[Tile_2on1(tx, tz)];
+                int limit = lod;
+                if (tz > 0)
+                    limit = MIN(limit, tileLod[Tile_2on1(tx, tz - 1)] + 1);
+                if (tx < TILE_COUNT - 1)
+                    limit = MIN(limit, tileLod[Tile_2on1(tx + 1, tz)] + 1);
+                if (tz < TILE_COUNT - 1)
+                    limit = MIN(limit, tileLod[Tile_2on1(tx, tz + 1)] + 1);
+                if (tx > 0)
+                    limit = MIN(limit, tileLod[Tile_2on1(tx - 1, tz)] + 1);
+                if (limit != lod)
+                {
+                    lod = limit;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
 
-    // Set the material properties for the water
-    program->setUniformValue("MatAmbient", QVector4D(0.4f, 0.4f, 0.4f, 1.0f));
-    program->setUniformValue("MatDiffuse", QVector4D(1.0f, 1.0f, 1.0f, 1.0f));
-    program->setUniformValue("MatSpecular", QVector4D(1.0f, 1.0f, 1.0f, 1.0f));
-    program->setUniformValue("MatShininess", 32.0f);
+// Choose the level of detail for every page of the streaming world in range, as selectLandLod() does for the tiles.
+// A neighbor that isn't in range this frame doesn't count.
+void GeometryEngine::selectPageLod(const QVector3D &eye)
+{
+    const QVector<worldPage *> &pages = pager->inRange();
+    for (int i = 0; i < pages.size(); i++)
+    {
+        worldPage *page = pages[i];
+        QVector3D closest(qBound(page->landMin.x(), eye.x(), page->landMax.x()),
+                          qBound(page->landMin.y(), eye.y(), page->landMax.y()),
+                          qBound(page->landMin.z(), eye.z(), page->landMax.z()));
+        float dist = (closest - eye).length();
+
+        int lod = 0;
+        for (float d = LOD_DISTANCE; dist > d && lod < TILE_LODS - 1; d *= 2.0f)
+            lod++;
+        page->lod = lod;
+    }
 
-    // Now the plumbing is hooked up, draw what's in the buffer!
-    glDrawElements(GL_TRIANGLE_STRIP, waterFacetsBuf.size() / sizeof(GLushort), GL_UNSIGNED_SHORT, NULL);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < pages.size(); i++)
+        {
+            worldPage *page = pages[i];
+            const worldPage *neighbor[] = {pager->find(page->px, page->pz - 1), pager->find(page->px + 1, page->pz),
+                                           pager->find(page->px, page->pz + 1), pager->find(page->px - 1, page->pz)};
+            int limit = page->lod;
+            for (const worldPage *n : neighbor)
+                if (n && n->lastUsed == page->lastUsed)
+                    limit = MIN(limit, n->lod + 1);
+            if (limit != page->lod)
+            {
+                page->lod = limit;
+                changed = true;
+            }
+        }
+    }
 }
 
-// Draw the land grid.  This assumes that the model-view matrix, model-view-perspective matrix, normal matrix, and
-// light position uniforms have already been mapped to the passed-in shader program.
-void GeometryEngine::drawLandGeometry(QOpenGLShaderProgram *program)
+// Draw the land grid.  The eye position (in world coordinates) is used to choose the level of detail of each tile.
+// The tiles are submitted nearest first, and the render queue keeps that order among draws that share state.  With the
+// height texture, the tiles at each level of detail are drawn as instances of the patch in one draw, and vland.glsl
+// does the stitching.  The streaming world's pages are drawn the same way, as tiles that can be anywhere.
+void GeometryEngine::drawLandGeometry(renderQueue &queue, QOpenGLShaderProgram *program, const QVector3D &eye)
 {
-    // Tell OpenGL which VBOs to use
-    landVertBuf.bind();
-    landFacetsBuf.bind();
+    uploadLandEdits();
+
+    for (int l = 0; l < TILE_LODS; l++)
+        lodTiles[l].resize(0);
+    if (streaming)
+    {
+        selectPageLod(eye);
+        for (int i = 0; i < visiblePages.size(); i++)
+        {
+            const worldPage *page = visiblePages[i];
+            auto coarser = [this, page](int px, int pz) {
+                const worldPage *n = pager->find(px, pz);
+                return n && n->lastUsed == page->lastUsed && n->lod > page->lod;
+            };
+            int mask = 0;
+            if (coarser(page->px, page->pz - 1))
+                mask |= STITCH_N;
+            if (coarser(page->px + 1, page->pz))
+                mask |= STITCH_E;
+            if (coarser(page->px, page->pz + 1))
+                mask |= STITCH_S;
+            if (coarser(page->px - 1, page->pz))
+                mask |= STITCH_W;
+            lodTiles[page->lod] << QVector4D(page->px * (TILE_DIVS - 1), page->pz * (TILE_DIVS - 1), mask, page->lod);
+        }
+    }
+    else
+        selectLandLod(eye);
+
+    for (int i = 0; i < visibleTiles.size(); i++)
+    {
+        int t = visibleTiles[i];
+        int tx = t % TILE_COUNT, tz = t / TILE_COUNT;
+        int lod = tileLod[t];
+
+        // Flag the edges that border a coarser tile
+        int mask = 0;
+        if (tz > 0 && tileLod[Tile_2on1(tx, tz - 1)] > lod)
+            mask |= STITCH_N;
+        if (tx < TILE_COUNT - 1 && tileLod[Tile_2on1(tx + 1, tz)] > lod)
+            mask |= STITCH_E;
+        if (tz < TILE_COUNT - 1 && tileLod[Tile_2on1(tx, tz + 1)] > lod)
+            mask |= STITCH_S;
+        if (tx > 0 && tileLod[Tile_2on1(tx - 1, tz)] > lod)
+            mask |= STITCH_W;
+
+        if (heightTexture)
+        {
+            lodTiles[lod] << QVector4D(tx * (TILE_DIVS - 1), tz * (TILE_DIVS - 1), mask, lod);
+            continue;
+        }
 
-    // Offset for position
-    quintptr offset = 0;
-
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
-
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
-
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(vertexData));
-
-    // Offset for normals
-    offset += sizeof(QVector2D);
-
-    // Tell OpenGL programmable pipeline how to locate vertex normal data
-    int normalLocation = program->attributeLocation("a_normal");
-    program->enableAttributeArray(normalLocation);
-    program->setAttributeBuffer(normalLocation, GL_FLOAT, offset, 3, sizeof(vertexData));
-
-    // Set the material properties for the land
-    program->setUniformValue("MatAmbient", QVector4D(0.4f, 0.4f, 0.4f, 1.0f));
-    program->setUniformValue("MatDiffuse", QVector4D(1.0f, 1.0f, 1.0f, 1.0f));
-    program->setUniformValue("MatSpecular", QVector4D(0.1f, 0.1f, 0.1f, 1.0f));
-    program->setUniformValue("MatShininess", 128.0f);
-
-    // Now the plumbing is hooked up, draw what's in the buffer!
-    glDrawElements(GL_TRIANGLE_STRIP, landFacetsBuf.size() / sizeof(GLuint), GL_UNSIGNED_INT, 0);
-}
-
-//
-// The following code implements the "Diamond Square" recursive terrain generation
-// algorithm.  "The idea was first introduced by Fournier, Fussell and Carpenter at SIGGRAPH 1982.":
-// Fournier, Alain; Fussell, Don; Carpenter, Loren (June 1982). "Computer rendering of stochastic models".
-//      Communications of the ACM. 25 (6): 371–384. doi:10.1145/358523.358553
-// https://en.wikipedia.org/wiki/Diamond-square_algorithm
-//
-// This C++ implementation is based from the example code found at:
-// https://medium.com/@nickobrien/diamond-square-algorithm-explanation-and-c-implementation-5efa891e486f
-//
-void GeometryEngine::diamondSquare(int size, bool presetCenter)
-{
-    int half = size / 2;
-    if (half < 1)
+        // The index buffers are tile local; the base vertex moves them to this tile's block of the vertex buffer
+        const lodRange &r = landLod[lod][mask];
+        drawCommand c = {0, program, surfaceTexture, &landMesh, landMaterial, GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                         r.count, quintptr(r.offset) * sizeof(GLushort), t * TILE_DIVS * TILE_DIVS, 0};
+        queue.submit(c);
+    }
+    if (!heightTexture)
         return;
 
-    // square steps - skip if center point is pre-set (my own modification to allow biasing the shape of the terrain)
-    if (!presetCenter)
-        for (int z = half; z < LAND_DIVS; z += size)
-            for (int x = half; x < LAND_DIVS; x += size)
-                squareStep(x % LAND_DIVS, z % LAND_DIVS, half);
-
-    // diamond steps
-    int col = 0;
-    for (int x = 0; x < LAND_DIVS; x += half)
-    {
-        col++;
-        //If this is an odd column.
-        if (col % 2 == 1)
-            for (int z = half; z < LAND_DIVS; z += size)
-                diamondStep(x % LAND_DIVS, z % LAND_DIVS, half);
-        else
-            for (int z = 0; z < LAND_DIVS; z += size)
-                diamondStep(x % LAND_DIVS, z % LAND_DIVS, half);
+    // The surface textures are on unit 0, so the heights go on unit 1
+    queue.setPassTexture(landHeightTexture);
+    for (int l = 0; l < TILE_LODS; l++)
+    {
+        if (lodTiles[l].isEmpty())
+            continue;
+
+        // Re-specify the buffer before writing, as for the trees
+        landInstBuf[l].bind();
+        landInstBuf[l].allocate(lodTiles[l].size() * sizeof(QVector4D));
+        landInstBuf[l].write(0, lodTiles[l].constData(), lodTiles[l].size() * sizeof(QVector4D));
+
+        const lodRange &r = landLod[l][0];
+        drawCommand c = {0, program, surfaceTexture, &landPatchMesh[l], landMaterial, GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                         r.count, quintptr(r.offset) * sizeof(GLushort), 0, lodTiles[l].size()};
+        queue.submit(c);
+    }
+}
+
+// Translate world coordinates to the index of the nearest land vertex.  Points off the edge of the world use the
+// closest edge vertex.
+int GeometryEngine::landIndex(float wx, float wz)
+{
+    int x = int((wx + WORLD_DIM) * (LAND_DIVS - 1) / (WORLD_DIM * 2.0f) + 0.5f);
+    int z = int((wz + WORLD_DIM) * (LAND_DIVS - 1) / (WORLD_DIM * 2.0f) + 0.5f);
+    x = MAX(0, MIN(x, LAND_DIVS - 1));
+    z = MAX(0, MIN(z, LAND_DIVS - 1));
+    return Coord_2on1(x, z);
+}
+
+// return the y height of the land at (x,z), interpolated between the four grid points around it so that the ground is
+// a continuous surface.  Points off the edge of the world get the height at the closest edge.  The streaming world has
+// no grid to hand, so that comes straight from the noise it's made from.
+float GeometryEngine::getHeight(float wx, float wz, bool stayAbove)
+{
+    float y;
+    if (streaming)
+        y = pager->height(wx, wz);
+    else
+    {
+        float gx = MAX(0.0f, MIN((wx + WORLD_DIM) * (LAND_DIVS - 1) / (WORLD_DIM * 2.0f), LAND_DIVS - 1.0f));
+        float gz = MAX(0.0f, MIN((wz + WORLD_DIM) * (LAND_DIVS - 1) / (WORLD_DIM * 2.0f), LAND_DIVS - 1.0f));
+        int x0 = MIN(int(gx), LAND_DIVS - 2);
+        int z0 = MIN(int(gz), LAND_DIVS - 2);
+        float fx = gx - x0, fz = gz - z0;
+        float north = landHeight[Coord_2on1(x0, z0)] * (1.0f - fx) + landHeight[Coord_2on1(x0 + 1, z0)] * fx;
+        float south = landHeight[Coord_2on1(x0, z0 + 1)] * (1.0f - fx) + landHeight[Coord_2on1(x0 + 1, z0 + 1)] * fx;
+        y = north * (1.0f - fz) + south * fz;
     }
-    diamondSquare(size / 2);
+    if (stayAbove)
+        return (MAX(y, waterLevel)); // Don't go below water
+    else
+        return (y);
 }
 
-void GeometryEngine::squareStep(int x, int z, int reach)
+// Sculpt the land around (x, z).  See geometryengine.h.
+void GeometryEngine::editTerrain(int brush, float x, float z, float radius, float amount)
 {
-    int count = 0;
-    float avg = 0.0f;
-    if (x - reach >= 0 && z - reach >= 0)
+    // The streaming world's pages are made over again whenever they come back, so edits wouldn't last
+    if (streaming)
+        return;
+
+    // The grid points under the brush
+    const float spacing = WORLD_DIM * 2.0f / (LAND_DIVS - 1);
+    int x0 = MAX(0, int(ceilf((x - radius + WORLD_DIM) / spacing)));
+    int x1 = MIN(LAND_DIVS - 1, int(floorf((x + radius + WORLD_DIM) / spacing)));
+    int z0 = MAX(0, int(ceilf((z - radius + WORLD_DIM) / spacing)));
+    int z1 = MIN(LAND_DIVS - 1, int(floorf((z + radius + WORLD_DIM) / spacing)));
+    if (x0 > x1 || z0 > z1 || radius <= 0.0f)
+        return;
+
+    // Work out all the new heights before changing any, since smoothing reads the neighbors
+    float target = getHeight(x, z, false);
+    int w = x1 - x0 + 1;
+    QVector<float> height(w * (z1 - z0 + 1));
+    for (int zi = z0; zi <= z1; zi++)
+    {
+        for (int xi = x0; xi <= x1; xi++)
+        {
+            float h = landHeight[Coord_2on1(xi, zi)];
+            float dx = -WORLD_DIM + xi * spacing - x;
+            float dz = -WORLD_DIM + zi * spacing - z;
+            float d = (dx * dx + dz * dz) / (radius * radius);
+            if (d < 1.0f)
+            {
+                // Full strength in the middle, falling off smoothly to nothing at the rim
+                float weight = (1.0f - d) * (1.0f - d);
+                switch (brush)
+                {
+                case BRUSH_RAISE:
+                    h += amount * weight;
+                    break;
+                case BRUSH_LOWER:
+                    h -= amount * weight;
+                    break;
+                case BRUSH_FLATTEN:
+                    h += (target - h) * MIN(amount * weight, 1.0f);
+                    break;
+                case BRUSH_SMOOTH:
+                {
+                    float around = landHeight[Coord_2on1(MAX(xi - 1, 0), zi)] +
+                                   landHeight[Coord_2on1(MIN(xi + 1, LAND_DIVS - 1), zi)] +
+                                   landHeight[Coord_2on1(xi, MAX(zi - 1, 0))] +
+                                   landHeight[Coord_2on1(xi, MIN(zi + 1, LAND_DIVS - 1))];
+                    h += (around / 4.0f - h) * MIN(amount * weight, 1.0f);
+                    break;
+                }
+                }
+            }
+            height[(zi - z0) * w + xi - x0] = qBound(-WORLD_DIM, h, WORLD_DIM);
+        }
+    }
+
+    // Put them in, keeping the running total for the average height
+    float change = 0.0f;
+    for (int zi = z0; zi <= z1; zi++)
     {
-        avg += landVerts[Coord_2on1(x - reach, z - reach)].position.y();
-        count++;
+        for (int xi = x0; xi <= x1; xi++)
+        {
+            float h = height[(zi - z0) * w + xi - x0];
+            change += h - landHeight[Coord_2on1(xi, zi)];
+            landHeight[Coord_2on1(xi, zi)] = h;
+            landVerts[Coord_2on1(xi, zi)].position.setY(h);
+        }
     }
-    if (x - reach >= 0 && z + reach < LAND_DIVS)
+    if (change != 0.0f)
     {
-        avg += landVerts[Coord_2on1(x - reach, z + reach)].position.y();
-        count++;
+        landAvg += change / (LAND_DIVS * LAND_DIVS);
+        waterLevel += change / (LAND_DIVS * LAND_DIVS);
+        waterMoved = true;
     }
-    if (x + reach < LAND_DIVS && z - reach >= 0)
+
+    // A point's normal depends on its neighbors' heights too, so one more point all round has to be redone
+    int nx0 = MAX(x0 - 1, 0), nx1 = MIN(x1 + 1, LAND_DIVS - 1);
+    int nz0 = MAX(z0 - 1, 0), nz1 = MIN(z1 + 1, LAND_DIVS - 1);
+    QRect changed(nx0, nz0, nx1 - nx0 + 1, nz1 - nz0 + 1);
+    for (int zi = changed.top(); zi <= changed.bottom(); zi++)
+        for (int xi = changed.left(); xi <= changed.right(); xi++)
+            landVerts[Coord_2on1(xi, zi)].normal = landNormal(xi, zi);
+    landDirty = landDirty.united(changed);
+
+    // Refit the bounds of the tiles the brush touched.  Grid points on a tile's edge belong to both tiles.
+    for (int tz = MAX(0, (z0 - 1) / (TILE_DIVS - 1)); tz <= MIN(TILE_COUNT - 1, z1 / (TILE_DIVS - 1)); tz++)
     {
-        avg += landVerts[Coord_2on1(x + reach, z - reach)].position.y();
-        count++;
+        for (int tx = MAX(0, (x0 - 1) / (TILE_DIVS - 1)); tx <= MIN(TILE_COUNT - 1, x1 / (TILE_DIVS - 1)); tx++)
+        {
+            int t = Tile_2on1(tx, tz);
+            float minY = FLT_MAX, maxY = -FLT_MAX;
+            for (int lz = 0; lz < TILE_DIVS; lz++)
+            {
+                for (int lx = 0; lx < TILE_DIVS; lx++)
+                {
+                    float y = landHeight[Coord_2on1(tx * (TILE_DIVS - 1) + lx, tz * (TILE_DIVS - 1) + lz)];
+                    minY = MIN(minY, y);
+                    maxY = MAX(maxY, y);
+                }
+            }
+            tileMin[t].setY(minY);
+            tileMax[t].setY(maxY);
+            tileCull.update(t, tileMin[t], tileMax[t]);
+        }
     }
-    if (x + reach < LAND_DIVS && z + reach < LAND_DIVS)
+
+    // Keep the trees standing on the ground
+    QVector<int> trees;
+    treeGrid.within(x, z, radius + spacing, trees);
+    for (int i = 0; i < trees.size(); i++)
     {
-        avg += landVerts[Coord_2on1(x + reach, z + reach)].position.y();
-        count++;
+        QVector4D &spot = treeSpot[trees[i]];
+        spot.setY(getHeight(spot.x(), spot.z(), false) - TREE_SINK);
+        treeCull.update(trees[i], spot.toVector3D() + treeMin * spot.w(), spot.toVector3D() + treeMax * spot.w());
     }
-    avg += Frand(reach / TERRAIN_SMOOTH) - reach / (TERRAIN_SMOOTH * 2.0f);
-    avg /= float(count);
-    landVerts[Coord_2on1(x, z)].position.setY(avg);
 }
 
-void GeometryEngine::diamondStep(int x, int z, int reach)
+// Bring the GPU copy of the land up to date with editTerrain()
+void GeometryEngine::uploadLandEdits()
 {
-    int count = 0;
-    float avg = 0.0f;
-    if (x - reach >= 0)
+    if (waterMoved)
     {
-        avg += landVerts[Coord_2on1(x - reach, z)].position.y();
-        count++;
+        updateWaterGeometry();
+        waterMoved = false;
     }
-    if (x + reach < LAND_DIVS)
-    {
-        avg += landVerts[Coord_2on1(x + reach, z)].position.y();
-        count++;
-    }
-    if (z - reach >= 0)
+    if (landDirty.isNull())
+        return;
+
+    if (heightTexture)
     {
-        avg += landVerts[Coord_2on1(x, z - reach)].position.y();
-        count++;
+        // Just the changed rectangle of the heights; the normals are worked out in the shader
+        QVector<GLushort> rect(landDirty.width() * landDirty.height());
+        for (int zi = landDirty.top(); zi <= landDirty.bottom(); zi++)
+            for (int xi = landDirty.left(); xi <= landDirty.right(); xi++)
+                rect[(zi - landDirty.top()) * landDirty.width() + xi - landDirty.left()] =
+                    packHeight(landHeight[Coord_2on1(xi, zi)]);
+        QOpenGLPixelTransferOptions rows;
+        rows.setAlignment(2);
+        landHeightTexture->setData(landDirty.left(), landDirty.top(), 0, landDirty.width(), landDirty.height(), 1,
+                                   QOpenGLTexture::Red, QOpenGLTexture::UInt16, rect.constData(), &rows);
     }
-    if (z + reach < LAND_DIVS)
+    else
     {
-        avg += landVerts[Coord_2on1(x, z + reach)].position.y();
-        count++;
+        // The vertex buffer is laid out tile by tile, so rewrite the changed rows of each tile the rectangle touches.
+        // A run of whole rows is contiguous, so that's one write per tile.
+        landVertBuf.bind();
+        for (int tz = MAX(0, (landDirty.top() - 1) / (TILE_DIVS - 1));
+             tz <= MIN(TILE_COUNT - 1, landDirty.bottom() / (TILE_DIVS - 1)); tz++)
+        {
+            for (int tx = MAX(0, (landDirty.left() - 1) / (TILE_DIVS - 1));
+                 tx <= MIN(TILE_COUNT - 1, landDirty.right() / (TILE_DIVS - 1)); tx++)
+            {
+                int lz0 = MAX(0, landDirty.top() - tz * (TILE_DIVS - 1));
+                int lz1 = MIN(TILE_DIVS - 1, landDirty.bottom() - tz * (TILE_DIVS - 1));
+                QVector<landVertexData> rows((lz1 - lz0 + 1) * TILE_DIVS);
+                for (int lz = lz0; lz <= lz1; lz++)
+                {
+                    for (int lx = 0; lx < TILE_DIVS; lx++)
+                    {
+                        const vertexData &v = landVerts[Coord_2on1(tx * (TILE_DIVS - 1) + lx, tz * (TILE_DIVS - 1) + lz)];
+                        landVertexData &p = rows[(lz - lz0) * TILE_DIVS + lx];
+                        p.height = packHeight(v.position.y());
+                        packOctahedral(v.normal, p.normal);
+                    }
+                }
+                int first = Tile_2on1(tx, tz) * TILE_DIVS * TILE_DIVS + lz0 * TILE_DIVS;
+                landVertBuf.write(first * sizeof(landVertexData), rows.constData(), rows.size() * sizeof(landVertexData));
+            }
+        }
     }
-    avg += Frand(reach / TERRAIN_SMOOTH) - reach / (TERRAIN_SMOOTH * 2.0f);
-    avg /= float(count);
-    landVerts[Coord_2on1(x, z)].position.setY(avg);
+    landDirty = QRect();
 }
 
-// return the y height of the land grid at (x,z)
-float GeometryEngine::getHeight(float wx, float wz, bool stayAbove)
+// Find where a ray first meets the land
+bool GeometryEngine::pickLand(const QVector3D &origin, const QVector3D &dir, QVector3D &hit)
 {
-    // Translate world coordinates to land vertex coordinates
-    int x = int((wx + WORLD_DIM) * LAND_DIVS / (WORLD_DIM * 2.0f) + 0.5f);
-    int z = int((wz + WORLD_DIM) * LAND_DIVS / (WORLD_DIM * 2.0f) + 0.5f);
-    if (stayAbove)
-        return (MAX(landVerts[Coord_2on1(x, z)].position.y(), waterLevel)); // Don't go below water
-    else
-        return (landVerts[Coord_2on1(x, z)].position.y());
+    // Step along the ray half a grid spacing at a time until it's below the ground, then close in on the crossing
+    QVector3D d = dir.normalized();
+    const float step = WORLD_DIM / (LAND_DIVS - 1);
+    float before = 0.0f;
+    for (float t = step; t < WORLD_DIM * 4.0f; t += step)
+    {
+        QVector3D p = origin + d * t;
+        if (fabsf(p.x()) > WORLD_DIM || fabsf(p.z()) > WORLD_DIM)
+            return false;
+        if (p.y() > getHeight(p.x(), p.z(), false))
+        {
+            before = t;
+            continue;
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            float mid = (before + t) / 2.0f;
+            QVector3D m = origin + d * mid;
+            if (m.y() > getHeight(m.x(), m.z(), false))
+                before = mid;
+            else
+                t = mid;
+        }
+        hit = origin + d * t;
+        return true;
+    }
+    return false;
 }
 
 // Starting from viewerPos, move in the direction of searchDir until water is found.
@@ -637,45 +1652,73 @@ bool GeometryEngine::adjustViewerPos(QVector3D &viewerPos, QVector2D searchDir)
     return (true);
 }
 
-// Return the distance to the closest tree from a given point
-float GeometryEngine::closestTree(float x, float z)
+// Relative density of trees at a point in the world, from 0 (no trees at all) to 1.  Trees can't grow in the water,
+// thin out towards the tree line, and thin out on steep slopes.
+float GeometryEngine::treeDensity(float x, float z)
 {
-    float minDist = FLT_MAX;
-    for (int i = 0; i < TREE_COUNT; i++)
-    {
-        float xd = treeSpot[i].x() - x;
-        float zd = treeSpot[i].z() - z;
-        minDist = MIN(minDist, xd * xd + zd * zd);
-    }
-    return sqrt(minDist);
+    const vertexData &v = landVerts[landIndex(x, z)];
+
+    float above = v.position.y() - waterLevel;
+    if (above < 0.0f)
+        return 0.0f;
+
+    QVector3D n = v.normal.normalized();
+    float slope = sqrt(n.x() * n.x() + n.z() * n.z()) / MAX(n.y(), 0.001f); // rise over run
+
+    float heightFactor = MAX(1.0f - above / TREE_LINE, 0.0f);
+    float slopeFactor = MAX(1.0f - slope / TREE_SLOPE_MAX, 0.0f);
+    return heightFactor * slopeFactor;
 }
 
-// Randomly place the trees in the world, making sure none of them are underwater and they maintain a
-// minimum spacing.  Warning:  This has the potential to become an infinite loop if too many trees are
-// attempted to be placed within a too-small area.  There is no logic present to guard against that.
-// As long as the tree count is sufficiently small and the land grid size is sufficiently large, this
-// won't be a problem.
+// Place the trees in the world using Poisson-disk sampling masked by treeDensity(), so none of them are underwater and
+// they always keep at least TREE_MIN_PROX apart.  The sampler has a hard cap on the number of attempts, so this always
+// finishes; if the world doesn't have room for TREE_COUNT trees, fewer are placed.
 void GeometryEngine::placeTrees(void)
 {
-    float x, y, z;
-    for (int i = 0; i < TREE_COUNT; i++)
+    // Estimate the amount of dry land, and spread the samples out so that there are a few more sites than trees
+    int dry = 0;
+    for (int i = 0; i < LAND_DIVS * LAND_DIVS; i++)
+        if (landVerts[i].position.y() >= waterLevel)
+            dry++;
+    float dryArea = (WORLD_DIM * 2.0f) * (WORLD_DIM * 2.0f) * dry / float(LAND_DIVS * LAND_DIVS);
+    float spacing = MAX(TREE_MIN_PROX, TREE_SPREAD * sqrt(dryArea / TREE_COUNT));
+
+    rngStream rng(worldSeed, RNG_TREES);
+    QVector<QVector2D> site;
+    int attempts = poissonDisk(WORLD_DIM, spacing, [this](float x, float z) { return treeDensity(x, z); },
+                               TREE_MAX_ATTEMPTS, rng, site);
+
+    // The sampler fills all of the available ground.  Shuffle the sites and keep the first TREE_COUNT of them; any subset
+    // still honours the spacing, and a random one keeps the forest from looking too regular.
+    for (int i = site.size() - 1; i > 0; i--)
     {
-        do
-        {
-            x = Frand(WORLD_DIM * 2) - WORLD_DIM;
-            z = Frand(WORLD_DIM * 2) - WORLD_DIM;
-            y = getHeight(x, z, false);
-        } while (y < waterLevel || closestTree(x, z) < TREE_MIN_PROX);
+        int j = rng.below(i + 1);
+        QVector2D t = site[i];
+        site[i] = site[j];
+        site[j] = t;
+    }
 
-        treeSpot[i] = QVector4D(x, y - TREE_SINK, z, TREE_RANGE_L + Frand(TREE_RANGE_H - TREE_RANGE_L));
+    int count = MIN(TREE_COUNT, site.size());
+    treeSpot.resize(count);
+    treeGrid.clear();
+    for (int i = 0; i < count; i++)
+    {
+        float x = site[i].x();
+        float z = site[i].y();
+        float y = getHeight(x, z, false);
+        treeSpot[i] = QVector4D(x, y - TREE_SINK, z, TREE_RANGE_L + rng.uniform(TREE_RANGE_H - TREE_RANGE_L));
+        treeGrid.insert(i, x, z);
     }
+
+    cout << "Placed " << count << " of " << TREE_COUNT << " trees (" << site.size() << " sites found in " << attempts
+         << " attempts)" << endl;
 }
 
 // Move the viewerPos in the direction indicated, subject to restraints.  The viewerPos will not be updated if
 // the movement would result in the viewer being...
 // * In the water
 // * In a tree
-// * Too close to the edge of the world (defined by EDGE_DISTANCE)
+// * Too close to the edge of the world (defined by EDGE_DISTANCE), unless it's the streaming world, which has none
 void GeometryEngine::move(QVector3D &viewerPos, QVector2D dir)
 {
     QVector3D candidate(viewerPos);
@@ -684,14 +1727,16 @@ void GeometryEngine::move(QVector3D &viewerPos, QVector2D dir)
     candidate.setZ(candidate.z() + dir.y());
 
     // check if the new position is sufficiently inside the world
-    if ((candidate.x() <= (WORLD_DIM - EDGE_DISTANCE)) && (candidate.x() >= -(WORLD_DIM - EDGE_DISTANCE)) && (candidate.z() <= (WORLD_DIM - EDGE_DISTANCE)) && (candidate.z() >= -(WORLD_DIM - EDGE_DISTANCE)))
+    if (streaming || ((candidate.x() <= (WORLD_DIM - EDGE_DISTANCE)) && (candidate.x() >= -(WORLD_DIM - EDGE_DISTANCE)) && (candidate.z() <= (WORLD_DIM - EDGE_DISTANCE)) && (candidate.z() >= -(WORLD_DIM - EDGE_DISTANCE))))
     {
         // check if the new position is above water
         float h = getHeight(candidate.x(), candidate.z(), false);
         if (h > getWaterLevel())
         {
             // check if the new position is far enough away from a tree
-            if (closestTree(candidate.x(), candidate.z()) > TREE_MIN_STAND)
+            bool tree = streaming ? pager->anyTreeWithin(candidate.x(), candidate.z(), TREE_MIN_STAND)
+                                  : treeGrid.anyWithin(candidate.x(), candidate.z(), TREE_MIN_STAND);
+            if (!tree)
             {
                 // cout << "Passed tree test.";
                 // We satisfied all of the move conditions.  Go ahead and move
@@ -12,11 +12,22 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLExtraFunctions>
+#include <QRect>
+#include <QSharedPointer>
 
 #include "wavefrontObj.h"
+#include "vertexdata.h"
+#include "culling.h"
+#include "spatialgrid.h"
+#include "rng.h"
+#include "worldcache.h"
+#include "meshfile.h"
+#include "texturecache.h"
+#include "rendercommand.h"
+#include "worldpager.h"
 
 // World generation parameters:
-#define LAND_DIVS 513         // The number of divisions in each cardinal direction for the land grid.  The Diamond Square terrain generation algorithm requires this to be 2^n+1 where n is a positive integer
+#define LAND_DIVS 513         // The number of divisions in each cardinal direction for the land grid.  The Diamond Square terrain generation algorithm requires this to be 2^n+1 where n is a positive integer.
 #define LAND_TEX_REPS 40      // The number of times the land texture repeats over the width and depth of the world
 #define WORLD_DIM 40.0f       // Half the width & depth & height of the world
 #define TERRAIN_RANGE 3.0f    // The maximum height range of the terrain
@@ -24,84 +35,239 @@
 #define WATER_LEVEL -1.5f     // elevation of water surface as offset from avg
 #define WATER_TEX_REPS 35.0f  // number of times to repeat the water texture
 #define WATER_START_PROX 2.0f // Starting distance from the edge of the water
-#define TREE_COUNT 500        // The number of trees in this world
+#define TREE_COUNT 500        // The number of trees in this world (fewer are placed if they don't fit)
 #define TREE_RANGE_L 0.2f     // The maximum size range of the trees (multiplier)
 #define TREE_RANGE_H 0.75f    // The maximum size range of the trees (multiplier)
 #define TREE_SINK 0.0f        // how far underground trees extend
 #define TREE_MIN_PROX 0.25f   // minimum distance between trees
 #define TREE_MIN_STAND 0.2f   // the closest the viewer can stand to a tree
+#define TREE_GRID_CELL 0.5f   // cell size of the spatial grid used to look up trees by location
+#define TREE_SPREAD 0.5f      // spacing of candidate tree sites, as a fraction of the average spacing if TREE_COUNT trees covered all dry land
+#define TREE_LINE 6.0f        // height above the water at which trees stop growing
+#define TREE_SLOPE_MAX 1.0f   // steepest slope (rise over run) that trees can grow on
+#define TREE_MAX_ATTEMPTS 2000000 // hard cap on the number of candidate tree sites tried while placing trees
+#define TREE_OBJ "Spruce.obj" // The tree model
+#define TREE_LODS 3           // Levels of detail of the tree model, not counting the impostors
+#define TREE_SIMPLIFY_CELLS 16 // Grid cells across the tree model for level 1.  Each level after that halves it (see meshsimplify.h)
+#define TREE_LOD_DISTANCE 20.0f // Trees closer than this (divided by their scale) are drawn at full detail.  Each doubling of the distance drops one level, and past the last level they are impostors
+#define TREE_LOD_FADE 0.2f    // Width of the cross-fade between levels, as a fraction of the switch distance
+#define IMPOSTOR_VIEWS 8      // Directions around the tree that the impostors are baked from
+#define IMPOSTOR_SIZE 128     // Width and height in pixels of each view of the impostor texture
+#define IMPOSTOR_LEVELS 4     // Mipmap levels of the impostor texture
+#define IMPOSTOR_GUTTER 8     // Transparent pixels on each side of each view, so the mipmaps don't blend the views.  At least 2^(IMPOSTOR_LEVELS - 1)
 #define EDGE_DISTANCE 1.0f    // the closest the viewer can be to the edge of the world (in walkaround mode)
 #define EYE_HEIGHT  0.5f      // How high the viewer's eyes are above the ground
+#define LAKE_RETRIES 11       // The number of other worlds to try if no lake is found from the starting position
+#define WORLD_GEN_VERSION 3   // Bump when the generator changes in a way the parameters above don't capture (invalidates cached worlds)
+
+// Surface textures.  The land, water, and tree textures are layers of one array texture, so the main shader binds it
+// once per frame and picks a layer per draw.  Every layer is scaled to the same size.
+#define LAND_TEXTURE ":/textures/Land/85290912-seamless-tileable-natural-ground-field-texture.jpg"
+#define WATER_TEXTURE ":/textures/Water/WaterPlain0012_1_270.jpg"
+#define TEXTURE_LAYER_SIZE 1024 // width and height of each layer
+#define LAYER_LAND 0
+#define LAYER_WATER 1
+#define LAYER_TREE 2            // first tree section; the rest follow in order
+
+// Random number streams.  Each subsystem draws from its own stream so that they don't affect each other.
+#define RNG_TERRAIN 1
+#define RNG_TREES 2
+#define RNG_PAGE_TREES 3     // with a seed of each page's own (see worldpager.cpp)
+
+// Land level of detail parameters:
+#define TILE_DIVS 33          // The number of grid points along each side of a land tile.  TILE_DIVS-1 must be a power of 2 and must divide LAND_DIVS-1.
+#define TILE_COUNT ((LAND_DIVS - 1) / (TILE_DIVS - 1)) // The number of land tiles in each cardinal direction
+#define TILE_LODS 6           // The number of levels of detail for a tile.  Level n uses every 2^n grid points, so 2^(TILE_LODS-1) must not exceed TILE_DIVS-1
+#define LOD_DISTANCE 6.0f     // Tiles closer than this are drawn at full detail.  Each doubling of the distance drops one level
+
+// Tile edges that need to be stitched to a coarser neighbor
+#define STITCH_N 1            // -z edge
+#define STITCH_E 2            // +x edge
+#define STITCH_S 4            // +z edge
+#define STITCH_W 8            // -x edge
+
+// Streaming world parameters (see worldpager.h):
+#define STREAM_RADIUS (3.0f * WORLD_DIM) // Pages are kept loaded this far around the viewer; the same as the far clipping plane in sceneRenderer::resize()
+#define STREAM_WINDOW 2048    // Width and depth in grid points of the height texture the loaded pages wrap around.  A power of 2, a multiple of TILE_DIVS-1, and well over twice STREAM_RADIUS
+#define STREAM_PAGES (STREAM_WINDOW / (TILE_DIVS - 1)) // Pages across the height texture
+
+// Terrain editing brushes (see GeometryEngine::editTerrain())
+#define BRUSH_RAISE 0         // push the ground up
+#define BRUSH_LOWER 1         // push it down
+#define BRUSH_FLATTEN 2       // pull it toward the height at the middle of the brush
+#define BRUSH_SMOOTH 3        // pull each point toward the average of its neighbors
 
 // Convenience macros to improve code readability
 #define Coord_2on1(X, Z) ((Z)*LAND_DIVS + (X))
-#define Frand(RANGE) (float(rand()) * float(RANGE) / float(RAND_MAX))
+#define Tile_2on1(X, Z) ((Z)*TILE_COUNT + (X))
 #define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
 #define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
 
-// Packed structures to use for the OpenGL VBOs
-struct unlitVertexData
+// The location of one set of land tile indices within the land index buffer
+struct lodRange
 {
-    QVector3D position;
-    QVector2D texCoord;
+    int offset, count;
 };
 
-struct vertexData
-{
-    QVector3D position;
-    QVector2D texCoord;
-    QVector3D normal;
-};
-
-struct facetChunkData
-{
-    GLushort base, count;
-};
-
-class GeometryEngine : protected QOpenGLFunctions
+class GeometryEngine : protected QOpenGLExtraFunctions
 {
 public:
-    GeometryEngine();
+    GeometryEngine(quint32 seed, bool useCache = true);
     virtual ~GeometryEngine();
 
-    void drawSkyCubeGeometry(QOpenGLShaderProgram *program);
-    void drawLandGeometry(QOpenGLShaderProgram *program);
-    void drawWaterGeometry(QOpenGLShaderProgram *program);
-    void drawTreeGeometry(QOpenGLShaderProgram *program);
+    // Loading happens in two stages.  prepare() does all of the CPU work (generating or loading the world, reading the
+    // tree model, decoding its textures) and may run on a worker thread.  upload() then creates the GL objects from
+    // the results, registering the materials with the render queue, and must run on the thread that owns the GL
+    // context.  Nothing else may be called before prepare() finishes, and nothing may be drawn before upload().
+    // upload() returns false if the materials don't fit in the render queue.
+    void prepare(void);
+    bool upload(renderQueue &queue);
+
+    // Draw the land from a texture of its heights and one shared tile patch, displaced in the vertex shader, instead of
+    // from a vertex buffer of the whole grid.  The land program must be built to match (HEIGHT_TEXTURE in
+    // vland.glsl).  Off by default.  Call before prepare().
+    void setHeightTexture(bool on) { heightTexture = on; }
+
+    // Make the world endless:  rather than one world of fixed size, generate pages of it on the thread pool as the
+    // viewer comes near them, and forget the ones left far behind (see worldpager.h).  Implies the height texture, and
+    // the land program must also be built with STREAMING in vland.glsl.  The streaming world isn't cached and can't be
+    // sculpted.  Off by default.  Call before prepare().
+    void setStreaming(bool on) { streaming = on; heightTexture = heightTexture || on; }
+
+    // The draw functions submit their draws to a render queue; nothing is drawn until the queue is flushed.  The
+    // per-frame uniforms (matrices and light position) must be set on the programs before then.
+    void drawSkyCubeGeometry(renderQueue &queue, QOpenGLShaderProgram *program, QOpenGLTexture *texture);
+    void drawLandGeometry(renderQueue &queue, QOpenGLShaderProgram *program, const QVector3D &eye);
+    void drawWaterGeometry(renderQueue &queue, QOpenGLShaderProgram *program);
+    void drawTreeGeometry(renderQueue &queue, QOpenGLShaderProgram *program);
+    void drawImpostorGeometry(renderQueue &queue, QOpenGLShaderProgram *program);
+
+    // Render the tree from IMPOSTOR_VIEWS directions into the impostor texture, with the program used for the trees
+    // and a light at lightPos in world coordinates.  Call after upload(), with the GL context current.
+    void bakeImpostors(renderQueue &queue, QOpenGLShaderProgram *program, const QVector3D &lightPos);
     float getHeight(float x, float z, bool stayAbove = true);
+
+    // Sculpt the land with a brush (BRUSH_ above) centered on (x, z), fading out to nothing at radius.  amount is how
+    // far raise and lower move the middle of the brush, and the fraction of the way there that flatten and smooth
+    // move it.  Only the grid points under the brush are changed, only the normals they affect are recomputed, the
+    // trees on them move with the ground, and the average height (and so the water level) is adjusted by the
+    // difference.  The GPU copy catches up, just for the changed rectangle, at the next drawLandGeometry().  Does
+    // nothing in the streaming world.
+    void editTerrain(int brush, float x, float z, float radius, float amount);
+
+    // Find where a ray from origin along dir first meets the land.  Returns false if it leaves the world first.
+    bool pickLand(const QVector3D &origin, const QVector3D &dir, QVector3D &hit);
     bool adjustViewerPos(QVector3D &viewerPos, QVector2D searchDir);
     float getWaterLevel(void) { return waterLevel; }
     void placeTrees(void);
     void move(QVector3D &viewerPos, QVector2D dir);
+    void cull(const QMatrix4x4 &viewProjection, const QVector3D &eye);
+    const cullStats &getCullStats(void) { return stats; }
+    QVector3D getStartPos(void) { return startPos; }
+    quint32 getSeed(void) { return worldSeed; }
 
-    QVector4D treeSpot[TREE_COUNT]; // xyz for location of each tree.  W will use for random scaling
+    QVector<QVector4D> treeSpot; // xyz for location of each tree.  W will use for random scaling
 
 private:
+    void prepareLandGeometry();
+    void prepareLandIndices();
+    void preparePages();
+    void prepareTreeGeometry();
+    void prepareTreeInstances();
+    void prepareTextures();
+    void generateWorld(quint32 seed);
+    bool loadWorld(worldCache &cache);
+    void saveWorld(worldCache &cache);
+    void generateTerrain(void);
+    void buildLandVerts(void);
+    void computeLandNormals(void);
+    QVector3D landNormal(int xi, int zi);
     void initSkyCubeGeometry();
     void initLandGeometry();
     void initWaterGeometry();
+    void updateWaterGeometry(float x = 0.0f, float z = 0.0f, float extent = WORLD_DIM);
     void initTreeGeometry();
+    void initTreeInstances();
+    void initImpostorGeometry();
+    void initTextures();
+    bool initMeshes(renderQueue &queue);
+    void buildTileIndices(int lod, int stitchMask, QVector<GLushort> &indices);
+    void selectLandLod(const QVector3D &eye);
+    void uploadLandEdits();
+    void cullPages(const viewFrustum &frustum, const QVector3D &eye);
+    void selectPageLod(const QVector3D &eye);
+    void uploadPage(worldPage *page);
 
-    void diamondSquare(int size, bool presetCenter = false);
-    void squareStep(int x, int z, int reach);
-    void diamondStep(int x, int z, int reach);
 
-    vertexData landVerts[LAND_DIVS * LAND_DIVS]; // Make this array a class member so we don't have to pass it around on the stack
+    // The fixed size world's land grid, LAND_DIVS x LAND_DIVS.  Left empty for the streaming world, whose pages carry
+    // their own heights.
+    QVector<float> landHeight;      // Terrain heights as a flat array for the generator
+    QVector<vertexData> landVerts;  // Make this array a class member so we don't have to pass it around on the stack
+    QVector3D tileMin[TILE_COUNT * TILE_COUNT];  // Bounding box of each land tile
+    QVector3D tileMax[TILE_COUNT * TILE_COUNT];
+    int tileLod[TILE_COUNT * TILE_COUNT];        // Level of detail chosen for each land tile for the current frame
+    lodRange landLod[TILE_LODS][16];             // Index ranges for each level of detail and stitching combination
 
     QOpenGLBuffer skyVertBuf;
     QOpenGLBuffer skyFacetsBuf;
     QOpenGLBuffer landVertBuf;
     QOpenGLBuffer landFacetsBuf;
+    QOpenGLBuffer landPatchBuf;           // One tile's grid points, for the height texture
+    QOpenGLBuffer landInstBuf[TILE_LODS]; // Per-instance attribute buffer for each level; one entry per tile drawn at it
     QOpenGLBuffer waterVertBuf;
     QOpenGLBuffer waterFacetsBuf;
-    QVector<QOpenGLBuffer> treeVertBuf;
+    QVector<QOpenGLBuffer> treeVertBuf;   // The tree sections of every level of detail, level by level
     QVector<QOpenGLBuffer> treeFacetsBuf;
-    QVector<QOpenGLTexture *> treeTexture;
-    QVector<QVector<facetChunkData>> facetChunk;
+    QOpenGLBuffer treeInstBuf[TREE_LODS]; // Per-instance attribute buffer for each level; one treeSpot entry per tree drawn at it
+    QOpenGLBuffer impostorVertBuf;
+    QOpenGLBuffer impostorFacetsBuf;
+    QOpenGLBuffer impostorInstBuf;
+    renderMesh skyMesh, landMesh, waterMesh, impostorMesh;
+    renderMesh landPatchMesh[TILE_LODS];  // The patch with each level's instance buffer
+    QVector<renderMesh> treeSectionMesh;  // Same order as treeVertBuf
+    int landMaterial, waterMaterial, impostorMaterial; // Material indices in the render queue
+    QVector<int> treeRenderMaterial;
+    QOpenGLTexture *impostorTexture;      // IMPOSTOR_VIEWS views of the tree side by side with gutters between, or null until baked
+    spatialGrid treeGrid;      // Tree locations, for finding nearby trees without checking every tree
+    QOpenGLTexture *surfaceTexture;     // Array texture with every LAYER_ above
+    QOpenGLTexture *landHeightTexture;  // The land heights, normalized over -WORLD_DIM..WORLD_DIM, or null
+    QVector<materialData> treeMaterial; // Material of each tree section
+    QVector3D treeMin, treeMax;         // Bounding box of the tree model
+    float treeRadius;                   // Farthest the tree model reaches from its trunk
+
+    // Results of prepare() waiting for upload().  upload() releases them.
+    QVector<landVertexData> landTileVerts;
+    QVector<GLushort> landHeightData;   // for landHeightTexture
+    QVector<GLushort> landIndices;
+    meshFile treeMesh;                  // the tree model, if it came from a mesh file...
+    QVector<meshSection> treeSections;  // ...otherwise converted from the obj
+    QVector<meshSection> treeLodSections; // Levels of detail from 1 up, level by level
+    QVector<QSharedPointer<textureFile>> layerFile; // cached texture for each layer of surfaceTexture
+
+    cullQuadtree tileCull, treeCull;
+    cullStats stats;
+    QVector<int> visibleItems;       // Scratch space for culling results (kept to avoid reallocating every frame)
+    QVector<QVector4D> visibleSpots; // treeSpot entries of the visible trees, nearest first
+    QVector<QVector4D> lodSpots[TREE_LODS + 1]; // visibleSpots sorted into levels of detail; the last is the impostors
+    QVector<int> visibleTiles;       // the visible land tiles, nearest first
+    QVector<QVector4D> lodTiles[TILE_LODS]; // visibleTiles sorted into levels of detail, as landInstBuf entries
+
+    worldPager *pager;                 // The pages of the streaming world, or null
+    QVector<worldPage *> visiblePages; // the pages in view, nearest first
+    QVector<QPoint> windowPage;        // The page last copied into each place in landHeightTexture, as (px, pz)
 
     float landAvg, waterLevel;
-    wavefrontObj tree;
-    float closestTree(float x, float z);
+    QRect landDirty;    // Grid points whose height or normal editTerrain() has changed since the GPU copy was updated
+    bool waterMoved;    // and whether the water level has
+    QVector3D startPos; // Where the viewer starts; at the shore of the lake if there is one
+    quint32 worldSeed;  // Seed the current world was generated from
+    quint32 requestedSeed;
+    bool useCache;
+    bool compressTextures;
+    bool heightTexture;
+    bool streaming;
+    float treeDensity(float x, float z);
+    int landIndex(float wx, float wz);
 };
 
 #endif // GEOMETRYENGINE_H
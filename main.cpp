@@ -6,27 +6,140 @@
 ****************************************************************************/
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QLabel>
+#include <QStringList>
 #include <QSurfaceFormat>
-#include <time.h>       // For seeding rand()
+#include <string.h>     // for strcmp()
+#include <time.h>       // For picking a seed when none is given
 
+#include <iostream>
+using namespace std;
+
+#include "benchmark.h"
+#include "framehistogram.h"
 #ifndef QT_NO_OPENGL
 #include "mainwidget.h"
 #endif
 
 int main(int argc, char *argv[])
 {
-    srand(time(0));
+    // The headless benchmark needs no display.  Unless told otherwise, use the platform plugin that doesn't open one.
+    // This has to be settled before the application object exists, so look for the option by hand.
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "--headless") && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+
     QApplication app(argc, argv);
 
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
+    format.setVersion(3, 3);                           // for the shaders' uniform blocks
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setSwapInterval(1);                         // vsync; the window draws continuously at the display's rate
     QSurfaceFormat::setDefaultFormat(format);
 
     app.setApplicationName("meadow - Timothy Mason");
     app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("A randomly generated mountain lake scene");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption seedOption("seed", "Generate the world from seed <n> instead of a random one.", "n");
+    QCommandLineOption noCacheOption("no-cache", "Always generate the world; don't use the world cache.");
+    QCommandLineOption budgetOption("budget", QString("Count frames longer than <ms> as over budget (default %1).")
+                                    .arg(FRAME_BUDGET_MS, 0, 'f', 1), "ms");
+    QCommandLineOption noPrepassOption("no-prepass", "Draw the trees without a depth pre-pass.");
+    QCommandLineOption heightTextureOption("height-texture", "Draw the land from a height texture instead of a vertex "
+                                           "buffer.");
+    QCommandLineOption streamOption("stream", "Make the world endless, generating it around the viewer instead of all "
+                                    "at once.");
+    QCommandLineOption headlessOption("headless", "Run the benchmark offscreen instead of opening a window.");
+    QCommandLineOption framesOption("frames", QString("Benchmark <n> frames (default %1).").arg(BENCH_FRAMES), "n");
+    QCommandLineOption sizeOption("size", QString("Benchmark at <w>x<h> pixels (default %1x%2).").arg(BENCH_WIDTH)
+                                  .arg(BENCH_HEIGHT), "wxh");
+    QCommandLineOption outputOption("output", QString("Write the benchmark results to <file>, as JSON if it ends in "
+                                    ".json and CSV otherwise (default %1).").arg(BENCH_OUTPUT), "file");
+    parser.addOption(seedOption);
+    parser.addOption(noCacheOption);
+    parser.addOption(budgetOption);
+    parser.addOption(noPrepassOption);
+    parser.addOption(heightTextureOption);
+    parser.addOption(streamOption);
+    parser.addOption(headlessOption);
+    parser.addOption(framesOption);
+    parser.addOption(sizeOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+    bool headless = parser.isSet(headlessOption);
+
+    // Every world is made from a single seed, so the same seed always gives the same world.  The benchmark always
+    // uses the same world unless it's given one.
+    quint32 seed = headless ? BENCH_SEED : quint32(time(0));
+    if (parser.isSet(seedOption))
+    {
+        bool ok;
+        seed = parser.value(seedOption).toUInt(&ok);
+        if (!ok)
+        {
+            cerr << "Invalid seed: " << parser.value(seedOption).toStdString() << endl;
+            return 1;
+        }
+    }
+    cout << "World seed " << seed << " (run with --seed " << seed << " to see this world again)" << endl;
+
 #ifndef QT_NO_OPENGL
-    MainWidget widget;
+    if (headless)
+    {
+        benchmarkOptions options = {seed, !parser.isSet(noCacheOption), !parser.isSet(noPrepassOption),
+                                    parser.isSet(heightTextureOption), parser.isSet(streamOption), BENCH_FRAMES,
+                                    BENCH_WIDTH, BENCH_HEIGHT,
+                                    parser.isSet(outputOption) ? parser.value(outputOption) : QString(BENCH_OUTPUT)};
+        if (parser.isSet(framesOption))
+        {
+            bool ok;
+            options.frames = parser.value(framesOption).toInt(&ok);
+            if (!ok || options.frames < 1)
+            {
+                cerr << "Invalid frame count: " << parser.value(framesOption).toStdString() << endl;
+                return 1;
+            }
+        }
+        if (parser.isSet(sizeOption))
+        {
+            QStringList wh = parser.value(sizeOption).split('x');
+            bool okW = false, okH = false;
+            if (wh.size() == 2)
+            {
+                options.width = wh[0].toInt(&okW);
+                options.height = wh[1].toInt(&okH);
+            }
+            if (!okW || !okH || options.width < 1 || options.height < 1)
+            {
+                cerr << "Invalid size: " << parser.value(sizeOption).toStdString() << endl;
+                return 1;
+            }
+        }
+        return runBenchmark(options);
+    }
+
+    float budget = FRAME_BUDGET_MS;
+    if (parser.isSet(budgetOption))
+    {
+        bool ok;
+        budget = parser.value(budgetOption).toFloat(&ok);
+        if (!ok || budget <= 0.0f)
+        {
+            cerr << "Invalid frame budget: " << parser.value(budgetOption).toStdString() << endl;
+            return 1;
+        }
+    }
+
+    MainWidget widget(seed, !parser.isSet(noCacheOption), budget);
+    widget.setDepthPrepass(!parser.isSet(noPrepassOption));
+    widget.setHeightTexture(parser.isSet(heightTextureOption));
+    widget.setStreaming(parser.isSet(streamOption));
     widget.resize(widget.sizeHint());
     widget.show();
 #else
@@ -7,32 +7,44 @@
 
 #include "mainwidget.h"
 
+#include <QDateTime>
 #include <QMouseEvent>
+#include <QPainter>
 
 #include <math.h>
 
-MainWidget::MainWidget(QWidget *parent) : QOpenGLWidget(parent),
-                                          geometries(0),
-                                          skyTexture(NULL), landTexture(NULL), waterTexture(NULL),
-                                          viewerPos(WORLD_DIM - 1.0f, 0, WORLD_DIM - 1.0f),
-                                          // Default looking at sun (to show off the water's specular spot)
-                                          lookDir(-0.707106781, 0.0f, -0.707106781),
-                                          th(225.0f), ph(0.0f)
+#include <iostream>
+using namespace std;
+
+MainWidget::MainWidget(quint32 seed, bool useCache, float budgetMs, QWidget *parent) : QOpenGLWidget(parent),
+                                                                       scene(seed, useCache),
+                                                                       firstFrame(true), lastGlCalls(-1), showProfile(false),
+                                                                       lastTick(0), lag(0.0), frameTimes(budgetMs),
+                                                                       lastSwap(-1), inputTime(-1), inputDrawn(false),
+                                                                       viewerPos(WORLD_DIM - 1.0f, 0, WORLD_DIM - 1.0f),
+                                                                       // Default looking at sun (to show off the water's specular spot)
+                                                                       lookDir(-0.707106781, 0.0f, -0.707106781),
+                                                                       th(225.0f), ph(0.0f)
 {
+    startTime.start();
+    clock.start();
+
+    // Draw continuously.  Each frame is started as soon as the last one is on screen, so with vsync on (see main())
+    // the display sets the pace.
+    connect(this, &QOpenGLWidget::frameSwapped, this, &MainWidget::frameShown);
+
     // Disable mouse tracking - mousepos events will only fire when left mouse button pressed
     setMouseTracking(false);
 
     //  Set window title
-    setWindowTitle("meadow - Timothy Mason's final project");
+    setWindowTitle(WINDOW_TITLE);
 }
 
 MainWidget::~MainWidget()
 {
     // Make sure the context is current when deleting textures and buffers.
     makeCurrent();
-    delete skyTexture;
-    delete landTexture;
-    delete geometries;
+    scene.release();
     doneCurrent();
 }
 
@@ -48,64 +60,160 @@ QSize MainWidget::sizeHint() const
 
 void MainWidget::keyPressEvent(QKeyEvent *e)
 {
-    QVector2D mvDir(lookDir.x(),lookDir.z());
-    mvDir.normalize(); // Move a fixed amount, even if user is starting at the sky or the ground
-    mvDir *= MOVE_AMT;
+    // Movement keys are only noted here; the simulation moves the viewer for as long as they're held.  Repeats from
+    // holding a key down are ignored, so the speed doesn't depend on the keyboard's repeat rate.
+    if (e->isAutoRepeat())
+    {
+        QOpenGLWidget::keyPressEvent(e);
+        return;
+    }
 
     switch (e->key())
     {
-    case Qt::Key_W:
-        // Move forward
-        geometries->move(viewerPos, mvDir);
+    case Qt::Key_W: // forward
+    case Qt::Key_S: // backwards
+    case Qt::Key_X: // backwards
+    case Qt::Key_A: // left
+    case Qt::Key_D: // right
+    case Qt::Key_Q: // diagonal fwd-left
+    case Qt::Key_E: // diagonal fwd-right
+    case Qt::Key_Z: // diagonal back-left
+    case Qt::Key_C: // diagonal back-right
+    case Qt::Key_1: // raise the ground
+    case Qt::Key_2: // lower it
+    case Qt::Key_3: // flatten it
+    case Qt::Key_4: // smooth it
+        heldKeys.insert(e->key());
+        if (inputTime < 0)
+            inputTime = clock.nsecsElapsed();
         break;
 
-    case Qt::Key_S:
-    case Qt::Key_X:
-        // Move backwards
-        geometries->move(viewerPos, -mvDir);
+    case Qt::Key_F3:
+        // Show or hide the profiler overlay
+        showProfile = !showProfile;
         break;
 
-    case Qt::Key_A:
-        // Move left
-        geometries->move(viewerPos, QVector2D(mvDir.y(), -mvDir.x()));
+    case Qt::Key_F5:
+        // Turn the trees' depth pre-pass on or off, to compare the two in the profiler
+        scene.setDepthPrepass(!scene.getDepthPrepass());
+        cout << "Depth pre-pass " << (scene.getDepthPrepass() ? "on" : "off") << endl;
         break;
 
-    case Qt::Key_D:
-        // Move right;
-        geometries->move(viewerPos, QVector2D(-mvDir.y(), mvDir.x()));
-        break;
-    
-    case Qt::Key_Q:
-        // Move diagonal fwd-left
-        geometries->move(viewerPos, QVector2D( (mvDir.x()+mvDir.y())/2, (mvDir.y()-mvDir.x()/2)));
-        break;
-    
-    case Qt::Key_E:
-        // Move diagonal fwd-right
-        geometries->move(viewerPos, QVector2D( (mvDir.x()-mvDir.y())/2, (mvDir.y()+mvDir.x()/2)));
-        break;
-
-    case Qt::Key_Z:
-        // Move diagonal back-left
-        geometries->move(viewerPos, QVector2D( (-mvDir.x()+mvDir.y())/2, (-mvDir.y()-mvDir.x()/2)));
-        break;
-    
-    case Qt::Key_C:
-        // Move diagonal back-right
-        geometries->move(viewerPos, QVector2D( (-mvDir.x()-mvDir.y())/2, (-mvDir.y()+mvDir.x()/2)));
+    case Qt::Key_F4:
+    {
+        // Save the profile of the last few seconds, and the frame time histograms
+        QString now = QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss");
+        scene.getProfiler().exportCsv(QString(PROFILE_EXPORT).arg(now));
+        QStringList names;
+        names << "frames" << "input";
+        writeHistograms(QString(HISTOGRAM_EXPORT).arg(now), names,
+                        QVector<const frameHistogram *>() << &frameTimes << &inputLatency);
         break;
+    }
 
     case Qt::Key_Escape:
 
         // exit application
         close();
     }
-    update();
 
     // Allow the base class to also handle all keypress events
     QOpenGLWidget::keyPressEvent(e);
 }
 
+void MainWidget::keyReleaseEvent(QKeyEvent *e)
+{
+    if (!e->isAutoRepeat())
+        heldKeys.remove(e->key());
+    QOpenGLWidget::keyReleaseEvent(e);
+}
+
+void MainWidget::focusOutEvent(QFocusEvent *e)
+{
+    // Keys let go of in another window never send a release here
+    heldKeys.clear();
+    inputTime = -1;
+    QOpenGLWidget::focusOutEvent(e);
+}
+
+// Catch the simulation up with real time
+void MainWidget::tick()
+{
+    qint64 now = clock.nsecsElapsed();
+    lag += (now - lastTick) / 1.0e9;
+    lastTick = now;
+
+    const double step = 1.0 / SIM_HZ;
+    for (int steps = 0; lag >= step && steps < SIM_MAX_STEPS; steps++)
+    {
+        previousPos = viewerPos;
+        simulate(float(step));
+        lag -= step;
+    }
+
+    // Drop whatever couldn't be caught up, rather than running ever more steps per frame
+    lag = fmod(lag, step);
+}
+
+// Advance the world by one step of dt seconds
+void MainWidget::simulate(float dt)
+{
+    // Add up the held keys into forward and rightward movement
+    float forward = 0.0f, right = 0.0f;
+    if (heldKeys.contains(Qt::Key_W) || heldKeys.contains(Qt::Key_Q) || heldKeys.contains(Qt::Key_E))
+        forward += 1.0f;
+    if (heldKeys.contains(Qt::Key_S) || heldKeys.contains(Qt::Key_X) || heldKeys.contains(Qt::Key_Z) ||
+        heldKeys.contains(Qt::Key_C))
+        forward -= 1.0f;
+    if (heldKeys.contains(Qt::Key_D) || heldKeys.contains(Qt::Key_E) || heldKeys.contains(Qt::Key_C))
+        right += 1.0f;
+    if (heldKeys.contains(Qt::Key_A) || heldKeys.contains(Qt::Key_Q) || heldKeys.contains(Qt::Key_Z))
+        right -= 1.0f;
+    if (inputTime >= 0)
+        inputDrawn = true; // this step used the key press; the next frame drawn shows it
+
+    // Sculpt the ground where the viewer is looking for as long as a brush key is held, and keep the viewer on it
+    const int brushes[][2] = {{Qt::Key_1, BRUSH_RAISE}, {Qt::Key_2, BRUSH_LOWER}, {Qt::Key_3, BRUSH_FLATTEN},
+                              {Qt::Key_4, BRUSH_SMOOTH}};
+    GeometryEngine *world = scene.geometry();
+    QVector3D target;
+    for (const auto &brush : brushes)
+    {
+        if (heldKeys.contains(brush[0]) && world->pickLand(viewerPos, lookDir, target))
+        {
+            world->editTerrain(brush[1], target.x(), target.z(), BRUSH_SIZE, BRUSH_RATE * dt);
+            viewerPos.setY(world->getHeight(viewerPos.x(), viewerPos.z(), false) + EYE_HEIGHT);
+        }
+    }
+
+    QVector2D amount(forward, right);
+    if (amount.isNull())
+        return;
+    amount.normalize(); // diagonals aren't any faster
+    amount *= WALK_SPEED * dt;
+
+    QVector2D mvDir(lookDir.x(), lookDir.z());
+    mvDir.normalize(); // Move a fixed amount, even if user is starting at the sky or the ground
+    scene.geometry()->move(viewerPos, mvDir * amount.x() + QVector2D(-mvDir.y(), mvDir.x()) * amount.y());
+}
+
+// A frame has reached the screen.  Time it, and start the next one.
+void MainWidget::frameShown()
+{
+    qint64 now = clock.nsecsElapsed();
+    if (lastSwap >= 0 && scene.isLoaded())
+        frameTimes.add((now - lastSwap) / 1.0e6f);
+    lastSwap = now;
+
+    if (inputDrawn)
+    {
+        inputLatency.add((now - inputTime) / 1.0e6f);
+        inputTime = -1;
+        inputDrawn = false;
+    }
+    update();
+}
+
 void MainWidget::mouseMoveEvent(QMouseEvent *e)
 {
     // Use mouse movement to update where the viewer is looking
@@ -129,8 +237,7 @@ void MainWidget::mouseMoveEvent(QMouseEvent *e)
     // Save the current mouse position so we can calculate a delta on the next mouse move
     mouseLastPosition = QVector2D(e->localPos());
 
-    // Redraw the scene with the new view
-    update();
+    // The render loop draws the new view on the next frame
 }
 
 void MainWidget::mousePressEvent(QMouseEvent *e)
@@ -143,143 +250,86 @@ void MainWidget::initializeGL()
 {
     initializeOpenGLFunctions();
 
-    glClearColor(0.31f, 0.43f, 0.65f, 1); // Sky color sampled from the skybox texture
-
-    initShaders();
-    initTextures();
-
-    // Enable depth buffer
-    glEnable(GL_DEPTH_TEST);
-
-    // Instantiate our geometry class
-    geometries = new GeometryEngine;
-
-    //
-    // Adjust starting position to be near the lake.
-    //
-    int retries = 11;
-    while (!geometries->adjustViewerPos(viewerPos, QVector2D(-0.707106781, -0.707106781)) && retries--)
-    {
-        // Lake not found.  Delete this world and make another one.  Oh, the POWER!!!
-        delete geometries;
-        geometries = new GeometryEngine;
-    }
-
-    viewerPos.setY(geometries->getHeight(viewerPos.x(), viewerPos.z()) + EYE_HEIGHT);
-}
-
-void MainWidget::initShaders()
-{
-    // Compile vertex shaders
-    if (!skyProgram.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/vtexonly.glsl"))
-        close();
-    if (!mainProgram.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/vmain.glsl"))
-        close();
-
-    // Compile fragment shaders
-    if (!skyProgram.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/ftexonly.glsl"))
-        close();
-    if (!mainProgram.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/fmain.glsl"))
+    // The world loads in the background; paintGL() shows the plain sky color until it's all in place
+    if (!scene.initialize())
         close();
 
-    // Link shader pipelines
-    if (!skyProgram.link())
-        close();
-    if (!mainProgram.link())
-        close();
-}
-
-void MainWidget::initTextures()
-{
-    // Load textures
-    skyTexture = new QOpenGLTexture(QImage(":/textures/Sky/2226.png").mirrored());
-    landTexture = new QOpenGLTexture(QImage(":/textures/Land/85290912-seamless-tileable-natural-ground-field-texture.jpg").mirrored());
-    waterTexture = new QOpenGLTexture(QImage(":/textures/Water/WaterPlain0012_1_270.jpg").mirrored());
-
-    // Set texture display parameters
-    skyTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
-    landTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
-    waterTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
-
-    skyTexture->setMagnificationFilter(QOpenGLTexture::Linear);
-    landTexture->setMagnificationFilter(QOpenGLTexture::Linear);
-    waterTexture->setMagnificationFilter(QOpenGLTexture::Linear);
-
-    skyTexture->setWrapMode(QOpenGLTexture::Repeat);
-    landTexture->setWrapMode(QOpenGLTexture::Repeat);
-    waterTexture->setWrapMode(QOpenGLTexture::Repeat);
+    // Always measure, so the overlay has figures to show as soon as it's opened
+    scene.getProfiler().setEnabled(true);
 }
 
 void MainWidget::resizeGL(int w, int h)
 {
-    // Calculate aspect ratio to keep pixels square
-    qreal aspect = qreal(w) / qreal(h ? h : 1);
-
-    const qreal zNear = 1.0f / WORLD_DIM;
-    const qreal zFar = 3.0f * WORLD_DIM;
-    const qreal fov = 55.0;
-
-    // Set perspective projection
-    projection.setToIdentity();
-    projection.perspective(fov, aspect, zNear, zFar);
+    scene.resize(w, h);
 }
 
 // Render the world (one frame at a time)
 void MainWidget::paintGL()
 {
-    // Clear color and depth buffer
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Calculate model view transformation matrix
-    QMatrix4x4 matrix;
-    matrix.lookAt(viewerPos, viewerPos + lookDir, QVector3D(0, 1, 0)); // +Y is always up
-
-    // Locate a light source to correspond (roughly) with the sun in the skybox texture (3/4 up, 3/4 back, on the left face)
-    QVector3D lightPos(-WORLD_DIM, WORLD_DIM / 2.0f, -WORLD_DIM / 2.0f);
-    lightPos = QVector3D(matrix * lightPos); // transform the light to world coordinates
-
-    // Bind skybox shader pipeline (no lighting on the skybox)
-    if (!skyProgram.bind())
-        close();
-
-    // Draw the skybox
-    skyProgram.setUniformValue("mvp_matrix", projection * matrix);
-    skyProgram.setUniformValue("texture", 0);
-    skyTexture->bind();
-    geometries->drawSkyCubeGeometry(&skyProgram);
-
-    // Bind land & water shader pipeline
-    if (!mainProgram.bind())
-        close();
-
-    // Set uniforms for the main shader
-    mainProgram.setUniformValue("mv_matrix", matrix);
-    mainProgram.setUniformValue("mvp_matrix", projection * matrix);
-    mainProgram.setUniformValue("normalMatrix", matrix.normalMatrix());
-    mainProgram.setUniformValue("lightPosition", lightPos);
+    if (firstFrame)
+    {
+        cout << "First frame after " << startTime.elapsed() << " ms" << endl;
+        firstFrame = false;
+    }
 
-    // Draw the water
-    waterTexture->bind();
-    geometries->drawWaterGeometry(&mainProgram);
+    // Still loading.  Upload whatever is ready, and leave the sky color up until it's all there.  The world can't be
+    // simulated before then, as moving reads the terrain.
+    if (!scene.isLoaded())
+    {
+        if (scene.load())
+        {
+            cout << "World loaded after " << startTime.elapsed() << " ms" << endl;
+            viewerPos = previousPos = scene.geometry()->getStartPos();
+            lastTick = clock.nsecsElapsed();
+            lag = 0.0;
+            heldKeys.clear();
+            inputTime = -1;
+        }
+        else if (scene.hasFailed())
+        {
+            close();
+            return;
+        }
+    }
+    else
+        tick();
 
-    // Draw the land
-    mainProgram.setUniformValue("texture", 0);
-    landTexture->bind();
-    geometries->drawLandGeometry(&mainProgram);
+    // Draw the viewer between the last two steps, as far along as the time left over
+    float alpha = float(lag * SIM_HZ);
+    scene.render(previousPos + (viewerPos - previousPos) * alpha, lookDir);
 
-    // Draw all of the trees
-    QMatrix4x4 treePos;
-    for (int i = 0; i < TREE_COUNT; i++)
+    // Show the GL call count in the title bar whenever it changes
+    const renderStats &rs = scene.getStats();
+    if (rs.glCalls != lastGlCalls)
     {
-        // Set translation matrix for each tree to individually locate and resize them in the world
-        treePos = matrix;
-        treePos.translate(geometries->treeSpot[i].toVector3D());
-        treePos.scale(geometries->treeSpot[i].w(), geometries->treeSpot[i].w(), geometries->treeSpot[i].w());
+        lastGlCalls = rs.glCalls;
+        setWindowTitle(QString("%1 - %2 draws, %3 GL calls, %4 skipped, %5 uniform bytes").arg(WINDOW_TITLE)
+                       .arg(rs.commands).arg(rs.glCalls).arg(rs.stateSkips).arg(rs.uniformBytes));
+    }
 
-        mainProgram.setUniformValue("mv_matrix", treePos);
-        mainProgram.setUniformValue("mvp_matrix", projection * treePos);
+    if (showProfile)
+        drawProfile();
+}
 
-        // Draw a tree
-        geometries->drawTreeGeometry(&mainProgram);
-    }
+// Paint the profiler's figures over the top left of the scene
+void MainWidget::drawProfile()
+{
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    font.setPointSize(9);
+    QFontMetrics metrics(font);
+
+    QStringList lines = scene.getProfiler().report();
+    lines << frameTimes.summary("frames") << inputLatency.summary("input");
+    int width = 0;
+    for (int i = 0; i < lines.size(); i++)
+        width = MAX(width, metrics.horizontalAdvance(lines[i]));
+    int lineHeight = metrics.height();
+
+    QPainter painter(this);
+    painter.fillRect(4, 4, width + 12, lines.size() * lineHeight + 8, QColor(0, 0, 0, 160));
+    painter.setFont(font);
+    painter.setPen(Qt::white);
+    for (int i = 0; i < lines.size(); i++)
+        painter.drawText(QRect(10, 8 + i * lineHeight, width, lineHeight), Qt::AlignLeft | Qt::AlignTop, lines[i]);
 }
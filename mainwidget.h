@@ -13,51 +13,80 @@
 #include <QOpenGLFunctions>
 #include <QMatrix4x4>
 #include <QVector2D>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLTexture>
+#include <QElapsedTimer>
+#include <QSet>
 #include "geometryengine.h"
+#include "scenerenderer.h"
+#include "framehistogram.h"
 
 //  Cosine and Sine in degrees
 #define Cos(x) (cos((x)*3.1415926/180.0))
 #define Sin(x) (sin((x)*3.1415926/180.0))
 
-#define MOVE_AMT    0.1f    // amount to move on each keypress
-
-class GeometryEngine;
+#define WALK_SPEED  3.0f    // world units per second while a movement key is held
+#define SIM_HZ      120     // simulation steps per second
+#define SIM_MAX_STEPS 8     // most steps run in one frame; after a longer stall the simulation skips ahead
+#define BRUSH_SIZE  2.0f    // radius of the sculpting brushes, in world units
+#define BRUSH_RATE  1.0f    // world units per second for raising and lowering; the fraction per second for flattening and smoothing
+#define WINDOW_TITLE "meadow - Timothy Mason's final project"
+#define PROFILE_EXPORT "profile-%1.csv" // F4 writes the profile here; %1 is the date and time
+#define HISTOGRAM_EXPORT "frametimes-%1.csv" // and the frame time histograms here
 
 class MainWidget : public QOpenGLWidget, protected QOpenGLFunctions
 {
     Q_OBJECT
 
 public:
-    explicit MainWidget(QWidget *parent = 0);
+    explicit MainWidget(quint32 seed, bool useCache = true, float budgetMs = FRAME_BUDGET_MS, QWidget *parent = 0);
     ~MainWidget();
     QSize minimumSizeHint() const override;
     QSize sizeHint() const override;
 
+    // Whether the trees get a depth pre-pass (F5 toggles it)
+    void setDepthPrepass(bool on) { scene.setDepthPrepass(on); }
+
+    // Whether the land is drawn from a height texture.  Only before the widget is first shown.
+    void setHeightTexture(bool on) { scene.setHeightTexture(on); }
+
+    // Whether the world is endless.  Only before the widget is first shown.
+    void setStreaming(bool on) { scene.setStreaming(on); }
+
 protected:
     void mouseMoveEvent(QMouseEvent *e) override;
     void mousePressEvent(QMouseEvent *e) override;
     void keyPressEvent(QKeyEvent *e) override;
-    
+    void keyReleaseEvent(QKeyEvent *e) override;
+    void focusOutEvent(QFocusEvent *e) override;
+
     void initializeGL() override;
     void resizeGL(int w, int h) override;
     void paintGL() override;
 
-    void initShaders();
-    void initTextures();
-
-    
+    void tick();
+    void simulate(float dt);
+    void frameShown();
+    void drawProfile();
 
 private:
-    QOpenGLShaderProgram skyProgram, mainProgram;
-    GeometryEngine *geometries;
-
-    QOpenGLTexture *skyTexture;
-    QOpenGLTexture *landTexture;
-    QOpenGLTexture *waterTexture;
-
-    QMatrix4x4 projection;
+    sceneRenderer scene;
+    bool firstFrame;         // Nothing has been shown yet
+    QElapsedTimer startTime; // For reporting how long startup takes
+    int lastGlCalls;         // GL call count shown in the title bar
+    bool showProfile;        // F3 profiler overlay is up
+
+    // The simulation runs in fixed steps of 1/SIM_HZ seconds, however fast frames are drawn.  Each frame runs as many
+    // steps as real time has passed, and draws the viewer part way between the last two steps' positions.
+    QSet<int> heldKeys;      // movement keys held down
+    QElapsedTimer clock;     // for simulation and frame timing
+    qint64 lastTick;         // clock time the simulation has caught up to, in ns
+    double lag;              // seconds of real time not yet simulated; always less than one step
+    QVector3D previousPos;   // viewer position before the last step
+
+    frameHistogram frameTimes;   // time between frames reaching the screen
+    frameHistogram inputLatency; // time from a movement key press to the first frame that shows it
+    qint64 lastSwap;             // clock time of the last frame swap, or -1
+    qint64 inputTime;            // clock time of the oldest movement key press not yet shown, or -1
+    bool inputDrawn;             // the frame just drawn shows it
 
     QVector2D mouseLastPosition;
     QVector3D viewerPos;
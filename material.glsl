@@ -0,0 +1,42 @@
+/****************************************************************************
+**
+** The materials, and the cross-fade between the trees' levels of detail,
+** for the fragment shaders that draw with the render queue's materials.
+** sceneRenderer::addShader() puts this in place of the #include line that
+** names it.
+**
+****************************************************************************/
+
+// Every material, indexed by materialIndex (see materialBlock in rendercommand.h).  sceneRenderer::addShader()
+// defines MATERIAL_CAPACITY and TREE_LOD_FADE.
+struct material
+{
+    vec4 MatAmbient;
+    vec4 MatDiffuse;
+    vec4 MatSpecular;
+    float MatShininess;
+    int layer;          // layer of the surface textures
+    float lodNear;      // distances over which a tree's level of detail is drawn; 0 for no limit
+    float lodFar;
+};
+
+layout(std140) uniform materialData
+{
+    material materials[MATERIAL_CAPACITY];
+};
+
+uniform int materialIndex; // the material for this draw
+
+// Cross-fade between the trees' levels of detail.  Within the band around a switch distance a tree is drawn at both
+// levels, and an ordered dither gives each pixel to one or the other, moving them over as the distance grows.
+// lodDistance is the distance to the tree, divided by its scale.
+bool lodHidden(material m, float lodDistance)
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+    float x = (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+
+    float fadeIn = m.lodNear > 0.0 ? clamp((lodDistance / m.lodNear - 1.0) / TREE_LOD_FADE + 0.5, 0.0, 1.0) : 1.0;
+    float fadeOut = m.lodFar > 0.0 ? clamp((lodDistance / m.lodFar - 1.0) / TREE_LOD_FADE + 0.5, 0.0, 1.0) : 0.0;
+    return x >= fadeIn || x < fadeOut;
+}
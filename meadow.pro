@@ -1,4 +1,4 @@
-QT       += core gui widgets
+QT       += core gui widgets concurrent
 
 TARGET = final
 TEMPLATE = app
@@ -7,13 +7,48 @@ SOURCES += main.cpp
 
 SOURCES += \
     mainwidget.cpp \
+    benchmark.cpp \
     geometryengine.cpp \
-    wavefrontObj.cpp
+    culling.cpp \
+    diamondsquare.cpp \
+    framehistogram.cpp \
+    meshfile.cpp \
+    meshoptimizer.cpp \
+    meshsimplify.cpp \
+    poissondisk.cpp \
+    profiler.cpp \
+    rendercommand.cpp \
+    rng.cpp \
+    scenerenderer.cpp \
+    spatialgrid.cpp \
+    texturecache.cpp \
+    uploadqueue.cpp \
+    wavefrontObj.cpp \
+    worldcache.cpp \
+    worldpager.cpp
 
 HEADERS += \
     mainwidget.h \
+    benchmark.h \
     geometryengine.h \
-    wavefrontObj.h
+    culling.h \
+    diamondsquare.h \
+    framehistogram.h \
+    meshfile.h \
+    meshoptimizer.h \
+    meshsimplify.h \
+    poissondisk.h \
+    profiler.h \
+    rendercommand.h \
+    rng.h \
+    scenerenderer.h \
+    spatialgrid.h \
+    texturecache.h \
+    uploadqueue.h \
+    vertexdata.h \
+    wavefrontObj.h \
+    worldcache.h \
+    worldpager.h
 
 RESOURCES += \
     shaders.qrc \
@@ -0,0 +1,246 @@
+/****************************************************************************
+**
+** Binary, GPU-ready mesh files.  See meshfile.h.
+**
+****************************************************************************/
+
+#include "meshfile.h"
+#include "meshoptimizer.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <string.h> // for strncpy(), memset(), memcpy()
+
+#include <iostream>
+using namespace std;
+
+// The vertex array is written and mapped as raw floats
+static_assert(sizeof(vertexData) == 8 * sizeof(float), "vertexData must be 8 packed floats");
+
+#define MESH_ALIGN 16 // alignment of each array in the file
+
+static quint64 alignUp(quint64 offset)
+{
+    return (offset + MESH_ALIGN - 1) & ~quint64(MESH_ALIGN - 1);
+}
+
+void buildMesh(const objectData &obj, QVector<meshSection> &sections)
+{
+    // The obj loader has vertices, texture coordinates, and normal coordinates in three separate arrays which are indexed independently,
+    // reflecting the format of an obj file.  For OpenGL VBO's, this has to be consolidated into packed vertex arrays.
+    sections.resize(obj.section.size());
+
+    for (int i = 0; i < obj.section.size(); i++)
+    {
+        const objectSection *s = &obj.section[i];
+        meshSection &out = sections[i];
+        out.mtl = s->mtl;
+        out.vertex.clear();
+        out.index.clear();
+
+        // Iterate through the facets and build the packed vertex array to match it.  Each distinct (v, vt, vn) combination
+        // becomes exactly one packed vertex; repeats re-use the existing vertex through the index buffer.
+        QHash<indexTriple, GLuint> packedIndex;
+        QVector<GLuint> poly;     // packed indices of the corners of the polygon currently being read
+        QVector<GLuint> rawIndex; // the same triangles without welding (one vertex per facet corner) for the report
+        int polyStart = 0;
+
+        for (int j = 0; j < s->f.size(); j++)
+        {
+            const indexTriple &t = s->f[j];
+            bool edge = t.edge; // true if this is the last vertex in a facet
+
+            QHash<indexTriple, GLuint>::const_iterator found = packedIndex.constFind(t);
+            if (found == packedIndex.constEnd())
+            {
+                // First time this combination has been seen.  obj indices are 1-based.
+                vertexData vd = {obj.v[t.v - 1], obj.vt[t.vt - 1], obj.vn[t.vn - 1]};
+                out.vertex << vd;
+                found = packedIndex.insert(t, out.vertex.size() - 1);
+            }
+            poly << found.value();
+
+            if (edge)
+            {
+                // End of a polygon.  obj polygons are convex, so split it into a fan of triangles around the first corner
+                for (int k = 1; k + 1 < poly.size(); k++)
+                {
+                    out.index << poly[0] << poly[k] << poly[k + 1];
+                    rawIndex << polyStart << polyStart + k << polyStart + k + 1;
+                }
+                poly.clear();
+                polyStart = j + 1;
+            }
+        }
+
+        // Order the triangles for the post-transform cache, then lay out the vertex buffer in the order it will be read
+        float weldedACMR = computeACMR(out.index);
+        optimizeVertexCache(out.index, out.vertex.size());
+        QVector<GLuint> remap = optimizeVertexFetch(out.index, out.vertex.size());
+        remapVertices(out.vertex, remap);
+
+        cout << "Mesh section " << s->mtl.name.toStdString() << ": "
+             << s->f.size() << " -> " << out.vertex.size() << " vertices, VBO "
+             << s->f.size() * sizeof(vertexData) << " -> " << out.vertex.size() * sizeof(vertexData) << " bytes, ACMR "
+             << computeACMR(rawIndex) << " -> " << weldedACMR << " (welded) -> " << computeACMR(out.index) << " (optimized)" << endl;
+    }
+}
+
+// Add a file's contents to the hash.  A missing file adds nothing, so it gets a different key from any real file.
+static QByteArray hashFile(QCryptographicHash &hash, const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+    QByteArray contents = file.readAll();
+    hash.addData(contents);
+    return contents;
+}
+
+quint64 meshSourceKey(const QString &objFileName)
+{
+    // Hash the contents of the obj and of the materials files it names (compiled-in resources have no modification
+    // time, and an edit can leave the size unchanged).  The textures aren't part of the mesh file, only their names.
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QByteArray obj = hashFile(hash, objFileName);
+    QString dir = QFileInfo(objFileName).path() + "/";
+    QList<QByteArray> lines = obj.split('\n');
+    for (int i = 0; i < lines.size(); i++)
+    {
+        QByteArray words = lines[i].simplified();
+        if (words.startsWith("mtllib "))
+            hashFile(hash, dir + QString::fromUtf8(words.mid(7)));
+    }
+
+    QByteArray digest = hash.result();
+    quint64 key = 0;
+    memcpy(&key, digest.constData(), sizeof(key));
+    return key ^ (quint64(MESH_FILE_VERSION) << 8) ^ quint64(VCACHE_SIZE);
+}
+
+bool writeMeshFile(const QString &fileName, quint64 sourceKey, const QVector<meshSection> &sections)
+{
+    // Lay out the file: header, section table, then each section's vertex and index arrays
+    QVector<meshFileSection> table(sections.size());
+    quint64 offset = sizeof(meshFileHeader) + sections.size() * sizeof(meshFileSection);
+    for (int i = 0; i < sections.size(); i++)
+    {
+        const meshSection &s = sections[i];
+        meshFileSection &t = table[i];
+        memset(&t, 0, sizeof(t));
+
+        QByteArray name = s.mtl.name.toUtf8();
+        QByteArray texture = s.mtl.map_d_filename.toUtf8();
+        if (name.size() >= MESH_NAME_LEN || texture.size() >= MESH_TEXTURE_LEN)
+        {
+            cerr << "Material or texture name too long for mesh file: " << name.constData() << endl;
+            return false;
+        }
+        strncpy(t.name, name.constData(), MESH_NAME_LEN - 1);
+        strncpy(t.texture, texture.constData(), MESH_TEXTURE_LEN - 1);
+
+        t.Ns = s.mtl.Ns;
+        t.d = s.mtl.d;
+        for (int c = 0; c < 4; c++)
+        {
+            t.Ka[c] = s.mtl.Ka[c];
+            t.Kd[c] = s.mtl.Kd[c];
+            t.Ks[c] = s.mtl.Ks[c];
+        }
+
+        t.vertexCount = s.vertex.size();
+        t.indexCount = s.index.size();
+        t.vertexOffset = offset = alignUp(offset);
+        offset += s.vertex.size() * sizeof(vertexData);
+        t.indexOffset = offset = alignUp(offset);
+        offset += s.index.size() * sizeof(GLuint);
+    }
+
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        cerr << "Can't write mesh file " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    meshFileHeader h = {MESH_FILE_MAGIC, MESH_FILE_VERSION, sourceKey, qint32(sections.size()), 0};
+    out.write((const char *)&h, sizeof(h));
+    out.write((const char *)table.constData(), table.size() * sizeof(meshFileSection));
+
+    // Zero padding up to each aligned array
+    static const char zeros[MESH_ALIGN] = {0};
+    for (int i = 0; i < sections.size(); i++)
+    {
+        out.write(zeros, table[i].vertexOffset - out.pos());
+        out.write((const char *)sections[i].vertex.constData(), sections[i].vertex.size() * sizeof(vertexData));
+        out.write(zeros, table[i].indexOffset - out.pos());
+        out.write((const char *)sections[i].index.constData(), sections[i].index.size() * sizeof(GLuint));
+    }
+    return out.commit();
+}
+
+meshFile::meshFile() : base(0), header(0)
+{
+}
+
+meshFile::~meshFile()
+{
+    close();
+}
+
+bool meshFile::open(const QString &fileName, quint64 sourceKey)
+{
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    quint64 size = file.size();
+    const uchar *p = size >= sizeof(meshFileHeader) ? file.map(0, size) : 0;
+    const meshFileHeader *h = (const meshFileHeader *)p;
+    bool ok = h && h->magic == MESH_FILE_MAGIC && h->version == MESH_FILE_VERSION && h->sourceKey == sourceKey &&
+              h->sectionCount >= 0 && sizeof(meshFileHeader) + h->sectionCount * sizeof(meshFileSection) <= size;
+
+    // Make sure every array lies inside the file before handing out pointers into it
+    for (int i = 0; ok && i < h->sectionCount; i++)
+    {
+        const meshFileSection &s = ((const meshFileSection *)(h + 1))[i];
+        ok = s.vertexCount >= 0 && s.indexCount >= 0 &&
+             s.vertexOffset % MESH_ALIGN == 0 && s.indexOffset % MESH_ALIGN == 0 &&
+             s.vertexOffset + s.vertexCount * sizeof(vertexData) <= size &&
+             s.indexOffset + s.indexCount * sizeof(GLuint) <= size &&
+             s.name[MESH_NAME_LEN - 1] == 0 && s.texture[MESH_TEXTURE_LEN - 1] == 0;
+    }
+
+    if (!ok)
+    {
+        cerr << "Ignoring stale mesh file " << fileName.toStdString() << endl;
+        file.close(); // also unmaps
+        return false;
+    }
+
+    base = p;
+    header = h;
+    return true;
+}
+
+void meshFile::close(void)
+{
+    base = 0;
+    header = 0;
+    file.close();
+}
+
+materialData meshFile::material(int i) const
+{
+    const meshFileSection &s = section(i);
+    materialData mtl(QString::fromUtf8(s.name));
+    mtl.Ns = s.Ns;
+    mtl.d = s.d;
+    mtl.Ka = QVector4D(s.Ka[0], s.Ka[1], s.Ka[2], s.Ka[3]);
+    mtl.Kd = QVector4D(s.Kd[0], s.Kd[1], s.Kd[2], s.Kd[3]);
+    mtl.Ks = QVector4D(s.Ks[0], s.Ks[1], s.Ks[2], s.Ks[3]);
+    mtl.map_d_filename = QString::fromUtf8(s.texture);
+    return mtl;
+}
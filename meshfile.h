@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** Binary, GPU-ready mesh files.  A mesh file holds what the renderer needs
+** from an obj model and nothing else: for each section the material, the
+** texture file name, an interleaved vertexData array and a triangle list
+** index array, all laid out so they can be uploaded straight from a memory
+** map.  Files are written by the objconvert tool, or by the application the
+** first time it has to parse an obj itself.
+**
+****************************************************************************/
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include "vertexdata.h"
+#include "wavefrontObj.h"
+
+#define MESH_FILE_MAGIC 0x4853454d // "MESH"
+#define MESH_FILE_VERSION 1
+#define MESH_NAME_LEN 64     // room for a material name, including the terminating zero
+#define MESH_TEXTURE_LEN 192 // room for a texture file name, including the terminating zero
+
+// A section of a mesh ready for upload: one material, one texture, one draw call
+struct meshSection
+{
+    materialData mtl;        // mtl.map_d_filename is relative to the directory of the obj file
+    QVector<vertexData> vertex;
+    QVector<GLuint> index;   // triangle list
+};
+
+// Layout of the start of a mesh file.  The header is followed by sectionCount meshFileSection records, then the
+// vertex and index arrays at the offsets given in those records.
+struct meshFileHeader
+{
+    quint32 magic, version;
+    quint64 sourceKey; // meshSourceKey() of the obj the mesh was made from
+    qint32 sectionCount;
+    quint32 pad;
+};
+
+struct meshFileSection
+{
+    char name[MESH_NAME_LEN];
+    char texture[MESH_TEXTURE_LEN];
+    float Ns, d;
+    float Ka[4], Kd[4], Ks[4];
+    qint32 vertexCount, indexCount;
+    quint64 vertexOffset, indexOffset; // byte offsets from the start of the file
+};
+
+// Turn a parsed obj model into GPU-ready sections.  Each distinct (v, vt, vn) combination becomes one packed vertex,
+// polygons are split into triangles, and the triangles and vertices are reordered for the vertex caches.
+void buildMesh(const objectData &obj, QVector<meshSection> &sections);
+
+// A key that changes whenever the obj file or its materials files, the file format, or the mesh optimization settings change
+quint64 meshSourceKey(const QString &objFileName);
+
+bool writeMeshFile(const QString &fileName, quint64 sourceKey, const QVector<meshSection> &sections);
+
+// A mesh file mapped into memory.  The vertex and index pointers stay valid until close().
+class meshFile
+{
+public:
+    meshFile();
+    ~meshFile();
+
+    bool open(const QString &fileName, quint64 sourceKey); // false if missing, stale, or malformed
+    void close(void);
+
+    int sectionCount(void) const { return header ? header->sectionCount : 0; }
+    materialData material(int i) const;
+    const vertexData *vertices(int i) const { return (const vertexData *)(base + section(i).vertexOffset); }
+    int vertexCount(int i) const { return section(i).vertexCount; }
+    const GLuint *indices(int i) const { return (const GLuint *)(base + section(i).indexOffset); }
+    int indexCount(int i) const { return section(i).indexCount; }
+
+private:
+    const meshFileSection &section(int i) const { return ((const meshFileSection *)(header + 1))[i]; }
+
+    QFile file;
+    const uchar *base;
+    const meshFileHeader *header; // start of the mapped file, or null if not open
+};
+
+#endif // MESHFILE_H
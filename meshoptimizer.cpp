@@ -0,0 +1,207 @@
+/****************************************************************************
+**
+** Index buffer optimizations for triangle list meshes:
+**  - Post-transform vertex cache ordering (Tom Forsyth, "Linear-Speed Vertex
+**    Cache Optimisation", 2006)
+**    https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+**  - Pre-transform vertex fetch ordering
+**  - Average cache miss ratio (ACMR) measurement
+**
+****************************************************************************/
+
+#include "meshoptimizer.h"
+#include <math.h> // for pow()
+
+// Scoring constants from the Forsyth paper
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+// Per-vertex bookkeeping for the cache optimizer
+struct vcacheVertex
+{
+    int cachePos;        // position in the simulated LRU cache, or -1 if not in the cache
+    int remaining;       // number of triangles using this vertex that have not been emitted yet
+    int firstTri;        // offset of this vertex's triangle list in the adjacency array
+    float score;
+};
+
+// Score a vertex based on where it is in the cache and how many triangles still need it.  Vertices with only a few
+// triangles left are boosted so that they get finished off instead of leaving lone triangles behind.
+static float vertexScore(const vcacheVertex &vert)
+{
+    if (vert.remaining == 0)
+        return -1.0f; // No triangles need it any more
+
+    float score = 0.0f;
+    if (vert.cachePos >= 0)
+    {
+        if (vert.cachePos < 3)
+        {
+            // Used by the triangle that was just emitted.  Give it a fixed score so that the very next triangle doesn't
+            // simply re-use the same edge, which tends to produce long thin strips.
+            score = LAST_TRI_SCORE;
+        }
+        else
+        {
+            float scaler = 1.0f / (VCACHE_SIZE - 3);
+            score = pow(1.0f - (vert.cachePos - 3) * scaler, CACHE_DECAY_POWER);
+        }
+    }
+
+    return score + VALENCE_BOOST_SCALE * pow(float(vert.remaining), -VALENCE_BOOST_POWER);
+}
+
+void optimizeVertexCache(QVector<GLuint> &index, int vertexCount)
+{
+    int triCount = index.size() / 3;
+    if (triCount == 0)
+        return;
+
+    // Build the vertex to triangle adjacency, packed into a single array
+    QVector<vcacheVertex> vert(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+        vert[i] = {-1, 0, 0, 0.0f};
+    for (int i = 0; i < index.size(); i++)
+        vert[index[i]].remaining++;
+
+    int offset = 0;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        vert[i].firstTri = offset;
+        offset += vert[i].remaining;
+    }
+
+    QVector<int> adjacency(index.size());
+    QVector<int> fill(vertexCount, 0);
+    for (int t = 0; t < triCount; t++)
+        for (int k = 0; k < 3; k++)
+        {
+            GLuint v = index[t * 3 + k];
+            adjacency[vert[v].firstTri + fill[v]++] = t;
+        }
+
+    for (int i = 0; i < vertexCount; i++)
+        vert[i].score = vertexScore(vert[i]);
+
+    QVector<float> triScore(triCount);
+    QVector<bool> emitted(triCount, false);
+    for (int t = 0; t < triCount; t++)
+        triScore[t] = vert[index[t * 3]].score + vert[index[t * 3 + 1]].score + vert[index[t * 3 + 2]].score;
+
+    // The cache is kept as a small array in LRU order, with three extra slots for the vertices of the triangle being
+    // added before the oldest entries fall off the end
+    int cache[VCACHE_SIZE + 3];
+    int cacheUsed = 0;
+
+    QVector<GLuint> result;
+    result.reserve(index.size());
+
+    int bestTri = -1;
+    int scanPos = 0; // Position of the linear search for a fresh starting triangle
+    for (int n = 0; n < triCount; n++)
+    {
+        if (bestTri < 0)
+        {
+            // Nothing in the cache is useful (first triangle, or the last island was finished).  Scores of triangles
+            // with no cached vertices only depend on valence, so rather than a full search just take the next unused one.
+            while (emitted[scanPos])
+                scanPos++;
+            bestTri = scanPos;
+        }
+
+        // Emit the triangle
+        emitted[bestTri] = true;
+        GLuint tv[3] = {index[bestTri * 3], index[bestTri * 3 + 1], index[bestTri * 3 + 2]};
+        for (int k = 0; k < 3; k++)
+        {
+            result << tv[k];
+
+            // Remove the triangle from this vertex's list of outstanding triangles
+            vcacheVertex &v = vert[tv[k]];
+            int *list = &adjacency[v.firstTri];
+            for (int j = 0; j < v.remaining; j++)
+                if (list[j] == bestTri)
+                {
+                    list[j] = list[v.remaining - 1];
+                    break;
+                }
+            v.remaining--;
+        }
+
+        // Move the triangle's vertices to the front of the cache, keeping everything else in LRU order
+        int newCache[VCACHE_SIZE + 3];
+        int newUsed = 0;
+        for (int k = 0; k < 3; k++)
+            newCache[newUsed++] = tv[k];
+        for (int c = 0; c < cacheUsed; c++)
+            if (cache[c] != int(tv[0]) && cache[c] != int(tv[1]) && cache[c] != int(tv[2]))
+                newCache[newUsed++] = cache[c];
+
+        // Update cache positions.  Vertices pushed off the end go back to being uncached.
+        for (int c = 0; c < newUsed; c++)
+        {
+            vert[newCache[c]].cachePos = (c < VCACHE_SIZE) ? c : -1;
+            vert[newCache[c]].score = vertexScore(vert[newCache[c]]);
+        }
+        cacheUsed = (newUsed < VCACHE_SIZE) ? newUsed : VCACHE_SIZE;
+        for (int c = 0; c < cacheUsed; c++)
+            cache[c] = newCache[c];
+
+        // Re-score the triangles touching the cached vertices and pick the best one to emit next
+        bestTri = -1;
+        float bestScore = -1.0f;
+        for (int c = 0; c < cacheUsed; c++)
+        {
+            const vcacheVertex &v = vert[cache[c]];
+            for (int j = 0; j < v.remaining; j++)
+            {
+                int t = adjacency[v.firstTri + j];
+                triScore[t] = vert[index[t * 3]].score + vert[index[t * 3 + 1]].score + vert[index[t * 3 + 2]].score;
+                if (triScore[t] > bestScore)
+                {
+                    bestScore = triScore[t];
+                    bestTri = t;
+                }
+            }
+        }
+    }
+
+    index.swap(result);
+}
+
+QVector<GLuint> optimizeVertexFetch(QVector<GLuint> &index, int vertexCount)
+{
+    QVector<GLuint> remap(vertexCount, GLuint(-1));
+    GLuint next = 0;
+    for (int i = 0; i < index.size(); i++)
+    {
+        GLuint &v = index[i];
+        if (remap[v] == GLuint(-1))
+            remap[v] = next++;
+        v = remap[v];
+    }
+    return remap;
+}
+
+float computeACMR(const QVector<GLuint> &index, int cacheSize)
+{
+    if (index.size() < 3)
+        return 0.0f;
+
+    // Simulate a FIFO cache, which is how GPU post-transform caches behave in practice
+    QVector<GLuint> fifo(cacheSize, GLuint(-1));
+    int head = 0;
+    int misses = 0;
+    for (int i = 0; i < index.size(); i++)
+    {
+        if (!fifo.contains(index[i]))
+        {
+            fifo[head] = index[i];
+            head = (head + 1) % cacheSize;
+            misses++;
+        }
+    }
+    return float(misses) / float(index.size() / 3);
+}
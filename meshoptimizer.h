@@ -0,0 +1,49 @@
+/****************************************************************************
+**
+** Index buffer optimizations for triangle list meshes:
+**  - Post-transform vertex cache ordering (Tom Forsyth, "Linear-Speed Vertex
+**    Cache Optimisation", 2006)
+**    https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+**  - Pre-transform vertex fetch ordering
+**  - Average cache miss ratio (ACMR) measurement
+**
+****************************************************************************/
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <QOpenGLFunctions>
+#include <QVector>
+
+#define VCACHE_SIZE 32 // Size of the simulated post-transform vertex cache (modern GPUs are somewhere around 16 to 32)
+
+// Reorder the triangles of an indexed triangle list so that vertices are re-used while they are still in the
+// post-transform cache.  Only the order of the triangles changes; the vertices are untouched.
+void optimizeVertexCache(QVector<GLuint> &index, int vertexCount);
+
+// Renumber vertices in the order they are first referenced by the index buffer, so that the GPU reads the vertex
+// buffer front to back.  The index buffer is rewritten in place; the returned table maps old vertex number to new
+// vertex number and should be passed to remapVertices() to reorder the vertex buffer to match.
+QVector<GLuint> optimizeVertexFetch(QVector<GLuint> &index, int vertexCount);
+
+// Reorder a vertex array using a table from optimizeVertexFetch().  Vertices that are never referenced are dropped.
+template <class T>
+void remapVertices(QVector<T> &vertex, const QVector<GLuint> &remap)
+{
+    int used = 0;
+    for (int i = 0; i < remap.size(); i++)
+        if (remap[i] != GLuint(-1))
+            used++;
+
+    QVector<T> reordered(used);
+    for (int i = 0; i < remap.size(); i++)
+        if (remap[i] != GLuint(-1))
+            reordered[remap[i]] = vertex[i];
+    vertex.swap(reordered);
+}
+
+// Average cache miss ratio: the number of vertex shader runs per triangle with a FIFO cache of the given size.
+// 3.0 means no re-use at all; 0.5 is the theoretical best for a large regular grid.
+float computeACMR(const QVector<GLuint> &index, int cacheSize = VCACHE_SIZE);
+
+#endif // MESHOPTIMIZER_H
@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Mesh simplification by vertex clustering.  See meshsimplify.h.
+**
+****************************************************************************/
+
+#include "meshsimplify.h"
+#include "meshoptimizer.h"
+
+#include <QHash>
+#include <QSet>
+#include <QVector4D>
+#include <QtGlobal>
+#include <algorithm> // for std::sort()
+
+void simplifyMesh(QVector<meshSection> &sections, const QVector3D &boxMin, const QVector3D &boxMax, int cells)
+{
+    QVector3D extent = boxMax - boxMin;
+    cells = qBound(1, cells, SIMPLIFY_MAX_CELLS);
+    float size = qMax(extent.x(), qMax(extent.y(), extent.z())) / cells;
+    if (size <= 0.0f)
+        return;
+    int nx = qMin(int(extent.x() / size) + 1, cells);
+    int ny = qMin(int(extent.y() / size) + 1, cells);
+    int nz = qMin(int(extent.z() / size) + 1, cells);
+    auto cellOf = [&](const QVector3D &p) {
+        int x = qBound(0, int((p.x() - boxMin.x()) / size), nx - 1);
+        int y = qBound(0, int((p.y() - boxMin.y()) / size), ny - 1);
+        int z = qBound(0, int((p.z() - boxMin.z()) / size), nz - 1);
+        return (z * ny + y) * nx + x;
+    };
+
+    // Sum the positions in each cell over every section, so that the trunk and the branches move the same way
+    QHash<int, QVector4D> sum; // xyz = total position, w = number of vertices
+    for (int s = 0; s < sections.size(); s++)
+        for (int v = 0; v < sections[s].vertex.size(); v++)
+        {
+            const QVector3D &p = sections[s].vertex[v].position;
+            sum[cellOf(p)] += QVector4D(p, 1.0f);
+        }
+
+    for (int s = 0; s < sections.size(); s++)
+    {
+        QVector<vertexData> &vertex = sections[s].vertex;
+        QVector<GLuint> &index = sections[s].index;
+
+        // Move every vertex to the middle of its cell's vertices
+        QVector<int> cell(vertex.size());
+        for (int v = 0; v < vertex.size(); v++)
+        {
+            cell[v] = cellOf(vertex[v].position);
+            QVector4D c = sum[cell[v]];
+            vertex[v].position = c.toVector3D() / c.w();
+        }
+
+        // Keep the triangles whose corners ended up in three different cells, and only one of those that ended up in
+        // the same three
+        QSet<quint64> seen;
+        QVector<GLuint> kept;
+        for (int t = 0; t + 2 < index.size(); t += 3)
+        {
+            quint64 c[3] = {quint64(cell[index[t]]), quint64(cell[index[t + 1]]), quint64(cell[index[t + 2]])};
+            if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+                continue;
+            std::sort(c, c + 3);
+            quint64 key = c[0] << 42 | c[1] << 21 | c[2];
+            if (seen.contains(key))
+                continue;
+            seen.insert(key);
+            kept << index[t] << index[t + 1] << index[t + 2];
+        }
+        index.swap(kept);
+
+        // The surviving triangles are scattered through the old order
+        optimizeVertexCache(index, vertex.size());
+        QVector<GLuint> remap = optimizeVertexFetch(index, vertex.size());
+        remapVertices(vertex, remap);
+    }
+}
+
+int countTriangles(const QVector<meshSection> &sections)
+{
+    int triangles = 0;
+    for (int s = 0; s < sections.size(); s++)
+        triangles += sections[s].index.size() / 3;
+    return triangles;
+}
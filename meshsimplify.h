@@ -0,0 +1,31 @@
+/****************************************************************************
+**
+** Mesh simplification by vertex clustering (Rossignac and Borrel,
+** "Multi-resolution 3D Approximations for Rendering Complex Scenes", 1993).
+** The model's bounding box is divided into a grid of cubic cells, every
+** vertex is moved to the average position of the vertices in its cell, and
+** the triangles that collapse are dropped.  It makes no attempt to keep
+** the shape as well as an edge collapse simplifier would, but it is fast,
+** it needs no connectivity, and it copes with the tree's open, card-like
+** branches, which simply vanish once they are smaller than a cell.
+**
+****************************************************************************/
+
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <QVector3D>
+#include <QVector>
+#include "meshfile.h"
+
+#define SIMPLIFY_MAX_CELLS 128 // most cells along any side of the grid, so that a cell number fits in 21 bits
+
+// Simplify every section of a model together, so that the sections stay joined where they meet.  cells is the number
+// of cells along the longest side of the box.  Each vertex keeps its own texture coordinate and normal; only its
+// position moves.  The sections are re-optimized for the vertex caches afterwards, and unused vertices are dropped.
+void simplifyMesh(QVector<meshSection> &sections, const QVector3D &boxMin, const QVector3D &boxMax, int cells);
+
+// Number of triangles in all of the sections
+int countTriangles(const QVector<meshSection> &sections);
+
+#endif // MESHSIMPLIFY_H
@@ -0,0 +1,248 @@
+/****************************************************************************
+**
+** The original QTextStream / QString::split based obj and mtl parser, kept
+** as a baseline for the benchmark.  Only the class name differs from the
+** version the application used to ship.
+**
+****************************************************************************/
+
+#include "legacyobj.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+legacyObj::legacyObj(QString filename, QString dir) : dir(dir)
+{
+    loadObj(filename);
+}
+
+// Parse an obj file into memory
+bool legacyObj::loadObj(QString filename)
+{
+    QString fn(dir + filename);
+    QFile infile(fn);
+    if (infile.open(QFile::ReadOnly | QFile::Text))
+    {
+        QTextStream in(&infile);
+        QString line;
+        while (in.readLineInto(&line))
+        {
+            if (line.isEmpty())
+                continue; // skip blank lines else token[0] will segfault
+
+            QStringList token = line.split(' ', QString::SkipEmptyParts);
+            QString cmd = token[0]; // The first token on a line is the command
+            if (cmd == "o")
+            {
+                // Object name.  Everything after the command is the name
+                data.name = line.right(line.size() - cmd.size()).trimmed();
+            }
+            else if (cmd == "v")
+            {
+                // Vertex coordinates (spec says can be 3 or 4, but we will assume only 3)
+                data.v << QVector3D(token[1].toFloat(), token[2].toFloat(), token[3].toFloat());
+            }
+            else if (cmd == "vn")
+            {
+                // Normal coordinates (always 3)
+                data.vn << QVector3D(token[1].toFloat(), token[2].toFloat(), token[3].toFloat());
+            }
+            else if (cmd == "vt")
+            {
+                // Texture coordinates (always 2)
+                data.vt << QVector2D(token[1].toFloat(), token[2].toFloat());
+            }
+            else if (cmd == "f")
+            {
+                // Facets.  Just stuff vertex #'s into data structures here.  They will be consolidated and converted
+                // to OpenGL VBO's external to this class
+
+                // Make sure there is a section available to add facets to
+                if (data.section.isEmpty())
+                    data.section.resize(1);
+
+                int n = token.size() - 1;
+                for (int i = 1; i <= n; i++)
+                {
+                    QStringList indices = token[i].split('/', QString::KeepEmptyParts);
+                    if (indices.size() == 3)
+                    {
+                        // v//vn format will automagically be handled correctly because split() with KeepEmptyParts
+                        // option will return empty string in position 1, and that empty string will parse to zero
+                        indexTriple t(indices[0].toUInt(), indices[1].toUInt(), indices[2].toUInt(), i == n);
+                        data.section.last().f << t;
+                    }
+                    else if (indices.size() == 1)
+                    {
+                        indexTriple t(indices[0].toUInt(), 0, 0, i == n);
+                        data.section.last().f << t;
+                    }
+                    else
+                    {
+                        cerr << "Invalid facet " << token[i].toStdString() << endl;
+                        return false;
+                    }
+                }
+            }
+            else if (cmd == "usemtl")
+            {
+                // Switch the material.
+                setMaterial(token[1]);
+            }
+            else if (cmd == "mtllib")
+            {
+                // Load a materials file
+                loadMaterialFile(token[1]);
+            }
+            // add handing for more commands here.  For now, anything not handled above  will just be ignored
+        }
+    }
+    else
+    {
+        cerr << "Cannot open file " << filename.toStdString() << endl;
+        return false;
+    }
+    return true;
+}
+
+bool legacyObj::setMaterial(QString name)
+{
+    // Search materials for a matching name
+    for (int i = 0; i < material.size(); i++)
+    {
+        if (material[i].name == name)
+        {
+            // Match!  Start a new objectSection with this material
+            objectSection s;
+            s.mtl = material[i];
+            data.section << s;
+
+            return true;
+        }
+    }
+    cerr << "Unknown material " << name.toStdString() << endl;
+    return false;
+}
+
+// Parse a material definition (mtl) file into memory
+bool legacyObj::loadMaterialFile(QString filename)
+{
+    QString fn(dir + filename);
+    QFile infile(fn);
+    if (infile.open(QFile::ReadOnly | QFile::Text))
+    {
+        QTextStream in(&infile);
+        QString line;
+        while (in.readLineInto(&line))
+        {
+            if (line.isEmpty())
+            {
+                continue; // skip blank lines else token[0] will segfault
+            }
+
+            QStringList token = line.split(' ', QString::SkipEmptyParts);
+
+            QString cmd = token[0]; // First token on a line is the command
+            if (cmd == "newmtl")
+            {
+                // New Material - start a materialData struct
+                if (token.size() == 2)
+                {
+                    materialData md;
+                    md.name = token[1];
+
+                    material << md;
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed newmtl command" << endl;
+                }
+            }
+            else if (material.isEmpty())
+            {
+                // If no materials named yet, then skip this line
+            }
+            else if (cmd == "Ka")
+            {
+                // Three floats for the ambient color
+                if (token.size() == 4)
+                {
+                    material.last().Ka.setX(token[1].toFloat());
+                    material.last().Ka.setY(token[2].toFloat());
+                    material.last().Ka.setZ(token[3].toFloat());
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ka command" << endl;
+                }
+            }
+            else if (cmd == "Kd")
+            {
+                // Three floats for the ambient color
+                if (token.size() == 4)
+                {
+                    material.last().Kd.setX(token[1].toFloat());
+                    material.last().Kd.setY(token[2].toFloat());
+                    material.last().Kd.setZ(token[3].toFloat());
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Kd command" << endl;
+                }
+            }
+            else if (cmd == "Ks")
+            {
+                // Three floats for the ambient color
+                if (token.size() == 4)
+                {
+                    material.last().Ks.setX(token[1].toFloat());
+                    material.last().Ks.setY(token[2].toFloat());
+                    material.last().Ks.setZ(token[3].toFloat());
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ks command" << endl;
+                }
+            }
+            else if (cmd == "Ns")
+            {
+                // One float for the Material shininess
+                if (token.size() == 2)
+                {
+                    material.last().Ns = token[1].toFloat();
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ns command" << endl;
+                }
+            }
+            else if (cmd == "d")
+            {
+                // One float for the dissolve factor
+                if (token.size() == 2)
+                {
+                    material.last().d = token[1].toFloat();
+                }
+                else
+                {
+                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed d command" << endl;
+                }
+            }
+            else if (cmd == "map_Kd")
+            {
+                // Texture.  Everything after the command is the filename
+                material.last().map_d_filename = line.right(line.size() - token[0].size()).trimmed();
+            }
+        }
+    }
+    else
+    {
+        cerr << "Cannot open materials file " << filename.toStdString() << endl
+             << endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,29 @@
+/****************************************************************************
+**
+** The original QTextStream / QString::split based obj and mtl parser, kept
+** as a baseline for the benchmark.
+**
+****************************************************************************/
+
+#ifndef LEGACYOBJ_H
+#define LEGACYOBJ_H
+
+#include "wavefrontObj.h"
+
+class legacyObj
+{
+public:
+    objectData data;
+
+    legacyObj(QString filename, QString dir);
+    bool loadObj(QString filename);
+
+private:
+    QString dir;
+    QVector<materialData> material;
+
+    bool setMaterial(QString name);
+    bool loadMaterialFile(QString filename);
+};
+
+#endif // LEGACYOBJ_H
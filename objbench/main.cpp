@@ -0,0 +1,146 @@
+/****************************************************************************
+**
+** objbench - compares the obj parser in wavefrontObj against the original
+** QTextStream / QString::split parser (legacyobj.cpp).
+**
+**   objbench [obj directory] [synthetic face count]
+**
+** Parses Spruce.obj from the obj directory (default ../obj/), then a
+** synthetic model with the given number of triangles (default 2000000)
+** written to the temp directory.  Each file is parsed a few times by each
+** parser; the best time is reported, and the two results are checked to
+** be the same.
+**
+****************************************************************************/
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include "wavefrontObj.h"
+#include "legacyobj.h"
+#include <math.h>
+#include <stdio.h>
+
+#include <iostream>
+using namespace std;
+
+#define BENCH_RUNS 3 // times each parser reads each file; the fastest run counts
+
+// Write a grid-shaped model with (at least) the given number of triangles, with positions, texture coordinates and
+// normals for every vertex, split into two materials
+static void writeSynthetic(const QString &dir, int faces)
+{
+    int n = int(sqrt(faces / 2.0)) + 1; // quads per side
+
+    FILE *mtl = fopen(QString(dir + "synthetic.mtl").toUtf8().constData(), "w");
+    fprintf(mtl, "newmtl Bark\nNs 32.0\nKa 0.2 0.2 0.2\nKd 0.6 0.4 0.2\nKs 0.1 0.1 0.1\nd 1.0\nmap_Kd bark.png\n\n");
+    fprintf(mtl, "newmtl Leaf\nNs 64.0\nKa 0.2 0.2 0.2\nKd 0.2 0.8 0.2\nKs 0.1 0.1 0.1\nd 1.0\nmap_Kd leaf.png\n");
+    fclose(mtl);
+
+    FILE *obj = fopen(QString(dir + "synthetic.obj").toUtf8().constData(), "w");
+    fprintf(obj, "# synthetic benchmark model\nmtllib synthetic.mtl\no Synthetic\n");
+    for (int z = 0; z <= n; z++)
+        for (int x = 0; x <= n; x++)
+        {
+            float fx = x / float(n), fz = z / float(n);
+            fprintf(obj, "v %f %f %f\n", fx * 10.0f - 5.0f, sinf(fx * 20.0f) * cosf(fz * 17.0f), fz * 10.0f - 5.0f);
+            fprintf(obj, "vt %f %f\n", fx, fz);
+            fprintf(obj, "vn %f %f %f\n", -0.1f * fx, 0.99f, 0.1f * fz);
+        }
+
+    for (int z = 0; z < n; z++)
+    {
+        if (z == 0 || z == n / 2)
+            fprintf(obj, "usemtl %s\n", z ? "Leaf" : "Bark");
+        for (int x = 0; x < n; x++)
+        {
+            int a = z * (n + 1) + x + 1, b = a + 1, c = a + n + 1, d = c + 1;
+            fprintf(obj, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+            fprintf(obj, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+        }
+    }
+    fclose(obj);
+}
+
+// Largest difference between the two parsers' results, or -1 if they don't have the same shape
+static float compare(const objectData &a, const objectData &b)
+{
+    if (a.v.size() != b.v.size() || a.vt.size() != b.vt.size() || a.vn.size() != b.vn.size() ||
+        a.section.size() != b.section.size() || a.name != b.name)
+        return -1.0f;
+
+    float diff = 0.0f;
+    for (int i = 0; i < a.v.size(); i++)
+        diff = qMax(diff, (a.v[i] - b.v[i]).length());
+    for (int i = 0; i < a.vt.size(); i++)
+        diff = qMax(diff, (a.vt[i] - b.vt[i]).length());
+    for (int i = 0; i < a.vn.size(); i++)
+        diff = qMax(diff, (a.vn[i] - b.vn[i]).length());
+
+    for (int i = 0; i < a.section.size(); i++)
+    {
+        const objectSection &sa = a.section[i], &sb = b.section[i];
+        if (sa.f.size() != sb.f.size() || sa.mtl.name != sb.mtl.name || sa.mtl.map_d_filename != sb.mtl.map_d_filename ||
+            sa.mtl.Kd != sb.mtl.Kd || sa.mtl.Ns != sb.mtl.Ns)
+            return -1.0f;
+        for (int j = 0; j < sa.f.size(); j++)
+            if (!(sa.f[j] == sb.f[j]) || sa.f[j].edge != sb.f[j].edge)
+                return -1.0f;
+    }
+    return diff;
+}
+
+static void bench(const QString &dir, const QString &name)
+{
+    qint64 legacyBest = -1, newBest = -1;
+    objectData legacyData, newData;
+    QElapsedTimer timer;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        timer.start();
+        legacyObj legacy(name, dir);
+        qint64 t = timer.nsecsElapsed();
+        legacyBest = legacyBest < 0 ? t : qMin(legacyBest, t);
+        legacyData = legacy.data;
+
+        timer.start();
+        wavefrontObj current(name, dir);
+        t = timer.nsecsElapsed();
+        newBest = newBest < 0 ? t : qMin(newBest, t);
+        newData = current.data;
+    }
+
+    int corners = 0;
+    for (int i = 0; i < newData.section.size(); i++)
+        corners += newData.section[i].f.size();
+
+    float diff = compare(legacyData, newData);
+    cout << name.toStdString() << ": " << QFile(dir + name).size() << " bytes, " << newData.v.size() << " vertices, "
+         << corners << " facet corners" << endl
+         << "    legacy parser " << legacyBest / 1e6 << " ms, new parser " << newBest / 1e6 << " ms ("
+         << double(legacyBest) / newBest << "x)" << endl
+         << "    results " << (diff < 0.0f ? "DIFFER" : "match") << " (largest coordinate difference " << diff << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString objDir = args.size() > 1 ? args[1] : QString("../obj/");
+    int faces = args.size() > 2 ? args[2].toInt() : 2000000;
+    if (!objDir.endsWith("/"))
+        objDir += "/";
+
+    bench(objDir, "Spruce.obj");
+
+    QString tmp = QDir::tempPath() + "/";
+    cout << "Writing synthetic model with " << faces << " triangles to " << tmp.toStdString() << endl;
+    writeSynthetic(tmp, faces);
+    bench(tmp, "synthetic.obj");
+    QFile::remove(tmp + "synthetic.obj");
+    QFile::remove(tmp + "synthetic.mtl");
+    return 0;
+}
@@ -0,0 +1,17 @@
+QT       += core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = objbench
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    legacyobj.cpp \
+    ../wavefrontObj.cpp
+
+HEADERS += \
+    legacyobj.h \
+    ../wavefrontObj.h
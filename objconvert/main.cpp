@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** objconvert - offline converter from Wavefront obj/mtl files to the binary
+** mesh files that meadow maps straight into its vertex buffers.
+**
+**   objconvert <input.obj> [output.mesh]
+**
+** The output defaults to the input with a .mesh extension.  Run it as
+** 'objconvert obj/Spruce.obj' from the main folder and meadow will pick up
+** obj/Spruce.mesh next to the application instead of parsing the obj.
+**
+****************************************************************************/
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QStringList>
+#include "meshfile.h"
+
+#include <iostream>
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    if (args.size() < 2 || args.size() > 3)
+    {
+        cerr << "usage: objconvert <input.obj> [output.mesh]" << endl;
+        return 1;
+    }
+
+    QFileInfo in(args[1]);
+    QString out = args.size() == 3 ? args[2] : in.path() + "/" + in.completeBaseName() + ".mesh";
+    if (!in.exists())
+    {
+        cerr << "Cannot open file " << args[1].toStdString() << endl;
+        return 1;
+    }
+
+    // The obj's materials and textures are found relative to its own directory
+    wavefrontObj obj(in.fileName(), in.path() + "/");
+    if (obj.data.section.isEmpty())
+    {
+        cerr << "No facets in " << args[1].toStdString() << endl;
+        return 1;
+    }
+
+    QVector<meshSection> sections;
+    buildMesh(obj.data, sections);
+    if (!writeMeshFile(out, meshSourceKey(in.filePath()), sections))
+        return 1;
+
+    cout << "Wrote " << out.toStdString() << " (" << QFileInfo(out).size() << " bytes)" << endl;
+    return 0;
+}
@@ -0,0 +1,20 @@
+QT       += core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = objconvert
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    ../meshfile.cpp \
+    ../meshoptimizer.cpp \
+    ../wavefrontObj.cpp
+
+HEADERS += \
+    ../meshfile.h \
+    ../meshoptimizer.h \
+    ../vertexdata.h \
+    ../wavefrontObj.h
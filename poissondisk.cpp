@@ -0,0 +1,84 @@
+/****************************************************************************
+**
+** Poisson-disk sampling over a square region of the XZ plane, with the
+** spacing of the samples controlled by a density map.
+**
+** Based on: Robert Bridson, "Fast Poisson Disk Sampling in Arbitrary
+** Dimensions", SIGGRAPH 2007 sketches.
+**   https://www.cs.ubc.ca/~rbridson/docs/bridson-siggraph07-poissondisk.pdf
+**
+****************************************************************************/
+
+#include "poissondisk.h"
+#include "spatialgrid.h"
+#include <math.h> // for sqrt(), cos(), sin()
+
+int poissonDisk(float extent, float radius, const densityFunc &density, int maxAttempts, rngStream &rng,
+                QVector<QVector2D> &points)
+{
+    // Background grid for the spacing checks.  Cells the size of the minimum spacing keep each check to a few cells.
+    spatialGrid grid(extent, radius);
+    QVector<int> active; // Samples that may still have room around them
+    int attempts = 0;
+
+    points.resize(0);
+
+    // Spacing required at a point, or 0 if nothing can go there
+    auto spacingAt = [&](float x, float z) -> float {
+        float d = density(x, z);
+        if (d <= 0.0f)
+            return 0.0f;
+        return radius / sqrt(qMax(d, POISSON_DENSITY_MIN));
+    };
+
+    // Accept a candidate if it is in bounds, in an area that allows samples, and has enough room around it
+    auto tryPoint = [&](float x, float z) -> bool {
+        attempts++;
+        if (x < -extent || x > extent || z < -extent || z > extent)
+            return false;
+        float spacing = spacingAt(x, z);
+        if (spacing == 0.0f || grid.anyWithin(x, z, spacing))
+            return false;
+
+        grid.insert(points.size(), x, z);
+        active << points.size();
+        points << QVector2D(x, z);
+        return true;
+    };
+
+    while (attempts < maxAttempts)
+    {
+        if (active.isEmpty())
+        {
+            // Start a new patch somewhere at random.  This is how separate islands of valid ground get filled in; if
+            // none of the tries land anywhere with room, the region is considered full.
+            bool seeded = false;
+            for (int i = 0; i < POISSON_RESEED_TRIES && !seeded && attempts < maxAttempts; i++)
+                seeded = tryPoint(rng.uniform(extent * 2.0f) - extent, rng.uniform(extent * 2.0f) - extent);
+            if (!seeded)
+                break;
+            continue;
+        }
+
+        // Try candidates in the ring between one and two spacings around a random active sample
+        int a = rng.below(active.size());
+        QVector2D p = points[active[a]];
+        float spacing = spacingAt(p.x(), p.y());
+        bool found = false;
+        for (int k = 0; k < POISSON_CANDIDATES && !found && attempts < maxAttempts; k++)
+        {
+            float angle = rng.uniform(2.0f * M_PI);
+            float dist = spacing * (1.0f + rng.uniform(1.0f));
+            found = tryPoint(p.x() + dist * cos(angle), p.y() + dist * sin(angle));
+        }
+
+        if (!found)
+        {
+            // No room left around this sample.  Retire it (order doesn't matter, so swap in the last one).
+            active[a] = active.last();
+            active.removeLast();
+        }
+    }
+
+    return attempts;
+}
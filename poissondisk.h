@@ -0,0 +1,33 @@
+/****************************************************************************
+**
+** Poisson-disk sampling over a square region of the XZ plane, with the
+** spacing of the samples controlled by a density map.
+**
+** Based on: Robert Bridson, "Fast Poisson Disk Sampling in Arbitrary
+** Dimensions", SIGGRAPH 2007 sketches.
+**   https://www.cs.ubc.ca/~rbridson/docs/bridson-siggraph07-poissondisk.pdf
+**
+****************************************************************************/
+
+#ifndef POISSONDISK_H
+#define POISSONDISK_H
+
+#include <QVector>
+#include <QVector2D>
+#include <functional>
+#include "rng.h"
+
+#define POISSON_CANDIDATES 30    // Candidates tried around each sample before it is retired (Bridson's k)
+#define POISSON_RESEED_TRIES 500 // Random points tried to start a new patch when the current one fills up
+#define POISSON_DENSITY_MIN 0.1f // Lowest density honoured; spacing grows as 1/sqrt(density) down to this
+
+// Relative density in [0..1] at a point.  0 means nothing may be placed there.
+typedef std::function<float(float x, float z)> densityFunc;
+
+// Fill the region -extent..extent (in x and z) with points that are at least radius / sqrt(density) apart.  Stops
+// when the region is full or after maxAttempts candidate points, whichever comes first.  Returns the number of
+// candidate points that were tried.
+int poissonDisk(float extent, float radius, const densityFunc &density, int maxAttempts, rngStream &rng,
+                QVector<QVector2D> &points);
+
+#endif // POISSONDISK_H
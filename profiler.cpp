@@ -0,0 +1,267 @@
+/****************************************************************************
+**
+** Frame profiler.  See profiler.h.
+**
+****************************************************************************/
+
+#include "profiler.h"
+
+#include <QSaveFile>
+#include <QtGlobal>
+#include <QTextStream>
+#include <algorithm>
+#include <math.h>
+
+#include <iostream>
+using namespace std;
+
+frameProfiler::frameProfiler() : enabled(false), gpuTimers(true), frame(0), activeQuery(-1)
+{
+    clock.start();
+    addSection("frame");
+}
+
+frameProfiler::~frameProfiler()
+{
+    // The queries must already have been released with the context current; this only frees what's left
+    for (int s = 0; s < section.size(); s++)
+        for (int q = 0; q < PROFILE_LATENCY; q++)
+            delete section[s].query[q];
+}
+
+void frameProfiler::release(void)
+{
+    for (int s = 0; s < section.size(); s++)
+        for (int q = 0; q < PROFILE_LATENCY; q++)
+        {
+            if (section[s].query[q])
+                section[s].query[q]->destroy();
+            delete section[s].query[q];
+            section[s].query[q] = 0;
+            section[s].queryFrame[q] = -1;
+        }
+    activeQuery = -1;
+}
+
+int frameProfiler::addSection(const QString &name)
+{
+    sectionData d;
+    d.name = name;
+    d.cpu.fill(-1.0f, PROFILE_FRAMES);
+    d.gpu.fill(-1.0f, PROFILE_FRAMES);
+    d.cpuStart = 0;
+    d.cpuTotal = -1;
+    for (int q = 0; q < PROFILE_LATENCY; q++)
+    {
+        d.query[q] = 0;
+        d.queryFrame[q] = -1;
+    }
+    section << d;
+    return section.size() - 1;
+}
+
+// Read the timer queries that are old enough to have finished.  A result that still isn't ready is dropped rather than
+// waited for, since its query is about to be reused.
+void frameProfiler::collect(void)
+{
+    qint64 done = frame - PROFILE_LATENCY; // the newest frame whose results are due
+    if (done < 0)
+        return;
+
+    float total = 0.0f;
+    bool any = false, complete = true;
+    for (int s = 0; s < section.size(); s++)
+    {
+        sectionData &d = section[s];
+        for (int q = 0; q < PROFILE_LATENCY; q++)
+        {
+            if (d.queryFrame[q] < 0 || d.queryFrame[q] > done)
+                continue;
+            if (d.queryFrame[q] == done && d.query[q]->isResultAvailable())
+            {
+                float ms = d.query[q]->waitForResult() / 1.0e6f;
+                d.gpu[done % PROFILE_FRAMES] = ms;
+                total += ms;
+                any = true;
+            }
+            else if (d.queryFrame[q] == done)
+                complete = false;
+            d.queryFrame[q] = -1;
+        }
+    }
+    if (any && complete)
+        section[PROFILE_FRAME].gpu[done % PROFILE_FRAMES] = total;
+}
+
+void frameProfiler::beginFrame(void)
+{
+    if (!enabled)
+        return;
+    collect();
+
+    int slot = frame % PROFILE_FRAMES;
+    for (int s = 0; s < section.size(); s++)
+    {
+        section[s].cpu[slot] = section[s].gpu[slot] = -1.0f;
+        section[s].cpuTotal = -1;
+    }
+    beginCpu(PROFILE_FRAME);
+}
+
+void frameProfiler::endFrame(void)
+{
+    if (!enabled)
+        return;
+    endGpu();
+    endCpu(PROFILE_FRAME);
+
+    // Sections that weren't timed this frame keep -1, so they don't count as 0 in the statistics
+    int slot = frame % PROFILE_FRAMES;
+    for (int s = 0; s < section.size(); s++)
+        if (section[s].cpuTotal >= 0)
+            section[s].cpu[slot] = section[s].cpuTotal / 1.0e6f;
+    frame++;
+}
+
+void frameProfiler::beginCpu(int s)
+{
+    if (!enabled)
+        return;
+    sectionData &d = section[s];
+    d.cpuStart = clock.nsecsElapsed();
+    if (d.cpuTotal < 0)
+        d.cpuTotal = 0;
+}
+
+void frameProfiler::endCpu(int s)
+{
+    if (!enabled)
+        return;
+    sectionData &d = section[s];
+    d.cpuTotal += clock.nsecsElapsed() - d.cpuStart;
+}
+
+void frameProfiler::beginGpu(int s)
+{
+    if (!enabled || !gpuTimers || activeQuery >= 0)
+        return;
+    sectionData &d = section[s];
+    int q = frame % PROFILE_LATENCY;
+    if (d.queryFrame[q] == frame)
+        return; // already timed this frame
+
+    if (!d.query[q])
+    {
+        d.query[q] = new QOpenGLTimerQuery;
+        if (!d.query[q]->create())
+        {
+            cerr << "No GPU timer queries; the profiler will only show CPU times" << endl;
+            delete d.query[q];
+            d.query[q] = 0;
+            gpuTimers = false;
+            return;
+        }
+    }
+    d.query[q]->begin();
+    d.queryFrame[q] = frame;
+    activeQuery = s;
+}
+
+void frameProfiler::endGpu(void)
+{
+    if (activeQuery < 0)
+        return;
+    section[activeQuery].query[frame % PROFILE_LATENCY]->end();
+    activeQuery = -1;
+}
+
+profileStats frameProfiler::summarize(const QVector<float> &ring)
+{
+    QVector<float> v;
+    for (int i = 0; i < ring.size(); i++)
+        if (ring[i] >= 0.0f)
+            v << ring[i];
+
+    profileStats st = {0.0f, 0.0f, 0.0f, v.size()};
+    if (v.isEmpty())
+        return st;
+
+    std::sort(v.begin(), v.end());
+    float sum = 0.0f;
+    for (int i = 0; i < v.size(); i++)
+        sum += v[i];
+    st.min = v.first();
+    st.avg = sum / v.size();
+    st.p99 = v[qMin(v.size() - 1, int(ceil(v.size() * 0.99)) - 1)];
+    return st;
+}
+
+profileStats frameProfiler::cpuStats(int s) const
+{
+    return summarize(section[s].cpu);
+}
+
+profileStats frameProfiler::gpuStats(int s) const
+{
+    return summarize(section[s].gpu);
+}
+
+// "min / avg / p99" with fixed widths, so the columns line up in a monospaced font
+static QString figures(const profileStats &st)
+{
+    if (!st.samples)
+        return QString("%1").arg("-", 22);
+    return QString("%1 /%2 /%3").arg(st.min, 6, 'f', 2).arg(st.avg, 6, 'f', 2).arg(st.p99, 6, 'f', 2);
+}
+
+QStringList frameProfiler::report(void) const
+{
+    QStringList lines;
+    lines << QString("%1 %2   %3").arg("ms", -8).arg("CPU min /   avg /   p99", 22).arg("GPU min /   avg /   p99", 22);
+    for (int s = 0; s < section.size(); s++)
+        lines << QString("%1 %2   %3").arg(section[s].name, -8).arg(figures(cpuStats(s))).arg(figures(gpuStats(s)));
+    return lines;
+}
+
+bool frameProfiler::exportCsv(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        cerr << "Can't write profile to " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "frame";
+    for (int s = 0; s < section.size(); s++)
+        out << "," << section[s].name << "_cpu_ms," << section[s].name << "_gpu_ms";
+    out << "\n";
+
+    // Oldest frame first.  Missing times are left empty.
+    for (qint64 f = qMax(frame - PROFILE_FRAMES, qint64(0)); f < frame; f++)
+    {
+        int slot = f % PROFILE_FRAMES;
+        out << f;
+        for (int s = 0; s < section.size(); s++)
+        {
+            out << ",";
+            if (section[s].cpu[slot] >= 0.0f)
+                out << section[s].cpu[slot];
+            out << ",";
+            if (section[s].gpu[slot] >= 0.0f)
+                out << section[s].gpu[slot];
+        }
+        out << "\n";
+    }
+    out.flush();
+
+    if (!file.commit())
+    {
+        cerr << "Can't write profile to " << fileName.toStdString() << endl;
+        return false;
+    }
+    cout << "Profile of the last " << qMin(frame, qint64(PROFILE_FRAMES)) << " frames written to "
+         << fileName.toStdString() << endl;
+    return true;
+}
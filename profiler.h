@@ -0,0 +1,110 @@
+/****************************************************************************
+**
+** Frame profiler.  The frame is divided into named sections (culling and
+** each render pass).  Each section's CPU time is measured with scoped
+** timers, and its GPU time with a GL_TIME_ELAPSED timer query.  The GPU
+** can't answer a query until it has finished the frame, so there is a set
+** of queries per section for each of the last PROFILE_LATENCY frames, and
+** a result is only read once it's ready; the CPU never waits for the GPU.
+** The last PROFILE_FRAMES frames are kept for the min/avg/p99 statistics.
+**
+** Section 0 is the whole frame.  Its CPU time runs from beginFrame() to
+** endFrame(), and its GPU time is the sum of the other sections'.
+**
+****************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QElapsedTimer>
+#include <QOpenGLTimerQuery>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#define PROFILE_FRAMES 300 // frames the statistics cover
+#define PROFILE_LATENCY 2  // frames between issuing a timer query and reading it
+#define PROFILE_FRAME 0    // the section for the whole frame
+
+struct profileStats
+{
+    float min, avg, p99; // milliseconds
+    int samples;         // frames the figures come from; 0 if none
+};
+
+class frameProfiler
+{
+public:
+    frameProfiler();
+    ~frameProfiler();
+
+    // Nothing is measured until the profiler is enabled
+    void setEnabled(bool on) { enabled = on; }
+    bool isEnabled(void) const { return enabled; }
+
+    // Delete the timer queries.  Call with the GL context current before it goes away.
+    void release(void);
+
+    // Add a section and return its number.  Sections can be added at any time.
+    int addSection(const QString &name);
+    int sections(void) const { return section.size(); }
+    const QString &sectionName(int s) const { return section[s].name; }
+
+    // Bracket each frame.  beginFrame() also collects whatever timer query results have come in.  Call with the GL
+    // context current.
+    void beginFrame(void);
+    void endFrame(void);
+
+    // CPU time of a section.  A section can be timed any number of times in a frame; the times add up.
+    void beginCpu(int s);
+    void endCpu(int s);
+
+    // GPU time of a section.  GL can only time one thing at a time, so these can't be nested, and each section can only
+    // be timed once a frame; any other attempt is ignored.
+    void beginGpu(int s);
+    void endGpu(void);
+
+    profileStats cpuStats(int s) const;
+    profileStats gpuStats(int s) const;
+
+    // One line per section with its CPU and GPU min/avg/p99, under a heading line
+    QStringList report(void) const;
+
+    // Write every frame still in the window to a CSV file, one row per frame and two columns per section
+    bool exportCsv(const QString &fileName) const;
+
+private:
+    struct sectionData
+    {
+        QString name;
+        QVector<float> cpu, gpu;                      // ring of PROFILE_FRAMES times in ms, -1 for none
+        qint64 cpuStart;                              // when the running CPU timer started, in ns
+        qint64 cpuTotal;                              // ns this frame so far
+        QOpenGLTimerQuery *query[PROFILE_LATENCY];    // one per frame in flight; created when first needed
+        qint64 queryFrame[PROFILE_LATENCY];           // frame each query was issued in, or -1
+    };
+
+    void collect(void);
+    static profileStats summarize(const QVector<float> &ring);
+
+    bool enabled;
+    bool gpuTimers;   // false if the driver has no timer queries
+    QVector<sectionData> section;
+    QElapsedTimer clock;
+    qint64 frame;     // number of the current frame, which is also the number of frames finished
+    int activeQuery;  // section whose timer query is running, or -1
+};
+
+// Times the CPU work of a section from construction to the end of the scope
+class profileScope
+{
+public:
+    profileScope(frameProfiler &p, int s) : profiler(p), section(s) { profiler.beginCpu(section); }
+    ~profileScope() { profiler.endCpu(section); }
+
+private:
+    frameProfiler &profiler;
+    int section;
+};
+
+#endif // PROFILER_H
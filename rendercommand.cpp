@@ -0,0 +1,441 @@
+/****************************************************************************
+**
+** Render commands.  See rendercommand.h.
+**
+** The sort key packs the pass, then small per-object numbers, most
+** expensive state first: program, then texture, then mesh, then material,
+** then the order the commands were submitted in.  The numbers are handed out the first time
+** each object is seen, so the order is the same from frame to frame, and
+** whatever is submitted first (such as the skybox) is drawn first.
+**
+****************************************************************************/
+
+#include "rendercommand.h"
+#include "vertexdata.h"
+
+#include <algorithm>
+#include <stddef.h> // for offsetof()
+#include <string.h> // for memcpy()
+
+#include <iostream>
+using namespace std;
+
+#define KEY_PASS_SHIFT 60     // 4 bits
+#define KEY_PROGRAM_SHIFT 52  // 8 bits
+#define KEY_TEXTURE_SHIFT 44  // 8 bits
+#define KEY_MESH_SHIFT 32     // 12 bits
+#define KEY_MATERIAL_SHIFT 20 // 12 bits
+#define KEY_ORDER_MASK 0xFFFFF
+
+static_assert(RENDER_PASSES == 1 << (64 - KEY_PASS_SHIFT), "RENDER_PASSES must fill the pass bits of the sort key");
+
+static const passState defaultPassState = {GL_LESS, GL_TRUE, GL_TRUE};
+
+void bindAttributeLocations(QOpenGLShaderProgram *program)
+{
+    program->bindAttributeLocation("a_position", ATTRIB_POSITION);
+    program->bindAttributeLocation("a_texcoord", ATTRIB_TEXCOORD);
+    program->bindAttributeLocation("a_normal", ATTRIB_NORMAL);
+    program->bindAttributeLocation("a_instance", ATTRIB_INSTANCE);
+}
+
+void renderMesh::create(QOpenGLExtraFunctions *gl, QOpenGLBuffer &vertices, QOpenGLBuffer &indices, int layout,
+                        QOpenGLBuffer *instances)
+{
+    gl->glGenVertexArrays(1, &vao);
+    gl->glBindVertexArray(vao);
+
+    // The element buffer binding is part of the vertex array object
+    indices.bind();
+
+    // The quantized layouts use normalized integer and half float attributes, which the vertex fetch turns back into
+    // floats, so the shaders read them the same as the full precision ones
+    vertices.bind();
+    gl->glEnableVertexAttribArray(ATTRIB_POSITION);
+    switch (layout)
+    {
+    case LAYOUT_UNLIT:
+        gl->glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(unlitVertexData),
+                                  (const void *)offsetof(unlitVertexData, position));
+        gl->glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        gl->glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(unlitVertexData),
+                                  (const void *)offsetof(unlitVertexData, texCoord));
+        break;
+
+    case LAYOUT_LIT:
+        gl->glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(vertexData),
+                                  (const void *)offsetof(vertexData, position));
+        gl->glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        gl->glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(vertexData),
+                                  (const void *)offsetof(vertexData, texCoord));
+        gl->glEnableVertexAttribArray(ATTRIB_NORMAL);
+        gl->glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(vertexData),
+                                  (const void *)offsetof(vertexData, normal));
+        break;
+
+    case LAYOUT_TREE:
+        gl->glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(treeVertexData),
+                                  (const void *)offsetof(treeVertexData, position));
+        gl->glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        gl->glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(treeVertexData),
+                                  (const void *)offsetof(treeVertexData, texCoord));
+        gl->glEnableVertexAttribArray(ATTRIB_NORMAL);
+        gl->glVertexAttribPointer(ATTRIB_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(treeVertexData),
+                                  (const void *)offsetof(treeVertexData, normal));
+        break;
+
+    case LAYOUT_LAND:
+        gl->glVertexAttribPointer(ATTRIB_POSITION, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(landVertexData),
+                                  (const void *)offsetof(landVertexData, height));
+        gl->glEnableVertexAttribArray(ATTRIB_NORMAL);
+        gl->glVertexAttribPointer(ATTRIB_NORMAL, 2, GL_BYTE, GL_TRUE, sizeof(landVertexData),
+                                  (const void *)offsetof(landVertexData, normal));
+        break;
+
+    case LAYOUT_PATCH:
+        gl->glVertexAttribPointer(ATTRIB_POSITION, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(patchVertexData),
+                                  (const void *)offsetof(patchVertexData, x));
+        break;
+    }
+
+    // The divisor makes the instance attribute advance once per instance instead of once per vertex
+    if (instances)
+    {
+        instances->bind();
+        gl->glEnableVertexAttribArray(ATTRIB_INSTANCE);
+        gl->glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, sizeof(QVector4D), 0);
+        gl->glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+    }
+
+    gl->glBindVertexArray(0);
+}
+
+void renderMesh::destroy(QOpenGLExtraFunctions *gl)
+{
+    if (vao)
+        gl->glDeleteVertexArrays(1, &vao);
+    vao = 0;
+}
+
+renderQueue::renderQueue() : pass(0), profiler(0), frameBuffer(0), materialBuffer(0), materialsDirty(false),
+                             currentProgram(0), currentTexture(0), currentMesh(0)
+{
+    stats = {0, 0, 0, 0, 0};
+    for (int p = 0; p < RENDER_PASSES; p++)
+    {
+        passStates[p] = defaultPassState;
+        passSections[p] = -1;
+        passTextures[p] = 0;
+    }
+    currentState = defaultPassState;
+    currentState.depthFunc = 0;
+}
+
+void renderQueue::initialize(void)
+{
+    initializeOpenGLFunctions();
+
+    // The buffers stay bound to their binding points for good; every program's blocks are connected to the same points
+    glGenBuffers(1, &frameBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(frameBlock), 0, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameBuffer);
+
+    glGenBuffers(1, &materialBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, MATERIAL_CAPACITY * sizeof(materialBlock), 0, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BINDING, materialBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void renderQueue::release(void)
+{
+    glDeleteBuffers(1, &frameBuffer);
+    glDeleteBuffers(1, &materialBuffer);
+    frameBuffer = materialBuffer = 0;
+}
+
+void renderQueue::addProgram(QOpenGLShaderProgram *program)
+{
+    GLuint id = program->programId();
+    GLuint frame = glGetUniformBlockIndex(id, "frameData");
+    if (frame != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, frame, FRAME_BINDING);
+    GLuint material = glGetUniformBlockIndex(id, "materialData");
+    if (material != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, material, MATERIAL_BINDING);
+
+    programState state = {program->uniformLocation("materialIndex"), -1};
+    programs.insert(program, state);
+}
+
+int renderQueue::addMaterial(const renderMaterial &material)
+{
+    if (materials.size() >= MATERIAL_CAPACITY)
+    {
+        cerr << "Too many materials; raise MATERIAL_CAPACITY" << endl;
+        return -1;
+    }
+
+    materialBlock m;
+    memset(&m, 0, sizeof(m));
+    for (int c = 0; c < 4; c++)
+    {
+        m.Ka[c] = material.Ka[c];
+        m.Kd[c] = material.Kd[c];
+        m.Ks[c] = material.Ks[c];
+    }
+    m.Ns = material.Ns;
+    m.layer = material.layer;
+    m.lodNear = material.lodNear;
+    m.lodFar = material.lodFar;
+    materials << m;
+    materialsDirty = true;
+    return materials.size() - 1;
+}
+
+void renderQueue::beginFrame(void)
+{
+    currentState.depthFunc = 0;
+    currentProgram = 0;
+    currentTexture = 0;
+    currentMesh = 0;
+    stats = {0, 0, 0, 0, 0};
+
+    // Non-instanced meshes don't have an instance array, so they all read this: placed at the origin, not scaled
+    glVertexAttrib4f(ATTRIB_INSTANCE, 0.0f, 0.0f, 0.0f, 1.0f);
+    glActiveTexture(GL_TEXTURE0);
+    stats.glCalls += 2;
+}
+
+void renderQueue::setFrame(const QMatrix4x4 &projection, const QMatrix4x4 &view, const QVector3D &lightPosition)
+{
+    frameBlock f;
+    memcpy(f.mvp, (projection * view).constData(), sizeof(f.mvp));
+    memcpy(f.mv, view.constData(), sizeof(f.mv));
+    QMatrix3x3 normal = view.normalMatrix();
+    for (int col = 0; col < 3; col++)
+    {
+        for (int row = 0; row < 3; row++)
+            f.normal[col * 4 + row] = normal(row, col);
+        f.normal[col * 4 + 3] = 0.0f;
+    }
+    f.lightPosition[0] = lightPosition.x();
+    f.lightPosition[1] = lightPosition.y();
+    f.lightPosition[2] = lightPosition.z();
+    f.lightPosition[3] = 1.0f;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(f), &f);
+    stats.glCalls += 2;
+    stats.uniformBytes += sizeof(f);
+}
+
+// The number of triangles an indexed draw makes from count indices
+static int triangleCount(GLenum mode, GLsizei count)
+{
+    switch (mode)
+    {
+    case GL_TRIANGLES:
+        return count / 3;
+    case GL_TRIANGLE_STRIP: // degenerate triangles joining strips are counted too, as the GPU still sets them up
+    case GL_TRIANGLE_FAN:
+        return count > 2 ? count - 2 : 0;
+    default:
+        return 0;
+    }
+}
+
+int renderQueue::slot(QHash<const void *, int> &ids, const void *object)
+{
+    QHash<const void *, int>::const_iterator found = ids.constFind(object);
+    if (found != ids.constEnd())
+        return found.value();
+    int n = ids.size();
+    ids.insert(object, n);
+    return n;
+}
+
+void renderQueue::beginPass(int p)
+{
+    pass = p;
+}
+
+void renderQueue::setPassState(int p, const passState &state)
+{
+    passStates[p & (RENDER_PASSES - 1)] = state;
+}
+
+void renderQueue::setPassTexture(QOpenGLTexture *texture)
+{
+    passTextures[pass & (RENDER_PASSES - 1)] = texture;
+}
+
+void renderQueue::setPassSection(int p, int section)
+{
+    passSections[p & (RENDER_PASSES - 1)] = section;
+}
+
+// Change whichever parts of the depth and color state differ from what's in effect
+void renderQueue::applyPassState(const passState &state)
+{
+    bool known = currentState.depthFunc != 0;
+    if (!known || state.depthFunc != currentState.depthFunc)
+    {
+        glDepthFunc(state.depthFunc);
+        stats.glCalls++;
+    }
+    else
+        stats.stateSkips++;
+    if (!known || state.depthWrite != currentState.depthWrite)
+    {
+        glDepthMask(state.depthWrite);
+        stats.glCalls++;
+    }
+    else
+        stats.stateSkips++;
+    if (!known || state.colorWrite != currentState.colorWrite)
+    {
+        glColorMask(state.colorWrite, state.colorWrite, state.colorWrite, state.colorWrite);
+        stats.glCalls++;
+    }
+    else
+        stats.stateSkips++;
+    currentState = state;
+}
+
+void renderQueue::submit(const drawCommand &command)
+{
+    drawCommand c = command;
+    c.key = quint64(pass & (RENDER_PASSES - 1)) << KEY_PASS_SHIFT |
+            quint64(slot(programSlot, c.program) & 0xFF) << KEY_PROGRAM_SHIFT |
+            quint64(slot(textureSlot, c.texture) & 0xFF) << KEY_TEXTURE_SHIFT |
+            quint64(slot(meshSlot, c.mesh) & 0xFFF) << KEY_MESH_SHIFT |
+            quint64((c.material + 1) & 0xFFF) << KEY_MATERIAL_SHIFT |
+            quint64(commands.size() & KEY_ORDER_MASK);
+    commands << c;
+    stats.commands++;
+}
+
+// Point the program at a material, unless it's already using it.  The program must be current.
+void renderQueue::applyMaterial(QOpenGLShaderProgram *program, int material)
+{
+    programState &s = programs[program];
+    if (s.current == material)
+    {
+        stats.stateSkips++;
+        return;
+    }
+    glUniform1i(s.materialIndex, material);
+    s.current = material;
+    stats.glCalls++;
+    stats.uniformBytes += sizeof(GLint);
+}
+
+void renderQueue::flush(void)
+{
+    // Send the materials if any were added
+    if (materialsDirty)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, materials.size() * sizeof(materialBlock), materials.constData());
+        materialsDirty = false;
+        stats.glCalls += 2;
+        stats.uniformBytes += materials.size() * sizeof(materialBlock);
+    }
+
+    std::sort(commands.begin(), commands.end(),
+              [](const drawCommand &a, const drawCommand &b) { return a.key < b.key; });
+
+    int running = -1; // pass being drawn
+    for (int i = 0; i < commands.size(); i++)
+    {
+        const drawCommand &c = commands[i];
+
+        // Switch to each pass's state as it starts, and time it from its first draw to the first draw of the next
+        int p = int(c.key >> KEY_PASS_SHIFT);
+        if (p != running)
+        {
+            if (profiler && running >= 0 && passSections[running] >= 0)
+            {
+                profiler->endGpu();
+                profiler->endCpu(passSections[running]);
+            }
+            applyPassState(passStates[p]);
+            if (passTextures[p])
+            {
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(passTextures[p]->target(), passTextures[p]->textureId());
+                glActiveTexture(GL_TEXTURE0);
+                stats.glCalls += 3;
+            }
+            if (profiler && passSections[p] >= 0)
+            {
+                profiler->beginCpu(passSections[p]);
+                profiler->beginGpu(passSections[p]);
+            }
+            running = p;
+        }
+
+        if (c.program != currentProgram)
+        {
+            c.program->bind();
+            currentProgram = c.program;
+            stats.glCalls++;
+        }
+        else
+            stats.stateSkips++;
+
+        if (c.texture && c.texture != currentTexture)
+        {
+            glBindTexture(c.texture->target(), c.texture->textureId());
+            currentTexture = c.texture;
+            stats.glCalls++;
+        }
+        else if (c.texture)
+            stats.stateSkips++;
+
+        if (c.mesh != currentMesh)
+        {
+            glBindVertexArray(c.mesh->vao);
+            currentMesh = c.mesh;
+            stats.glCalls++;
+        }
+        else
+            stats.stateSkips++;
+
+        if (c.material >= 0)
+            applyMaterial(c.program, c.material);
+
+        const void *indices = (const void *)c.offset;
+        if (c.instances)
+            glDrawElementsInstanced(c.mode, c.count, c.type, indices, c.instances);
+        else if (c.baseVertex)
+            glDrawElementsBaseVertex(c.mode, c.count, c.type, indices, c.baseVertex);
+        else
+            glDrawElements(c.mode, c.count, c.type, indices);
+        stats.glCalls++;
+        stats.triangles += triangleCount(c.mode, c.count) * (c.instances ? c.instances : 1);
+    }
+    if (profiler && running >= 0 && passSections[running] >= 0)
+    {
+        profiler->endGpu();
+        profiler->endCpu(passSections[running]);
+    }
+
+    // Put the depth and color state back for whatever draws or clears next
+    if (running >= 0)
+        applyPassState(defaultPassState);
+
+    // Leave no vertex array bound, so that nothing outside the queue modifies one by accident
+    if (currentMesh)
+    {
+        glBindVertexArray(0);
+        currentMesh = 0;
+        stats.glCalls++;
+    }
+    commands.resize(0);
+    for (int p = 0; p < RENDER_PASSES; p++)
+        passTextures[p] = 0;
+    pass = 0;
+}
@@ -0,0 +1,216 @@
+/****************************************************************************
+**
+** Render commands.  Instead of setting up GL state and drawing directly,
+** the draw functions submit a command describing the draw: the program,
+** texture, mesh (a vertex array object), material, and index range.  At the
+** end of the frame the queue sorts the commands so that draws sharing state
+** are adjacent, then issues them, skipping every state change that is
+** already in effect.  It counts the GL calls it makes.
+**
+** Every program that draws through the queue must pin its vertex attributes
+** to the ATTRIB_ locations with bindAttributeLocations() before linking.
+** That lets a single vertex array object serve any program, and means the
+** attribute locations never have to be looked up.  After linking, it must
+** be registered with addProgram().
+**
+** Shader inputs live in two std140 uniform blocks.  frameData holds the
+** camera and light and is written once per frame.  materialData holds every
+** material and is written only when a material is added.  A draw just
+** selects its material by index, so the only uniform set per draw is that
+** index, and only when it changes.
+**
+** Draws are grouped into passes (sky, water, ...).  The passes are drawn in
+** the order of their numbers, each as one unbroken run of draws, so a
+** profiler attached to the queue can time each pass on the CPU and GPU.
+** Each pass can have its own depth test and write masks, for a depth
+** pre-pass and the passes that rely on it.
+**
+****************************************************************************/
+
+#ifndef RENDERCOMMAND_H
+#define RENDERCOMMAND_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <QMatrix4x4>
+#include <QVector4D>
+#include <QVector>
+#include <QHash>
+
+#include "profiler.h"
+
+// Fixed vertex attribute locations
+#define ATTRIB_POSITION 0
+#define ATTRIB_TEXCOORD 1
+#define ATTRIB_NORMAL 2
+#define ATTRIB_INSTANCE 3 // xyz = location, w = scale (or the tile, for the land patch).  Not an array for non-instanced meshes, so it reads (0,0,0,1).
+
+// Vertex layouts
+#define LAYOUT_UNLIT 0 // unlitVertexData
+#define LAYOUT_LIT 1   // vertexData
+#define LAYOUT_TREE 2  // treeVertexData
+#define LAYOUT_LAND 3  // landVertexData:  the height in the position attribute, and the encoded normal.  No texture coordinate.
+#define LAYOUT_PATCH 4 // patchVertexData, in the position attribute.  Nothing else.
+
+// Uniform block binding points
+#define FRAME_BINDING 0
+#define MATERIAL_BINDING 1
+#define MATERIAL_CAPACITY 64 // size of the materials array in the shaders' materialData block
+
+void bindAttributeLocations(QOpenGLShaderProgram *program);
+
+// Surface properties for the main shader
+struct renderMaterial
+{
+    int layer;            // layer of the surface texture array
+    QVector4D Ka, Kd, Ks; // ambient, diffuse, specular
+    float Ns;             // shininess
+    float lodNear, lodFar; // distances over which a level of detail is drawn, for the cross-fade; 0 for no limit
+};
+
+// std140 layout of the frameData uniform block
+struct frameBlock
+{
+    GLfloat mvp[16];          // model-view-projection matrix
+    GLfloat mv[16];           // model-view matrix
+    GLfloat normal[12];       // normal matrix; std140 pads each column of a mat3 to a vec4
+    GLfloat lightPosition[4]; // in eye coordinates
+};
+
+// std140 layout of one element of the materialData uniform block's array
+struct materialBlock
+{
+    GLfloat Ka[4], Kd[4], Ks[4];
+    GLfloat Ns;
+    GLint layer;
+    GLfloat lodNear, lodFar; // also round the element up to a multiple of 16 bytes, as std140 requires
+};
+
+// A vertex array object with the attribute layout and index buffer of one mesh
+struct renderMesh
+{
+    GLuint vao;
+
+    renderMesh() : vao(0) {}
+    void create(QOpenGLExtraFunctions *gl, QOpenGLBuffer &vertices, QOpenGLBuffer &indices, int layout,
+                QOpenGLBuffer *instances = 0);
+    void destroy(QOpenGLExtraFunctions *gl);
+};
+
+struct drawCommand
+{
+    quint64 key;                    // sort key; filled in by submit()
+    QOpenGLShaderProgram *program;
+    QOpenGLTexture *texture;        // bound to texture unit 0
+    const renderMesh *mesh;
+    int material;                   // from addMaterial(), or -1 for programs without materials
+    GLenum mode;                    // GL_TRIANGLES, GL_TRIANGLE_STRIP, ...
+    GLenum type;                    // index type
+    GLsizei count;                  // number of indices
+    quintptr offset;                // byte offset into the index buffer
+    GLint baseVertex;               // added to every index
+    GLsizei instances;              // 0 for a plain draw
+};
+
+#define RENDER_PASSES 16 // passes the sort key has room for
+
+// Depth and color state for the draws of one pass
+struct passState
+{
+    GLenum depthFunc;     // GL_LESS, GL_EQUAL, GL_LEQUAL, ...
+    GLboolean depthWrite;
+    GLboolean colorWrite;
+};
+
+struct renderStats
+{
+    int commands;    // draws submitted
+    int glCalls;     // GL calls issued to carry them out
+    int uniformBytes; // bytes of uniform data sent to the GPU
+    int stateSkips;  // state changes skipped because the state was already current
+    int triangles;   // triangles drawn, counting every instance
+};
+
+class renderQueue : protected QOpenGLExtraFunctions
+{
+public:
+    renderQueue();
+
+    void initialize(void); // call with a current GL context
+    void release(void);    // call with a current GL context before the context goes away
+
+    // Connect a linked program's uniform blocks to the queue's buffers
+    void addProgram(QOpenGLShaderProgram *program);
+
+    // Add a material to the material buffer and return its index for drawCommand::material, or -1 if the buffer is
+    // full
+    int addMaterial(const renderMaterial &material);
+
+    // Forget what's bound.  Call at the start of each frame, since anything outside the queue may have changed it.
+    void beginFrame(void);
+
+    // Set the camera and light for the frame.  The light position is in eye coordinates.
+    void setFrame(const QMatrix4x4 &projection, const QMatrix4x4 &view, const QVector3D &lightPosition);
+
+    // Put the draws submitted from now on into a pass.  Passes are numbered from 0 to RENDER_PASSES - 1; it's 0 until
+    // set.
+    void beginPass(int pass);
+
+    // Set the depth and color state a pass is drawn with.  It's GL_LESS with both writes on until set, and that is
+    // what's left in effect after each flush.
+    void setPassState(int pass, const passState &state);
+
+    // Bind a texture to texture unit 1 while the current pass is drawn, for programs that read one besides their
+    // drawCommand::texture.  It's bound when the pass starts in flush(), and forgotten after the flush.
+    void setPassTexture(QOpenGLTexture *texture);
+
+    void submit(const drawCommand &command);
+
+    // Sort and issue everything submitted since the last flush
+    void flush(void);
+
+    const renderStats &getStats(void) const { return stats; } // for the frame so far
+
+    // Time the passes given a section with setPassSection() in the profiler
+    void setProfiler(frameProfiler *p) { profiler = p; }
+
+    // Time a pass as a profiler section, from its first draw to the first draw of the next.  Passes aren't timed
+    // until given a section.
+    void setPassSection(int pass, int section);
+
+private:
+    // Location and last value of the material index uniform, per program
+    struct programState
+    {
+        int materialIndex;
+        int current; // -1 until set
+    };
+
+    int slot(QHash<const void *, int> &ids, const void *object);
+    void applyPassState(const passState &state);
+    void applyMaterial(QOpenGLShaderProgram *program, int material);
+
+    QVector<drawCommand> commands;
+    int pass;                            // for the commands being submitted
+    frameProfiler *profiler;             // or null
+    QHash<const void *, int> programSlot, textureSlot, meshSlot; // small numbers for the sort keys
+    QHash<QOpenGLShaderProgram *, programState> programs;
+
+    GLuint frameBuffer, materialBuffer;  // the uniform buffers
+    QVector<materialBlock> materials;
+    bool materialsDirty;                 // materials has changed since it was last sent
+
+    passState passStates[RENDER_PASSES];
+    int passSections[RENDER_PASSES];     // profiler section timing each pass, or -1
+    QOpenGLTexture *passTextures[RENDER_PASSES]; // bound to texture unit 1 for each pass, or null
+    passState currentState;              // depthFunc is 0 when unknown
+
+    QOpenGLShaderProgram *currentProgram;
+    QOpenGLTexture *currentTexture;
+    const renderMesh *currentMesh;
+    renderStats stats;
+};
+
+#endif // RENDERCOMMAND_H
@@ -0,0 +1,26 @@
+/****************************************************************************
+**
+** Small seeded pseudo-random number generator (PCG32).  See rng.h.
+**
+****************************************************************************/
+
+#include "rng.h"
+
+rngStream::rngStream(quint64 seed, quint64 stream) : state(0), inc((stream << 1u) | 1u)
+{
+    next();
+    state += seed;
+    next();
+}
+
+float rngStream::uniform(float range)
+{
+    // 24 random bits fill the float's mantissa exactly
+    return float(next() >> 8) * range / float((1 << 24) - 1);
+}
+
+int rngStream::below(int n)
+{
+    // Lemire's multiply-shift; the bias for the small n used here is negligible
+    return int((quint64(next()) * quint64(n)) >> 32);
+}
@@ -0,0 +1,41 @@
+/****************************************************************************
+**
+** Small seeded pseudo-random number generator (PCG32).  Each subsystem that
+** needs random numbers gets its own stream, derived from the world seed and
+** a stream number, so that adding or removing random draws in one subsystem
+** doesn't change the results of any other.
+**
+** Based on: Melissa O'Neill, "PCG: A Family of Simple Fast Space-Efficient
+** Statistically Good Algorithms for Random Number Generation", 2014.
+**   https://www.pcg-random.org/
+**
+****************************************************************************/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <QtGlobal>
+
+class rngStream
+{
+public:
+    rngStream(quint64 seed, quint64 stream);
+
+    // Next raw 32-bit random value
+    inline quint32 next(void)
+    {
+        quint64 old = state;
+        state = old * 6364136223846793005ULL + inc;
+        quint32 xorshifted = quint32(((old >> 18u) ^ old) >> 27u);
+        quint32 rot = quint32(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    float uniform(float range); // Uniform random float in [0..range]
+    int below(int n);           // Uniform random integer in [0..n-1]
+
+private:
+    quint64 state, inc;
+};
+
+#endif // RNG_H
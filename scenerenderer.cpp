@@ -0,0 +1,362 @@
+/****************************************************************************
+**
+** Adapted from "cube" example code from the Qt library
+**   https://doc.qt.io/qt-5/qtopengl-cube-example.html
+**
+** The scene renderer.  See scenerenderer.h.
+**
+****************************************************************************/
+
+#include "scenerenderer.h"
+#include "geometryengine.h"
+#include "texturecache.h"
+
+#include <QFile>
+
+#include <iostream>
+using namespace std;
+
+// Locate a light source to correspond (roughly) with the sun in the skybox texture (3/4 up, 3/4 back, on the left
+// face).  World coordinates.
+static QVector3D sunPosition(void)
+{
+    return QVector3D(-WORLD_DIM, WORLD_DIM / 2.0f, -WORLD_DIM / 2.0f);
+}
+
+sceneRenderer::sceneRenderer(quint32 seed, bool useCache) : geometries(0), worldSeed(seed), useCache(useCache),
+                                                            loaded(false), failed(false), compressTextures(false),
+                                                            skyTexture(NULL), depthPrepass(true), heightTexture(false),
+                                                            streaming(false)
+{
+    // The passes go nearest and most hiding first: the trees' depth, then the land, water, trees, and far trees, and
+    // the sky last, where it only fills the pixels nothing else covered
+    static const char *const passNames[passCount] = {"depth", "land", "water", "trees", "impostors", "sky"};
+    cullSection = profiler.addSection("cull");
+    for (int p = 0; p < passCount; p++)
+    {
+        passSection[p] = profiler.addSection(passNames[p]);
+        renderer.setPassSection(p, passSection[p]);
+    }
+}
+
+sceneRenderer::~sceneRenderer()
+{
+    // Let any background loading finish before tearing down what it writes into
+    loader.wait();
+}
+
+bool sceneRenderer::initialize(void)
+{
+    initializeOpenGLFunctions();
+
+    glClearColor(0.31f, 0.43f, 0.65f, 1); // Sky color sampled from the skybox texture
+
+    renderer.initialize();
+    renderer.setProfiler(&profiler);
+
+    // The depth pass fills in depth only.  The sky is drawn at the far plane, so it passes just where the depth
+    // buffer is still clear, and it has no need to write depth.
+    passState depthOnly = {GL_LESS, GL_TRUE, GL_FALSE};
+    passState sky = {GL_LEQUAL, GL_FALSE, GL_TRUE};
+    renderer.setPassState(depthPass, depthOnly);
+    renderer.setPassState(skyPass, sky);
+    if (!initShaders())
+        return false;
+
+    // Everything else loads in the background.  render() shows the plain sky color until it's all in place.
+    compressTextures = textureCompressionSupported();
+    initTextures();
+
+    // Instantiate our geometry class.  Building the world (which also finds the starting position near the lake)
+    // happens on the thread pool; only creating the GL objects has to happen here.
+    geometries = new GeometryEngine(worldSeed, useCache);
+    geometries->setHeightTexture(heightTexture);
+    geometries->setStreaming(streaming);
+    loader.start([this]() {
+        geometries->prepare();
+        loader.post([this]() {
+            if (!geometries->upload(renderer))
+            {
+                failed = true;
+                return;
+            }
+            geometries->bakeImpostors(renderer, &mainProgram, sunPosition());
+        });
+    });
+    return true;
+}
+
+void sceneRenderer::release(void)
+{
+    loader.wait();
+    delete skyTexture;
+    delete geometries;
+    skyTexture = NULL;
+    geometries = 0;
+    renderer.release();
+    profiler.release();
+}
+
+// The constants the shaders share with the C++ side, as #defines, so that they can't drift apart.  The ones the
+// shaders use as floats are written as floats.
+static QByteArray shaderConstants(void)
+{
+    QByteArray constants;
+    constants += "#define LAND_DIVS " + QByteArray::number(LAND_DIVS) + "\n";
+    constants += "#define TILE_DIVS " + QByteArray::number(TILE_DIVS) + "\n";
+    constants += "#define TILE_COUNT " + QByteArray::number(TILE_COUNT) + "\n";
+    constants += "#define WORLD_DIM " + QByteArray::number(WORLD_DIM, 'f', 6) + "\n";
+    constants += "#define LAND_TEX_REPS " + QByteArray::number(double(LAND_TEX_REPS), 'f', 6) + "\n";
+    constants += "#define STITCH_N " + QByteArray::number(STITCH_N) + "\n";
+    constants += "#define STITCH_E " + QByteArray::number(STITCH_E) + "\n";
+    constants += "#define STITCH_S " + QByteArray::number(STITCH_S) + "\n";
+    constants += "#define STITCH_W " + QByteArray::number(STITCH_W) + "\n";
+    constants += "#define MATERIAL_CAPACITY " + QByteArray::number(MATERIAL_CAPACITY) + "\n";
+    constants += "#define TREE_LOD_FADE " + QByteArray::number(TREE_LOD_FADE, 'f', 6) + "\n";
+    constants += "#define IMPOSTOR_VIEWS " + QByteArray::number(IMPOSTOR_VIEWS) + "\n";
+    constants += "#define IMPOSTOR_SIZE " + QByteArray::number(IMPOSTOR_SIZE) + "\n";
+    constants += "#define IMPOSTOR_GUTTER " + QByteArray::number(IMPOSTOR_GUTTER) + "\n";
+    return constants;
+}
+
+static bool readShader(const QString &fileName, QByteArray &source)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        cerr << "Can't open shader " << fileName.toStdString() << endl;
+        return false;
+    }
+    source = file.readAll();
+    return true;
+}
+
+// Compile one shader from a resource file, with the shared constants and any #defines put in right after its #version
+// line.  GLSL has no #include, so each #include "file" line is replaced here by that resource file.
+bool sceneRenderer::addShader(QOpenGLShaderProgram &program, QOpenGLShader::ShaderType type, const QString &fileName,
+                              const QByteArray &defines)
+{
+    QByteArray source;
+    if (!readShader(fileName, source))
+        return false;
+    for (int at = source.indexOf("#include \""); at >= 0; at = source.indexOf("#include \"", at))
+    {
+        int nameStart = at + 10, nameEnd = source.indexOf('"', nameStart);
+        QByteArray included;
+        if (nameEnd < 0 || !readShader(":/" + QString::fromUtf8(source.mid(nameStart, nameEnd - nameStart)), included))
+            return false;
+        source.replace(at, nameEnd + 1 - at, included);
+    }
+    source.insert(source.indexOf('\n', source.indexOf("#version")) + 1, shaderConstants() + defines);
+    return program.addShaderFromSourceCode(type, source);
+}
+
+bool sceneRenderer::initShaders(void)
+{
+    // Compile vertex shaders
+    if (!addShader(skyProgram, QOpenGLShader::Vertex, ":/vtexonly.glsl", streaming ? "#define STREAMING\n" : ""))
+        return false;
+    if (!addShader(mainProgram, QOpenGLShader::Vertex, ":/vmain.glsl"))
+        return false;
+    if (!addShader(opaqueProgram, QOpenGLShader::Vertex, ":/vmain.glsl"))
+        return false;
+    QByteArray landDefines;
+    if (heightTexture || streaming)
+        landDefines += "#define HEIGHT_TEXTURE\n";
+    if (streaming)
+        landDefines += "#define STREAMING\n#define STREAM_WINDOW " + QByteArray::number(STREAM_WINDOW) + "\n";
+    if (!addShader(landProgram, QOpenGLShader::Vertex, ":/vland.glsl", landDefines))
+        return false;
+    if (!addShader(depthProgram, QOpenGLShader::Vertex, ":/vmain.glsl"))
+        return false;
+    if (!addShader(impostorProgram, QOpenGLShader::Vertex, ":/vimpostor.glsl"))
+        return false;
+
+    // Compile fragment shaders
+    if (!addShader(skyProgram, QOpenGLShader::Fragment, ":/ftexonly.glsl"))
+        return false;
+    if (!addShader(mainProgram, QOpenGLShader::Fragment, ":/fmain.glsl", "#define ALPHA_TEST\n"))
+        return false;
+    if (!addShader(opaqueProgram, QOpenGLShader::Fragment, ":/fmain.glsl"))
+        return false;
+    if (!addShader(landProgram, QOpenGLShader::Fragment, ":/fmain.glsl"))
+        return false;
+    if (!addShader(depthProgram, QOpenGLShader::Fragment, ":/fdepth.glsl"))
+        return false;
+    if (!addShader(impostorProgram, QOpenGLShader::Fragment, ":/fimpostor.glsl"))
+        return false;
+
+    QOpenGLShaderProgram *programs[] = {&skyProgram, &mainProgram, &opaqueProgram, &landProgram, &depthProgram,
+                                        &impostorProgram};
+    for (QOpenGLShaderProgram *program : programs)
+    {
+        // Pin the vertex attributes to the render queue's fixed locations, so that the vertex array objects work
+        // with any program.  That also puts the vertex position at attribute 0; some drivers won't draw anything
+        // unless attribute 0 is an enabled array.
+        bindAttributeLocations(program);
+
+        // Link shader pipelines
+        if (!program->link())
+            return false;
+
+        // Connect the uniform blocks
+        renderer.addProgram(program);
+    }
+
+    // Point the samplers at texture unit 0 for good
+    skyProgram.bind();
+    skyProgram.setUniformValue("tex", 0);
+    impostorProgram.bind();
+    impostorProgram.setUniformValue("tex", 0);
+    for (QOpenGLShaderProgram *program : {&mainProgram, &opaqueProgram, &landProgram, &depthProgram})
+    {
+        program->bind();
+        program->setUniformValue("textures", 0);
+    }
+    if (heightTexture || streaming)
+    {
+        landProgram.bind();
+        landProgram.setUniformValue("heights", 1); // GeometryEngine::drawLandGeometry() has the queue bind it there
+    }
+    depthProgram.release();
+    return true;
+}
+
+void sceneRenderer::initTextures(void)
+{
+    // Load the skybox texture.  The land, water, and tree textures belong to the geometry engine.
+    loadTexture(&skyTexture, ":/textures/Sky/2226.png");
+}
+
+// Open the cached texture for an image on the thread pool (making it first if needed), then upload it on the render
+// thread
+void sceneRenderer::loadTexture(QOpenGLTexture **texture, const QString &fileName)
+{
+    loader.start([this, texture, fileName]() {
+        QSharedPointer<textureFile> tex(new textureFile);
+        tex->load(fileName, compressTextures);
+        loader.post([texture, tex]() {
+            *texture = tex->upload();
+
+            // Set texture display parameters
+            (*texture)->setMinificationFilter(QOpenGLTexture::LinearMipMapNearest);
+            (*texture)->setMagnificationFilter(QOpenGLTexture::Linear);
+            (*texture)->setWrapMode(QOpenGLTexture::Repeat);
+        });
+    });
+}
+
+bool sceneRenderer::load(void)
+{
+    if (!loaded && !failed)
+    {
+        loader.drain();
+        loaded = loader.idle() && !failed;
+    }
+    return loaded;
+}
+
+bool sceneRenderer::finishLoading(void)
+{
+    // An upload job may start more background work, so keep going until nothing is left anywhere
+    while (!loaded && !failed)
+    {
+        loader.wait();
+        loader.drain(UPLOAD_BUDGET_MS);
+        loaded = loader.idle() && !failed;
+    }
+    return loaded;
+}
+
+void sceneRenderer::resize(int w, int h)
+{
+    // Calculate aspect ratio to keep pixels square
+    qreal aspect = qreal(w) / qreal(h ? h : 1);
+
+    const qreal zNear = 1.0f / WORLD_DIM;
+    const qreal zFar = 3.0f * WORLD_DIM;
+    const qreal fov = 55.0;
+
+    // Set perspective projection
+    projection.setToIdentity();
+    projection.perspective(fov, aspect, zNear, zFar);
+}
+
+void sceneRenderer::render(const QVector3D &eye, const QVector3D &lookDir)
+{
+    // Enable depth buffer.  This is set every frame, since anything painted over the scene (such as the profiler
+    // overlay) turns it off.
+    glEnable(GL_DEPTH_TEST);
+
+    // Clear color and depth buffer
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!loaded)
+        return;
+
+    profiler.beginFrame();
+
+    // Calculate model view transformation matrix
+    QMatrix4x4 matrix;
+    matrix.lookAt(eye, eye + lookDir, QVector3D(0, 1, 0)); // +Y is always up
+
+    // The streaming world has no middle for the sun to stay over, so it goes along with the viewer
+    QVector3D sun = streaming ? eye + sunPosition() : sunPosition();
+    QVector3D lightPos = QVector3D(matrix * sun); // transform the light to eye coordinates
+
+    // Find out what's in view.  Everything outside the view frustum is skipped by the draw calls below.
+    {
+        profileScope timer(profiler, cullSection);
+        geometries->cull(projection * matrix, eye);
+    }
+
+    // Set the camera and light for both shader pipelines with one upload
+    renderer.beginFrame();
+    renderer.setFrame(projection, matrix, lightPos);
+
+    // Queue up the whole scene, one pass at a time.  The trees' location and size come from the instance buffer, so the
+    // world view matrices set above are used as-is.
+    //
+    // With the depth pre-pass the trees' cutout test (and the dither that cross-fades their levels of detail) is made
+    // once, in the depth pass, and the tree pass then shades only the fragments whose depth matches exactly what the
+    // depth pass kept (vmain.glsl computes gl_Position the same way in both).  Without it the tree pass makes the test
+    // itself, and every leaf fragment in front of what's already drawn is lit, even if a nearer one covers it later.
+    if (depthPrepass)
+    {
+        profileScope timer(profiler, passSection[depthPass]);
+        renderer.beginPass(depthPass);
+        geometries->drawTreeGeometry(renderer, &depthProgram);
+    }
+    {
+        profileScope timer(profiler, passSection[landPass]);
+        renderer.beginPass(landPass);
+        geometries->drawLandGeometry(renderer, &landProgram, eye);
+    }
+    {
+        profileScope timer(profiler, passSection[waterPass]);
+        renderer.beginPass(waterPass);
+        geometries->drawWaterGeometry(renderer, &opaqueProgram);
+    }
+    {
+        profileScope timer(profiler, passSection[treePass]);
+        passState shade = {GL_EQUAL, GL_FALSE, GL_TRUE};
+        passState cutout = {GL_LESS, GL_TRUE, GL_TRUE};
+        renderer.setPassState(treePass, depthPrepass ? shade : cutout);
+        renderer.beginPass(treePass);
+        geometries->drawTreeGeometry(renderer, depthPrepass ? &opaqueProgram : &mainProgram);
+    }
+    {
+        profileScope timer(profiler, passSection[impostorPass]);
+        renderer.beginPass(impostorPass);
+        geometries->drawImpostorGeometry(renderer, &impostorProgram);
+    }
+    {
+        profileScope timer(profiler, passSection[skyPass]);
+        renderer.beginPass(skyPass);
+        geometries->drawSkyCubeGeometry(renderer, &skyProgram, skyTexture);
+    }
+
+    // Draw it, sorted by pass and then by state.  The queue adds each pass's share of the flush to its times.
+    renderer.flush();
+
+    profiler.endFrame();
+}
@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** The scene renderer owns everything needed to draw the world into the
+** current framebuffer: the shader programs, the skybox texture, the
+** geometry engine and the render queue, plus the background loader that
+** fills them in.  It knows nothing about windows or input, so the
+** interactive window and the headless benchmark draw exactly the same
+** frames.
+**
+****************************************************************************/
+
+#ifndef SCENERENDERER_H
+#define SCENERENDERER_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include "uploadqueue.h"
+#include "rendercommand.h"
+#include "profiler.h"
+
+class GeometryEngine;
+
+class sceneRenderer : protected QOpenGLFunctions
+{
+public:
+    sceneRenderer(quint32 seed, bool useCache = true);
+    ~sceneRenderer();
+
+    // Compile the shaders and start loading the world in the background.  Call with a current GL context.  Returns
+    // false if the shaders don't build.
+    bool initialize(void);
+
+    // Wait for the loader and delete the GL objects.  Call with the same context current before it goes away.
+    void release(void);
+
+    // Upload whatever the loader has ready, for up to UPLOAD_BUDGET_MS.  Returns true once the whole world is loaded.
+    bool load(void);
+
+    // Block until the whole world is loaded and uploaded.  Returns false if it failed to load.
+    bool finishLoading(void);
+    bool isLoaded(void) const { return loaded; }
+    bool hasFailed(void) const { return failed; } // The world couldn't be uploaded, and never will be
+
+    // Set the projection for a viewport of w x h pixels
+    void resize(int w, int h);
+
+    // Draw one frame seen from eye, looking along lookDir.  Until the world is loaded this just clears to the sky
+    // color.
+    void render(const QVector3D &eye, const QVector3D &lookDir);
+
+    GeometryEngine *geometry(void) { return geometries; } // null until initialize()
+    const renderStats &getStats(void) const { return renderer.getStats(); } // for the last frame
+
+    // Times culling and each render pass.  Off until enabled.
+    frameProfiler &getProfiler(void) { return profiler; }
+
+    // Lay down the trees' depth in a pass of its own before shading them, so each visible tree pixel is lit just
+    // once.  On by default.
+    void setDepthPrepass(bool on) { depthPrepass = on; }
+    bool getDepthPrepass(void) const { return depthPrepass; }
+
+    // Draw the land from a height texture and a shared tile patch instead of a vertex buffer (see
+    // GeometryEngine::setHeightTexture()).  Off by default.  Call before initialize().
+    void setHeightTexture(bool on) { heightTexture = on; }
+
+    // Make the world endless, generating it around the viewer as it goes (see GeometryEngine::setStreaming()).  Off by
+    // default.  Call before initialize().
+    void setStreaming(bool on) { streaming = on; }
+
+private:
+    bool initShaders(void);
+    bool addShader(QOpenGLShaderProgram &program, QOpenGLShader::ShaderType type, const QString &fileName,
+                   const QByteArray &defines = QByteArray());
+    void initTextures(void);
+    void loadTexture(QOpenGLTexture **texture, const QString &fileName);
+
+    // mainProgram makes the alpha cutout test for the leaves, opaqueProgram skips it for the water (and the trees
+    // behind a depth pre-pass), landProgram is the same for the land's quantized vertices, depthProgram writes only
+    // the trees' depth, and impostorProgram draws the farthest trees as billboards.
+    QOpenGLShaderProgram skyProgram, mainProgram, opaqueProgram, landProgram, depthProgram, impostorProgram;
+    GeometryEngine *geometries;
+    quint32 worldSeed; // Seed for generating the world
+    bool useCache;     // Whether to load and save generated worlds in the world cache
+
+    uploadQueue loader;      // Assets still being loaded in the background
+    bool loaded;             // Everything has been uploaded and the world can be drawn
+    bool failed;             // Uploading the world failed
+    bool compressTextures;   // The GPU takes BC1 textures
+
+    QOpenGLTexture *skyTexture;
+    bool depthPrepass;       // Draw the trees' depth first (see setDepthPrepass())
+    bool heightTexture;      // Draw the land from a height texture (see setHeightTexture())
+    bool streaming;          // Endless world (see setStreaming())
+
+    renderQueue renderer;
+
+    // Render passes, in the order they're drawn
+    enum
+    {
+        depthPass,
+        landPass,
+        waterPass,
+        treePass,
+        impostorPass,
+        skyPass,
+        passCount
+    };
+    static_assert(passCount <= RENDER_PASSES, "Too many render passes for the render queue");
+
+    // Profiler sections.  Each render pass has its own, given to the queue with renderQueue::setPassSection().
+    frameProfiler profiler;
+    int cullSection;
+    int passSection[passCount];
+
+    QMatrix4x4 projection;
+};
+
+#endif // SCENERENDERER_H
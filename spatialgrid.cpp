@@ -0,0 +1,86 @@
+/****************************************************************************
+**
+** Uniform grid spatial index over the XZ plane.  Points are bucketed into
+** square cells so that radius queries only have to look
+** at the few cells around the query position.
+**
+****************************************************************************/
+
+#include "spatialgrid.h"
+#include <math.h> // for ceil()
+
+spatialGrid::spatialGrid(float extent, float cellSize) : extent(extent),
+                                                         cellSize(cellSize)
+{
+    divs = int(ceil(2.0f * extent / cellSize));
+    if (divs < 1)
+        divs = 1;
+    cell.resize(divs * divs);
+}
+
+void spatialGrid::clear(void)
+{
+    for (int i = 0; i < cell.size(); i++)
+        cell[i].resize(0);
+}
+
+int spatialGrid::cellX(float x) const
+{
+    int cx = int((x + extent) / cellSize);
+    return cx < 0 ? 0 : (cx >= divs ? divs - 1 : cx);
+}
+
+int spatialGrid::cellZ(float z) const
+{
+    int cz = int((z + extent) / cellSize);
+    return cz < 0 ? 0 : (cz >= divs ? divs - 1 : cz);
+}
+
+void spatialGrid::insert(int id, float x, float z)
+{
+    gridEntry e = {x, z, id};
+    cell[cellZ(z) * divs + cellX(x)] << e;
+}
+
+// Return true if any point in the grid is closer than radius to (x, z)
+bool spatialGrid::anyWithin(float x, float z, float radius) const
+{
+    int x0 = cellX(x - radius), x1 = cellX(x + radius);
+    int z0 = cellZ(z - radius), z1 = cellZ(z + radius);
+    float r2 = radius * radius;
+
+    for (int iz = z0; iz <= z1; iz++)
+        for (int ix = x0; ix <= x1; ix++)
+        {
+            const QVector<gridEntry> &c = cell[iz * divs + ix];
+            for (int i = 0; i < c.size(); i++)
+            {
+                float dx = c[i].x - x;
+                float dz = c[i].z - z;
+                if (dx * dx + dz * dz < r2)
+                    return true;
+            }
+        }
+    return false;
+}
+
+// Append the ids of all points closer than radius to (x, z)
+void spatialGrid::within(float x, float z, float radius, QVector<int> &ids) const
+{
+    int x0 = cellX(x - radius), x1 = cellX(x + radius);
+    int z0 = cellZ(z - radius), z1 = cellZ(z + radius);
+    float r2 = radius * radius;
+
+    for (int iz = z0; iz <= z1; iz++)
+        for (int ix = x0; ix <= x1; ix++)
+        {
+            const QVector<gridEntry> &c = cell[iz * divs + ix];
+            for (int i = 0; i < c.size(); i++)
+            {
+                float dx = c[i].x - x;
+                float dz = c[i].z - z;
+                if (dx * dx + dz * dz < r2)
+                    ids << c[i].id;
+            }
+        }
+}
@@ -0,0 +1,40 @@
+/****************************************************************************
+**
+** Uniform grid spatial index over the XZ plane.  Points are bucketed into
+** square cells so that radius queries only have to look
+** at the few cells around the query position.
+**
+****************************************************************************/
+
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <QVector>
+
+class spatialGrid
+{
+public:
+    spatialGrid(float extent, float cellSize);
+
+    void clear(void);
+    void insert(int id, float x, float z);
+    bool anyWithin(float x, float z, float radius) const;
+    void within(float x, float z, float radius, QVector<int> &ids) const;
+
+private:
+    struct gridEntry
+    {
+        float x, z;
+        int id;
+    };
+
+    int cellX(float x) const;
+    int cellZ(float z) const;
+
+    float extent;   // The grid covers -extent..extent in both x and z.  Points outside are kept in the edge cells
+    float cellSize;
+    int divs;       // Number of cells in each direction
+    QVector<QVector<gridEntry>> cell;
+};
+
+#endif // SPATIALGRID_H
@@ -0,0 +1,451 @@
+/****************************************************************************
+**
+** Texture cache.  See texturecache.h.
+**
+** Mipmaps are made with a 2x2 box filter.  The color channels are weighted
+** by alpha so that the transparent parts of cutout textures (whose color is
+** meaningless) don't bleed dark fringes into the smaller levels.
+**
+** The BC1 encoder fits each 4x4 block's endpoints to the bounding box of its
+** colors, inset slightly, along whichever diagonal of the box follows the
+** colors.  Blocks with any pixel below half alpha use BC1's 3-color mode,
+** which has a transparent index; that matches the shader's alpha cutoff.
+**
+****************************************************************************/
+
+#include "texturecache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QOpenGLContext>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <limits.h> // for INT_MAX
+#include <string.h> // for memcpy()
+
+#include <iostream>
+using namespace std;
+
+#define TEXTURE_ALIGN 16 // alignment of each level in the file
+
+static quint64 alignUp(quint64 offset)
+{
+    return (offset + TEXTURE_ALIGN - 1) & ~quint64(TEXTURE_ALIGN - 1);
+}
+
+// Halve an RGBA image.  Odd sizes repeat the last row or column.
+static QVector<uchar> halve(const QVector<uchar> &src, int w, int h, int &nw, int &nh)
+{
+    nw = qMax(w / 2, 1);
+    nh = qMax(h / 2, 1);
+    QVector<uchar> dst(nw * nh * 4);
+    for (int y = 0; y < nh; y++)
+    {
+        const uchar *row0 = src.constData() + qMin(y * 2, h - 1) * w * 4;
+        const uchar *row1 = src.constData() + qMin(y * 2 + 1, h - 1) * w * 4;
+        uchar *out = dst.data() + y * nw * 4;
+        for (int x = 0; x < nw; x++)
+        {
+            int x0 = qMin(x * 2, w - 1) * 4;
+            int x1 = qMin(x * 2 + 1, w - 1) * 4;
+            const uchar *p[4] = {row0 + x0, row0 + x1, row1 + x0, row1 + x1};
+
+            int a = p[0][3] + p[1][3] + p[2][3] + p[3][3];
+            for (int c = 0; c < 3; c++)
+            {
+                if (a > 0)
+                    out[c] = uchar((p[0][c] * p[0][3] + p[1][c] * p[1][3] + p[2][c] * p[2][3] + p[3][c] * p[3][3] + a / 2) / a);
+                else
+                    out[c] = uchar((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+            }
+            out[3] = uchar((a + 2) / 4);
+            out += 4;
+        }
+    }
+    return dst;
+}
+
+static quint16 pack565(const int rgb[3])
+{
+    return quint16(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+static void unpack565(quint16 c, int rgb[3])
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Encode one 4x4 block of RGBA pixels into 8 bytes of BC1
+static void encodeBlock(const uchar px[16][4], uchar *out)
+{
+    bool cutout = false;
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    int opaque = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        if (px[i][3] < 128)
+        {
+            cutout = true;
+            continue;
+        }
+        opaque++;
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = qMin(lo[c], int(px[i][c]));
+            hi[c] = qMax(hi[c], int(px[i][c]));
+        }
+    }
+
+    quint16 c0 = 0, c1 = 0;
+    quint32 bits = 0xFFFFFFFF; // every pixel transparent
+    if (opaque)
+    {
+        // Pick the diagonal of the bounding box that the colors lie along: the widest channel leads, and each other
+        // channel runs the same way or the opposite way depending on the sign of its covariance with it.
+        int mid[3], lead = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            mid[c] = (lo[c] + hi[c]) / 2;
+            if (hi[c] - lo[c] > hi[lead] - lo[lead])
+                lead = c;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            int cov = 0;
+            for (int i = 0; i < 16; i++)
+                if (px[i][3] >= 128)
+                    cov += (px[i][lead] - mid[lead]) * (px[i][c] - mid[c]);
+            if (cov < 0)
+                qSwap(lo[c], hi[c]);
+        }
+
+        // Pull the endpoints in a little; the extremes are usually outliers
+        for (int c = 0; c < 3; c++)
+        {
+            int inset = (hi[c] - lo[c]) / 16;
+            hi[c] -= inset;
+            lo[c] += inset;
+        }
+
+        c0 = pack565(hi);
+        c1 = pack565(lo);
+
+        // The endpoint order selects the mode: c0 > c1 for 4 colors, c0 <= c1 for 3 colors and transparent
+        if ((cutout && c0 > c1) || (!cutout && c0 < c1))
+            qSwap(c0, c1);
+
+        int palette[4][3];
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        int colors = c0 > c1 ? 4 : 3;
+        for (int c = 0; c < 3; c++)
+        {
+            if (colors == 4)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        }
+
+        bits = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 3; // transparent in 3-color mode
+            if (px[i][3] >= 128 || !cutout)
+            {
+                int bestDist = INT_MAX;
+                for (int j = 0; j < (colors == 4 ? 4 : 3); j++)
+                {
+                    int dr = px[i][0] - palette[j][0], dg = px[i][1] - palette[j][1], db = px[i][2] - palette[j][2];
+                    int dist = dr * dr + dg * dg + db * db;
+                    if (dist < bestDist)
+                    {
+                        bestDist = dist;
+                        best = j;
+                    }
+                }
+            }
+            bits |= quint32(best) << (i * 2);
+        }
+    }
+
+    out[0] = uchar(c0);
+    out[1] = uchar(c0 >> 8);
+    out[2] = uchar(c1);
+    out[3] = uchar(c1 >> 8);
+    out[4] = uchar(bits);
+    out[5] = uchar(bits >> 8);
+    out[6] = uchar(bits >> 16);
+    out[7] = uchar(bits >> 24);
+}
+
+// Compress an RGBA image to BC1.  Partial blocks on the right and top edges repeat the last column or row.
+static QVector<uchar> compressBC1(const QVector<uchar> &src, int w, int h)
+{
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    QVector<uchar> dst(bw * bh * 8);
+    uchar *out = dst.data();
+    for (int by = 0; by < bh; by++)
+    {
+        for (int bx = 0; bx < bw; bx++)
+        {
+            uchar px[16][4];
+            for (int i = 0; i < 16; i++)
+            {
+                int x = qMin(bx * 4 + (i & 3), w - 1);
+                int y = qMin(by * 4 + (i >> 2), h - 1);
+                memcpy(px[i], src.constData() + (y * w + x) * 4, 4);
+            }
+            encodeBlock(px, out);
+            out += 8;
+        }
+    }
+    return dst;
+}
+
+// Hash of the image's full path and its contents (compiled-in resources have no modification time, and an edit can
+// leave the size unchanged).  Images with the same name in different directories get different digests.
+static QByteArray sourceDigest(const QString &imageName)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QFileInfo(imageName).absoluteFilePath().toUtf8());
+    hash.addData(QByteArray(1, 0));
+    QFile file(imageName);
+    if (file.open(QFile::ReadOnly))
+        hash.addData(file.readAll());
+    return hash.result();
+}
+
+static quint64 digestKey(const QByteArray &digest, int format, int size)
+{
+    quint64 key = 0;
+    memcpy(&key, digest.constData(), sizeof(key));
+    return key ^ (quint64(TEXTURE_FILE_VERSION) << 8) ^ quint64(format) ^ (quint64(size) << 48);
+}
+
+quint64 textureSourceKey(const QString &imageName, int format, int size)
+{
+    return digestKey(sourceDigest(imageName), format, size);
+}
+
+bool writeTextureFile(const QString &fileName, const QString &imageName, int format, int size)
+{
+    // Flip it once here so that it never has to be flipped again
+    QImage image = QImage(imageName).convertToFormat(QImage::Format_RGBA8888).mirrored();
+    if (image.isNull())
+    {
+        cerr << "Can't read image " << imageName.toStdString() << endl;
+        return false;
+    }
+    if (size)
+        image = image.scaled(size, size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    int w = image.width(), h = image.height();
+    QVector<uchar> pixels(w * h * 4);
+    for (int y = 0; y < h; y++)
+        memcpy(pixels.data() + y * w * 4, image.constScanLine(y), w * 4);
+
+    // Build every level down to 1x1
+    QVector<textureFileLevel> table;
+    QVector<QVector<uchar>> data;
+    for (;;)
+    {
+        data << (format == TEXTURE_BC1 ? compressBC1(pixels, w, h) : pixels);
+        textureFileLevel level = {w, h, 0, quint64(data.last().size())};
+        table << level;
+        if (w == 1 && h == 1)
+            break;
+        pixels = halve(pixels, w, h, w, h);
+    }
+
+    // Lay out the file: header, level table, then each level's data
+    quint64 offset = sizeof(textureFileHeader) + table.size() * sizeof(textureFileLevel);
+    for (int i = 0; i < table.size(); i++)
+    {
+        table[i].offset = offset = alignUp(offset);
+        offset += table[i].size;
+    }
+
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        cerr << "Can't write texture file " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    textureFileHeader header = {TEXTURE_FILE_MAGIC, TEXTURE_FILE_VERSION, textureSourceKey(imageName, format, size),
+                                image.width(), image.height(), qint32(table.size()), format};
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)table.constData(), table.size() * sizeof(textureFileLevel));
+
+    // Zero padding up to each aligned level
+    static const char zeros[TEXTURE_ALIGN] = {0};
+    for (int i = 0; i < table.size(); i++)
+    {
+        out.write(zeros, table[i].offset - out.pos());
+        out.write((const char *)data[i].constData(), data[i].size());
+    }
+    return out.commit();
+}
+
+bool textureCompressionSupported(void)
+{
+    return TEXTURE_COMPRESS && QOpenGLContext::currentContext()->hasExtension("GL_EXT_texture_compression_s3tc");
+}
+
+textureFile::textureFile() : base(0), header(0)
+{
+}
+
+textureFile::~textureFile()
+{
+    close();
+}
+
+bool textureFile::open(const QString &fileName, quint64 sourceKey)
+{
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    quint64 size = file.size();
+    const uchar *p = size >= sizeof(textureFileHeader) ? file.map(0, size) : 0;
+    const textureFileHeader *h = (const textureFileHeader *)p;
+    bool ok = h && h->magic == TEXTURE_FILE_MAGIC && h->version == TEXTURE_FILE_VERSION && h->sourceKey == sourceKey &&
+              h->width > 0 && h->height > 0 && h->levels > 0 && h->levels <= 32 &&
+              (h->format == TEXTURE_RGBA8 || h->format == TEXTURE_BC1) &&
+              sizeof(textureFileHeader) + h->levels * sizeof(textureFileLevel) <= size;
+
+    // Make sure every level lies inside the file, and is the size it should be, before handing out pointers into it
+    for (int i = 0; ok && i < h->levels; i++)
+    {
+        const textureFileLevel &l = ((const textureFileLevel *)(h + 1))[i];
+        quint64 expected = h->format == TEXTURE_BC1 ? quint64((l.width + 3) / 4) * ((l.height + 3) / 4) * 8
+                                                    : quint64(l.width) * l.height * 4;
+        ok = l.width == qMax(h->width >> i, 1) && l.height == qMax(h->height >> i, 1) &&
+             l.size == expected && l.offset % TEXTURE_ALIGN == 0 && l.offset + l.size <= size;
+    }
+
+    if (!ok)
+    {
+        cerr << "Ignoring stale texture file " << fileName.toStdString() << endl;
+        file.close(); // also unmaps
+        return false;
+    }
+
+    base = p;
+    header = h;
+    return true;
+}
+
+void textureFile::close(void)
+{
+    base = 0;
+    header = 0;
+    file.close();
+}
+
+bool textureFile::load(const QString &imageName, bool compress, int size)
+{
+    int format = compress ? TEXTURE_BC1 : TEXTURE_RGBA8;
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/textures";
+    QByteArray digest = sourceDigest(imageName);
+    QString fileName = cacheDir + "/" + QFileInfo(imageName).completeBaseName() + "-" +
+                       QString::fromLatin1(digest.toHex().left(16)) + (size ? QString("-%1").arg(size) : "") +
+                       (compress ? ".bc1" : ".rgba");
+    quint64 key = digestKey(digest, format, size);
+
+    if (open(fileName, key))
+        return true;
+
+    cout << "Caching texture " << imageName.toStdString() << endl;
+    QDir().mkpath(cacheDir);
+    return writeTextureFile(fileName, imageName, format, size) && open(fileName, key);
+}
+
+QOpenGLTexture *textureFile::upload(void) const
+{
+    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+
+    // If the image couldn't be loaded, draw it plain white rather than not at all
+    if (!isOpen())
+    {
+        static const uchar white[4] = {255, 255, 255, 255};
+        texture->setSize(1, 1);
+        texture->setMipLevels(1);
+        texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+        texture->allocateStorage();
+        texture->setData(0, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, white);
+        return texture;
+    }
+
+    texture->setSize(width(), height());
+    texture->setMipLevels(levels());
+    texture->setFormat(format() == TEXTURE_BC1 ? QOpenGLTexture::RGBA_DXT1 : QOpenGLTexture::RGBA8_UNorm);
+    texture->allocateStorage();
+
+    for (int i = 0; i < levels(); i++)
+    {
+        if (format() == TEXTURE_BC1)
+            texture->setCompressedData(i, levelSize(i), levelData(i));
+        else
+            texture->setData(i, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, levelData(i));
+    }
+    return texture;
+}
+
+QOpenGLTexture *textureFile::uploadArray(const QVector<QSharedPointer<textureFile>> &layers)
+{
+    // The first layer that loaded sets the size and format for the rest
+    const textureFile *first = 0;
+    for (int i = 0; i < layers.size() && !first; i++)
+        if (layers[i]->isOpen())
+            first = layers[i].data();
+
+    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2DArray);
+    texture->setSize(first ? first->width() : 1, first ? first->height() : 1);
+    texture->setLayers(layers.size());
+    texture->setMipLevels(first ? first->levels() : 1);
+    texture->setFormat(first && first->format() == TEXTURE_BC1 ? QOpenGLTexture::RGBA_DXT1 : QOpenGLTexture::RGBA8_UNorm);
+    texture->allocateStorage();
+
+    for (int layer = 0; layer < layers.size(); layer++)
+    {
+        // If no layer loaded, draw them all plain white, as upload() does
+        if (!first)
+        {
+            static const uchar white[4] = {255, 255, 255, 255};
+            texture->setData(0, layer, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, white);
+            continue;
+        }
+
+        // A layer that's missing or doesn't match gets a copy of the first one, so that its storage isn't left undefined
+        const textureFile *tex = layers[layer].data();
+        if (!tex->isOpen() || tex->width() != first->width() || tex->height() != first->height() ||
+            tex->levels() != first->levels() || tex->format() != first->format())
+        {
+            cerr << "Texture array layer " << layer << " is missing or doesn't match the others; using the first one's image"
+                 << endl;
+            tex = first;
+        }
+
+        for (int i = 0; i < tex->levels(); i++)
+        {
+            if (tex->format() == TEXTURE_BC1)
+                texture->setCompressedData(i, layer, tex->levelSize(i), tex->levelData(i));
+            else
+                texture->setData(i, layer, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, tex->levelData(i));
+        }
+    }
+    return texture;
+}
@@ -0,0 +1,91 @@
+/****************************************************************************
+**
+** Texture cache.  The first time an image is used it is decoded, flipped
+** for OpenGL, reduced to a full mipmap chain and (when the GPU supports it)
+** compressed to BC1, and the result is saved in the user's cache directory.
+** After that the texture file is mapped and each level goes straight to
+** the GPU, with no image decoding and no mipmap generation by the driver.
+**
+****************************************************************************/
+
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <QFile>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <QOpenGLTexture>
+
+#define TEXTURE_FILE_MAGIC 0x58455454 // "TTEX"
+#define TEXTURE_FILE_VERSION 1
+#define TEXTURE_COMPRESS 1            // use BC1 (DXT1) when the GPU supports it
+
+#define TEXTURE_RGBA8 0               // 4 bytes per pixel
+#define TEXTURE_BC1 1                 // 8 bytes per 4x4 block; 1-bit alpha
+
+// Layout of the start of a texture file.  The header is followed by one textureFileLevel record per mipmap level,
+// then the data of each level at the offset given in its record.  Rows run bottom to top, as OpenGL expects.
+struct textureFileHeader
+{
+    quint32 magic, version;
+    quint64 sourceKey; // textureSourceKey() of the image the texture was made from
+    qint32 width, height;
+    qint32 levels;
+    qint32 format;     // TEXTURE_RGBA8 or TEXTURE_BC1
+};
+
+struct textureFileLevel
+{
+    qint32 width, height;
+    quint64 offset, size; // byte offset from the start of the file, and byte count
+};
+
+// A key that changes whenever the image's path or contents, the file format, the texture format or the texture size change
+quint64 textureSourceKey(const QString &imageName, int format, int size);
+
+// Decode an image and write it out as a texture file.  If size isn't 0 the image is first scaled to size x size.
+bool writeTextureFile(const QString &fileName, const QString &imageName, int format, int size = 0);
+
+// True if the GPU can use BC1 textures.  Call with a current GL context.
+bool textureCompressionSupported(void);
+
+// A texture file mapped into memory.  The level pointers stay valid until close().
+class textureFile
+{
+public:
+    textureFile();
+    ~textureFile();
+
+    bool open(const QString &fileName, quint64 sourceKey); // false if missing, stale, or malformed
+    void close(void);
+
+    // Open the cached texture for an image, making it first if there isn't an up-to-date one.  A non-zero size scales
+    // the image to size x size.  Safe to call from any thread.
+    bool load(const QString &imageName, bool compress, int size = 0);
+
+    bool isOpen(void) const { return header != 0; }
+    int width(void) const { return header->width; }
+    int height(void) const { return header->height; }
+    int levels(void) const { return header->levels; }
+    int format(void) const { return header->format; }
+    const uchar *levelData(int i) const { return base + level(i).offset; }
+    int levelSize(int i) const { return int(level(i).size); }
+
+    // Create a texture and upload every level (or a white texel if the file isn't open).  Call with a current GL
+    // context.
+    QOpenGLTexture *upload(void) const;
+
+    // Create a 2D array texture with one layer per file.  The files must all have the same size and format.  Call
+    // with a current GL context.
+    static QOpenGLTexture *uploadArray(const QVector<QSharedPointer<textureFile>> &layers);
+
+private:
+    const textureFileLevel &level(int i) const { return ((const textureFileLevel *)(header + 1))[i]; }
+
+    QFile file;
+    const uchar *base;
+    const textureFileHeader *header; // start of the mapped file, or null if not open
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** Background loading.  See uploadqueue.h.
+**
+****************************************************************************/
+
+#include "uploadqueue.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+uploadQueue::uploadQueue() : running(0)
+{
+}
+
+uploadQueue::~uploadQueue()
+{
+    // The tasks may still be posting into the queue
+    wait();
+}
+
+void uploadQueue::start(std::function<void()> work)
+{
+    running.fetchAndAddOrdered(1);
+    tasks.addFuture(QtConcurrent::run([this, work]() {
+        work();
+        // Everything the task posted is already in the queue by now, so idle() can't see an empty queue too early
+        running.fetchAndAddOrdered(-1);
+    }));
+}
+
+void uploadQueue::post(std::function<void()> job)
+{
+    QMutexLocker lock(&mutex);
+    jobs << job;
+}
+
+void uploadQueue::drain(qint64 budgetMs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    do
+    {
+        std::function<void()> job;
+        {
+            QMutexLocker lock(&mutex);
+            if (jobs.isEmpty())
+                return;
+            job = jobs.takeFirst();
+        }
+        job(); // outside the lock, so the workers can keep posting
+    } while (timer.elapsed() < budgetMs);
+}
+
+bool uploadQueue::idle(void) const
+{
+    // Check the tasks first; a task posts before it counts itself finished
+    if (running.loadAcquire() != 0)
+        return false;
+    QMutexLocker lock(&mutex);
+    return jobs.isEmpty();
+}
+
+void uploadQueue::wait(void)
+{
+    tasks.waitForFinished();
+}
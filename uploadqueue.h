@@ -0,0 +1,51 @@
+/****************************************************************************
+**
+** Background loading.  Work that doesn't need the GL context (parsing,
+** world generation, image decoding) runs on the thread pool, and whatever
+** it produces for the GPU is posted back as a job for the render thread.
+** The render thread drains the queue a few milliseconds at a time between
+** frames, so the window stays responsive while assets stream in.
+**
+****************************************************************************/
+
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+#include <QAtomicInt>
+#include <QFutureSynchronizer>
+#include <QMutex>
+#include <QVector>
+#include <functional>
+
+#define UPLOAD_BUDGET_MS 8 // time per frame the render thread spends on uploads
+
+class uploadQueue
+{
+public:
+    uploadQueue();
+    ~uploadQueue();
+
+    // Run work on the thread pool
+    void start(std::function<void()> work);
+
+    // Queue a job for the render thread.  May be called from any thread.
+    void post(std::function<void()> job);
+
+    // Run queued jobs on the calling (render) thread until the queue is empty or budgetMs has passed.  At least one
+    // job runs each call, so a single large upload can't stall loading.
+    void drain(qint64 budgetMs = UPLOAD_BUDGET_MS);
+
+    // True once every started task has finished and everything it posted has been drained
+    bool idle(void) const;
+
+    // Wait for the started tasks to finish.  Jobs they posted are left in the queue.
+    void wait(void);
+
+private:
+    mutable QMutex mutex;
+    QVector<std::function<void()>> jobs; // guarded by mutex
+    QFutureSynchronizer<void> tasks;
+    QAtomicInt running;                  // tasks started but not finished
+};
+
+#endif // UPLOADQUEUE_H
@@ -0,0 +1,61 @@
+/****************************************************************************
+**
+** Packed vertex structures used for the OpenGL VBOs, and for the binary
+** mesh files that are uploaded into them.
+**
+** vertexData is the full precision form that the models are built and
+** stored in.  The GPU gets quantized forms of it:  treeVertexData keeps the
+** position as floats but halves the texture coordinate and packs the
+** normal into one word (20 bytes instead of 32), and landVertexData keeps
+** only a 16-bit height and an octahedral normal (4 bytes), because the x
+** and z of a land vertex follow from where it is in the grid.  When the
+** heights are in a texture instead, the land is drawn from a single tile's
+** worth of patchVertexData, which holds nothing but the place in the tile.
+**
+****************************************************************************/
+
+#ifndef VERTEXDATA_H
+#define VERTEXDATA_H
+
+#include <QOpenGLFunctions>
+#include <QVector2D>
+#include <QVector3D>
+#include <qfloat16.h>
+
+// Packed structures to use for the OpenGL VBOs
+struct unlitVertexData
+{
+    QVector3D position;
+    QVector2D texCoord;
+};
+
+struct vertexData
+{
+    QVector3D position;
+    QVector2D texCoord;
+    QVector3D normal;
+};
+
+// Tree model vertex.  The normal is GL_INT_2_10_10_10_REV, read back as a normalized vec3.
+struct treeVertexData
+{
+    QVector3D position;
+    qfloat16 texCoord[2];
+    GLuint normal;
+};
+
+// Land grid vertex.  The height is normalized over -WORLD_DIM..WORLD_DIM, and the normal is octahedral encoded (see
+// packOctahedral() in geometryengine.cpp).  Both are decoded in vland.glsl.
+struct landVertexData
+{
+    GLushort height;
+    GLbyte normal[2];
+};
+
+// Grid point of the shared land tile patch, numbered from the tile's corner
+struct patchVertexData
+{
+    GLushort x, z;
+};
+
+#endif // VERTEXDATA_H
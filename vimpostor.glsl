@@ -0,0 +1,53 @@
+/****************************************************************************
+**
+** Vertex shader for the tree impostors.  Each instance is an upright quad
+** the size of the tree's outline, turned about its trunk to face the
+** viewer, and textured with whichever of the views baked by
+** GeometryEngine::bakeImpostors() was seen from the nearest direction.
+**
+****************************************************************************/
+
+#version 330 core
+
+// Camera and light for the frame (see frameBlock in rendercommand.h)
+layout(std140) uniform frameData
+{
+    mat4 mvp_matrix;
+    mat4 mv_matrix;
+    mat3 normalMatrix;
+    vec4 lightPosition; // eye coordinates
+};
+
+const float PI = 3.1415926;
+
+in vec4 a_position;  // corner of the quad:  x across the tree, y up it, in model units
+in vec2 a_texcoord;  // the same corner in one view of the impostor texture
+in vec4 a_instance;  // xyz = location, w = scale
+
+out vec2 v_texcoord;
+flat out float v_lodDistance; // distance to this instance, divided by its scale, for the level of detail cross-fade
+
+void main()
+{
+    // The view matrix is a rotation and a translation, so the eye is where the inverse takes the origin
+    vec3 eye = -(transpose(mat3(mv_matrix)) * mv_matrix[3].xyz);
+    vec3 toEye = eye - a_instance.xyz;
+    v_lodDistance = length(toEye) / a_instance.w;
+
+    // Face the eye, turning only about the vertical, the way the views were baked
+    vec2 level = toEye.xz;
+    if (dot(level, level) < 1.0e-8)
+        level = vec2(1.0, 0.0);
+    vec3 forward = normalize(vec3(-level.x, 0.0, -level.y));
+    vec3 right = normalize(cross(forward, vec3(0.0, 1.0, 0.0)));
+    vec3 position = a_instance.xyz + (right * a_position.x + vec3(0.0, a_position.y, 0.0)) * a_instance.w;
+
+    // View n was baked from angle 2*pi*n/IMPOSTOR_VIEWS around the tree
+    float view = mod(floor(atan(level.y, level.x) * float(IMPOSTOR_VIEWS) / (2.0 * PI) + 0.5), float(IMPOSTOR_VIEWS));
+    // Each view sits between IMPOSTOR_GUTTER pixel gutters (see GeometryEngine::bakeImpostors())
+    float cell = float(IMPOSTOR_SIZE + 2 * IMPOSTOR_GUTTER);
+    float u = view * cell + float(IMPOSTOR_GUTTER) + a_texcoord.x * float(IMPOSTOR_SIZE);
+    v_texcoord = vec2(u / (cell * float(IMPOSTOR_VIEWS)), a_texcoord.y);
+
+    gl_Position = mvp_matrix * vec4(position, 1.0);
+}
@@ -0,0 +1,107 @@
+/****************************************************************************
+**
+** Vertex shader for the land.  The vertices are only a quantized height
+** and an octahedral encoded normal (landVertexData in vertexdata.h); where
+** each one sits in the grid, and so its x, z and texture coordinate, comes
+** from its index in the vertex buffer.  Used with fmain.glsl, like
+** vmain.glsl.
+**
+** With HEIGHT_TEXTURE defined, the heights come from a texture instead,
+** and every tile is an instance of the same flat patch of grid points.
+** The normal is worked out from the neighboring heights, and the edges
+** that border a coarser tile are stitched here rather than in the index
+** buffers.
+**
+** With STREAMING defined as well, the tiles are the pages of the endless
+** world, which can be anywhere.  The height texture is a window onto the
+** grid that wraps around, so a grid point's texel is its position modulo
+** STREAM_WINDOW, the size of the texture (see GeometryEngine::uploadPage()).
+**
+****************************************************************************/
+
+#version 330 core
+
+// Camera and light for the frame (see frameBlock in rendercommand.h)
+layout(std140) uniform frameData
+{
+    mat4 mvp_matrix;
+    mat4 mv_matrix;
+    mat3 normalMatrix;
+    vec4 lightPosition; // eye coordinates
+};
+
+// The land grid, LAND_DIVS, TILE_DIVS, TILE_COUNT, WORLD_DIM and LAND_TEX_REPS, and the STITCH_ edges of a tile are
+// defined by sceneRenderer::addShader() from geometryengine.h
+
+#ifdef HEIGHT_TEXTURE
+uniform sampler2D heights; // one texel per grid point, normalized over -WORLD_DIM..WORLD_DIM
+
+in vec4 a_position;  // xy = grid point within the tile
+in vec4 a_instance;  // xy = the tile's first grid point, z = the STITCH_ edges that border a coarser tile, w = level of detail
+#else
+in vec4 a_position;  // x = height, normalized over -WORLD_DIM..WORLD_DIM
+in vec2 a_normal;    // octahedral encoded normal
+#endif
+
+out vec2 v_texcoord;
+out vec3 N;
+out vec3 v;
+flat out float v_lodDistance; // not used for the land
+
+#ifdef HEIGHT_TEXTURE
+float heightAt(ivec2 grid)
+{
+#ifdef STREAMING
+    ivec2 texel = grid & ivec2(STREAM_WINDOW - 1);
+#else
+    ivec2 texel = clamp(grid, ivec2(0), ivec2(LAND_DIVS - 1));
+#endif
+    return -WORLD_DIM + WORLD_DIM * 2.0 * texelFetch(heights, texel, 0).r;
+}
+#endif
+
+void main(void)
+{
+#ifdef HEIGHT_TEXTURE
+    // Move the in-between points along an edge that borders a coarser tile onto that tile's points, the same as
+    // GeometryEngine::buildTileIndices() does with the indices, so that no cracks open up.  The triangles that collapse
+    // have no area and aren't drawn.
+    ivec2 local = ivec2(a_position.xy);
+    int mask = int(a_instance.z);
+    int coarse = 2 << int(a_instance.w);
+    if (((mask & STITCH_N) != 0 && local.y == 0) || ((mask & STITCH_S) != 0 && local.y == TILE_DIVS - 1))
+        local.x -= local.x % coarse;
+    if (((mask & STITCH_W) != 0 && local.x == 0) || ((mask & STITCH_E) != 0 && local.x == TILE_DIVS - 1))
+        local.y -= local.y % coarse;
+    ivec2 grid = ivec2(a_instance.xy) + local;
+    float height = heightAt(grid);
+
+    // Central differences of the neighboring heights.  At the edge of the world the missing neighbor reads as this
+    // point, which is near enough.  The streaming world has no edge, and a page is only drawn once the pages around it
+    // are in the texture too (see GeometryEngine::cullPages()).
+    float spacing = WORLD_DIM * 2.0 / float(LAND_DIVS - 1);
+    vec3 n = vec3(heightAt(grid - ivec2(1, 0)) - heightAt(grid + ivec2(1, 0)), 2.0 * spacing,
+                  heightAt(grid - ivec2(0, 1)) - heightAt(grid + ivec2(0, 1)));
+#else
+    // The vertex buffer holds the tiles one after another, each a square of TILE_DIVS rows of TILE_DIVS grid points.
+    // gl_VertexID includes the draw's base vertex, so it counts from the start of the buffer.
+    int tile = gl_VertexID / (TILE_DIVS * TILE_DIVS);
+    int local = gl_VertexID % (TILE_DIVS * TILE_DIVS);
+    ivec2 grid = ivec2(tile % TILE_COUNT, tile / TILE_COUNT) * (TILE_DIVS - 1) + ivec2(local % TILE_DIVS, local / TILE_DIVS);
+    float height = -WORLD_DIM + WORLD_DIM * 2.0 * a_position.x;
+
+    // Undo the octahedral encoding:  the lower half of the octahedron was folded out over the corners of the upper
+    vec3 n = vec3(a_normal.x, 1.0 - abs(a_normal.x) - abs(a_normal.y), a_normal.y);
+    if (n.y < 0.0)
+        n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+#endif
+
+    vec2 frac = vec2(grid) / float(LAND_DIVS - 1);
+    vec4 position = vec4(-WORLD_DIM + WORLD_DIM * 2.0 * frac.x, height, -WORLD_DIM + WORLD_DIM * 2.0 * frac.y, 1.0);
+
+    v = vec3(mv_matrix * position);
+    N = normalize(normalMatrix * n);
+    v_texcoord = frac * LAND_TEX_REPS;
+    v_lodDistance = 0.0;
+    gl_Position = mvp_matrix * position;
+}
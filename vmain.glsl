@@ -7,24 +7,44 @@
 **
 ****************************************************************************/
 
-uniform mat4 mvp_matrix;
-uniform mat4 mv_matrix;
-uniform mat3 normalMatrix;
+#version 330 core
 
-attribute vec4 a_position;  // bind this to vertex coordinate array
-attribute vec3 a_normal;    // Array of normals
-attribute vec2 a_texcoord;  // Array of texture coordinates 
+// Camera and light for the frame (see frameBlock in rendercommand.h)
+layout(std140) uniform frameData
+{
+    mat4 mvp_matrix;
+    mat4 mv_matrix;
+    mat3 normalMatrix;
+    vec4 lightPosition; // eye coordinates
+};
 
-varying vec2 v_texcoord;
-varying vec3 N;
-varying vec3 v;
+in vec4 a_position;  // bind this to vertex coordinate array
+in vec3 a_normal;    // Array of normals
+in vec2 a_texcoord;  // Array of texture coordinates 
+in vec4 a_instance;  // Per-instance placement:  xyz = location, w = scale.  (0,0,0,1) for non-instanced geometry
+
+out vec2 v_texcoord;
+out vec3 N;
+out vec3 v;
+flat out float v_lodDistance; // distance to this instance, divided by its scale, for the level of detail cross-fade
+
+// The depth pre-pass uses this shader too, and the shading pass after it only keeps fragments at exactly the depth
+// the pre-pass wrote, so the position has to come out the same in both programs
+invariant gl_Position;
 
 void main(void)  
 {     
-    v = vec3(mv_matrix * a_position);       
+    // Place this instance in the world.  The scaling is uniform, so the normals don't need adjusting
+    vec4 position = vec4(a_position.xyz * a_instance.w + a_instance.xyz, 1.0);
+
+    v = vec3(mv_matrix * position);       
     N = normalize(normalMatrix * a_normal);
 
     v_texcoord = a_texcoord;    // texture coordinate pass-through
-    gl_Position = mvp_matrix * a_position;  
+
+    // The view matrix is a rotation and a translation, so the eye is where the inverse takes the origin
+    vec3 eye = -(transpose(mat3(mv_matrix)) * mv_matrix[3].xyz);
+    v_lodDistance = length(a_instance.xyz - eye) / a_instance.w;
+    gl_Position = mvp_matrix * position;  
 }
           
\ No newline at end of file
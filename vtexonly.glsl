@@ -5,19 +5,38 @@
 **
 ** Vertex shader with just texture mapping
 **
+** With STREAMING defined the sky cube is centered on the eye, since the
+** endless world has no middle for it to stay around.
+**
 ****************************************************************************/
 
-uniform mat4 mvp_matrix;
+#version 330 core
+
+// Camera and light for the frame (see frameBlock in rendercommand.h)
+layout(std140) uniform frameData
+{
+    mat4 mvp_matrix;
+    mat4 mv_matrix;
+    mat3 normalMatrix;
+    vec4 lightPosition; // eye coordinates
+};
 
-attribute vec4 a_position;
-attribute vec2 a_texcoord;
+in vec4 a_position;
+in vec2 a_texcoord;
 
-varying vec2 v_texcoord;
+out vec2 v_texcoord;
 
 void main()
 {
-    // Calculate vertex position in screen space
-    gl_Position = mvp_matrix * a_position;
+    // Calculate vertex position in screen space.  The skybox is drawn last, behind everything:  setting z to w puts it
+    // at the far plane, so it only fills in the pixels nothing else has covered.
+#ifdef STREAMING
+    // The view matrix is a rotation and a translation, so the eye is where the inverse takes the origin
+    vec3 eye = -(transpose(mat3(mv_matrix)) * mv_matrix[3].xyz);
+    gl_Position = (mvp_matrix * vec4(a_position.xyz + eye, 1.0)).xyww;
+#else
+    gl_Position = (mvp_matrix * a_position).xyww;
+#endif
 
     // Pass texture coordinate to fragment shader
     // Value will be automatically interpolated to fragments inside polygon faces
@@ -13,99 +13,324 @@
 
 #include <iostream>
 #include <string>
+#include <math.h>   // for pow()
+#include <string.h> // for strlen(), memcmp(), memchr()
 
 using namespace std;
 
-wavefrontObj::wavefrontObj(QString filename)
+wavefrontObj::wavefrontObj(QString filename, QString dir) : dir(dir)
 {
     loadObj(filename);
 }
 
+//
+// Byte-level tokenizer for obj and mtl files.  It walks the file contents in place, one line at a time, handing out
+// [begin, end) pointers for each whitespace-separated word.  Nothing is copied and nothing is allocated, which is what
+// makes the parser fast on big models; the old QTextStream + QString::split version allocated a list of strings for
+// every line and another for every facet corner.
+//
+class objTokenizer
+{
+public:
+    objTokenizer(const char *begin, const char *end) : next(begin), end(end), pos(begin), eol(begin) {}
+
+    // Advance to the next line that has something on it.  Returns false at the end of the file.
+    bool nextLine(void)
+    {
+        while (next < end)
+        {
+            pos = next;
+            eol = (const char *)memchr(pos, '\n', end - pos);
+            if (!eol)
+                eol = end;
+            next = eol + 1;
+            skipSpace();
+            if (pos < eol && *pos != '\r')
+                return true; // skip blank lines
+        }
+        return false;
+    }
+
+    // The next word on the current line, or false if there are no more
+    bool word(const char *&b, const char *&e)
+    {
+        skipSpace();
+        b = pos;
+        while (pos < eol && !isSpace(*pos))
+            pos++;
+        e = pos;
+        return b != e;
+    }
+
+    // True if there are no more words on the current line
+    bool atEol(void)
+    {
+        skipSpace();
+        return pos == eol;
+    }
+
+    // Everything left on the current line, without the surrounding whitespace (for names that may contain spaces)
+    QString rest(void)
+    {
+        skipSpace();
+        const char *e = eol;
+        while (e > pos && isSpace(e[-1]))
+            e--;
+        return QString::fromUtf8(pos, int(e - pos));
+    }
+
+    // Parse the next word as a float / unsigned int.  Anything that doesn't parse gives 0, as QString::toFloat() and
+    // toUInt() did.
+    float toFloat(void);
+    GLuint toUInt(void);
+
+    // Number of words on the current line, without consuming them
+    int countWords(void);
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    // Compare a word against a command name
+    static bool is(const char *b, const char *e, const char *cmd) { return size_t(e - b) == strlen(cmd) && !memcmp(b, cmd, e - b); }
+
+private:
+    void skipSpace(void)
+    {
+        while (pos < eol && isSpace(*pos))
+            pos++;
+    }
+
+    const char *next, *end; // start of the next line; end of the file
+    const char *pos, *eol;  // current position and end of the current line
+};
+
+// Parse an unsigned integer from [p, end).  Returns the position after it, or null if there are no digits.
+static const char *parseUInt(const char *p, const char *end, GLuint &value)
+{
+    const char *start = p;
+    GLuint v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + GLuint(*p++ - '0');
+    value = v;
+    return p == start ? 0 : p;
+}
+
+// Parse a decimal floating point number (with optional sign, fraction, and exponent) from [p, end).  Returns the
+// position after it, or null if it isn't a number.
+static const char *parseFloat(const char *p, const char *end, float &value)
+{
+    // Exact powers of ten for doubles
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    // Gather up to 19 significant digits into an integer, and keep track of where the decimal point goes
+    quint64 mantissa = 0;
+    int digits = 0, scale = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + quint64(*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+            scale++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + quint64(*p - '0');
+                digits += mantissa != 0;
+                scale--;
+            }
+        }
+    }
+    if (!any)
+        return 0;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool negExp = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negExp = *q++ == '-';
+        GLuint e;
+        if ((q = parseUInt(q, end, e)))
+        {
+            scale += negExp ? -int(e < 1000 ? e : 1000) : int(e < 1000 ? e : 1000);
+            p = q;
+        }
+    }
+
+    double v = double(mantissa);
+    if (scale < 0)
+        v = scale >= -22 ? v / pow10[-scale] : v * pow(10.0, scale);
+    else if (scale > 0)
+        v = scale <= 22 ? v * pow10[scale] : v * pow(10.0, scale);
+    value = float(negative ? -v : v);
+    return p;
+}
+
+float objTokenizer::toFloat(void)
+{
+    const char *b, *e;
+    float v = 0.0f;
+    if (word(b, e) && parseFloat(b, e, v) != e)
+        v = 0.0f;
+    return v;
+}
+
+GLuint objTokenizer::toUInt(void)
+{
+    const char *b, *e;
+    GLuint v = 0;
+    if (word(b, e) && parseUInt(b, e, v) != e)
+        v = 0;
+    return v;
+}
+
+int objTokenizer::countWords(void)
+{
+    const char *save = pos, *b, *e;
+    int n = 0;
+    while (word(b, e))
+        n++;
+    pos = save;
+    return n;
+}
+
 // Parse an obj file into memory
 bool wavefrontObj::loadObj(QString filename)
 {
-    QString fn(":/obj/" + filename);
+    QString fn(dir + filename);
     QFile infile(fn);
-    if (infile.open(QFile::ReadOnly | QFile::Text))
+    if (!infile.open(QFile::ReadOnly))
     {
-        QTextStream in(&infile);
-        QString line;
-        while (in.readLineInto(&line))
+        cerr << "Cannot open file " << filename.toStdString() << endl;
+        return false;
+    }
+
+    // Map the file if possible (compressed resources can't be), otherwise read it in one go
+    QByteArray contents;
+    const char *begin = (const char *)infile.map(0, infile.size());
+    if (!begin)
+    {
+        contents = infile.readAll();
+        begin = contents.constData();
+    }
+    const char *end = begin + infile.size();
+    const char *b, *e;
+
+    //
+    // Counting pass: find out how big the vertex arrays and each section's facet list will get, so they can be
+    // allocated once up front instead of growing as the file is read
+    //
+    int nv = 0, nvt = 0, nvn = 0;
+    QVector<int> corners(1, 0); // facet corners before the first usemtl, then after each one
+    objTokenizer count(begin, end);
+    while (count.nextLine())
+    {
+        count.word(b, e);
+        if (objTokenizer::is(b, e, "v"))
+            nv++;
+        else if (objTokenizer::is(b, e, "vt"))
+            nvt++;
+        else if (objTokenizer::is(b, e, "vn"))
+            nvn++;
+        else if (objTokenizer::is(b, e, "f"))
+            corners.last() += count.countWords();
+        else if (objTokenizer::is(b, e, "usemtl"))
+            corners << 0;
+    }
+    data.v.reserve(data.v.size() + nv);
+    data.vt.reserve(data.vt.size() + nvt);
+    data.vn.reserve(data.vn.size() + nvn);
+
+    //
+    // Parsing pass
+    //
+    int block = 0; // which usemtl block we're in, to look up its facet count
+    objTokenizer in(begin, end);
+    while (in.nextLine())
+    {
+        in.word(b, e); // The first word on a line is the command
+        if (objTokenizer::is(b, e, "o"))
+        {
+            // Object name.  Everything after the command is the name
+            data.name = in.rest();
+        }
+        else if (objTokenizer::is(b, e, "v"))
         {
-            if (line.isEmpty())
-                continue; // skip blank lines else token[0] will segfault
+            // Vertex coordinates (spec says can be 3 or 4, but we will assume only 3)
+            float x = in.toFloat(), y = in.toFloat(), z = in.toFloat();
+            data.v << QVector3D(x, y, z);
+        }
+        else if (objTokenizer::is(b, e, "vn"))
+        {
+            // Normal coordinates (always 3)
+            float x = in.toFloat(), y = in.toFloat(), z = in.toFloat();
+            data.vn << QVector3D(x, y, z);
+        }
+        else if (objTokenizer::is(b, e, "vt"))
+        {
+            // Texture coordinates (always 2)
+            float s = in.toFloat(), t = in.toFloat();
+            data.vt << QVector2D(s, t);
+        }
+        else if (objTokenizer::is(b, e, "f"))
+        {
+            // Facets.  Just stuff vertex #'s into data structures here.  They will be consolidated and converted
+            // to OpenGL VBO's external to this class
 
-            QStringList token = line.split(' ', QString::SkipEmptyParts);
-            QString cmd = token[0]; // The first token on a line is the command
-            if (cmd == "o")
-            {
-                // Object name.  Everything after the command is the name
-                data.name = line.right(line.size() - cmd.size()).trimmed();
-            }
-            else if (cmd == "v")
-            {
-                // Vertex coordinates (spec says can be 3 or 4, but we will assume only 3)
-                data.v << QVector3D(token[1].toFloat(), token[2].toFloat(), token[3].toFloat());
-            }
-            else if (cmd == "vn")
+            // Make sure there is a section available to add facets to
+            if (data.section.isEmpty())
             {
-                // Normal coordinates (always 3)
-                data.vn << QVector3D(token[1].toFloat(), token[2].toFloat(), token[3].toFloat());
+                data.section.resize(1);
+                data.section.last().f.reserve(corners[block]);
             }
-            else if (cmd == "vt")
-            {
-                // Texture coordinates (always 2)
-                data.vt << QVector2D(token[1].toFloat(), token[2].toFloat());
-            }
-            else if (cmd == "f")
-            {
-                // Facets.  Just stuff vertex #'s into data structures here.  They will be consolidated and converted
-                // to OpenGL VBO's external to this class
 
-                // Make sure there is a section available to add facets to
-                if (data.section.isEmpty())
-                    data.section.resize(1);
+            while (in.word(b, e))
+            {
+                // v, v//vn, or v/vt/vn.  Missing indices are 0.
+                GLuint idx[3] = {0, 0, 0};
+                int parts = 1;
+                const char *p = parseUInt(b, e, idx[0]);
+                p = p ? p : b;
+                while (p < e && *p == '/' && parts < 3)
+                {
+                    const char *q = parseUInt(p + 1, e, idx[parts++]);
+                    p = q ? q : p + 1;
+                }
 
-                int n = token.size() - 1;
-                for (int i = 1; i <= n; i++)
+                if (p != e || parts == 2)
                 {
-                    QStringList indices = token[i].split('/', QString::KeepEmptyParts);
-                    if (indices.size() == 3)
-                    {
-                        // v//vn format will automagically be handled correctly because split() with KeepEmptyParts
-                        // option will return empty string in position 1, and that empty string will parse to zero
-                        indexTriple t(indices[0].toUInt(), indices[1].toUInt(), indices[2].toUInt(), i == n);
-                        data.section.last().f << t;
-                    }
-                    else if (indices.size() == 1)
-                    {
-                        indexTriple t(indices[0].toUInt(), 0, 0, i == n);
-                        data.section.last().f << t;
-                    }
-                    else
-                    {
-                        cerr << "Invalid facet " << token[i].toStdString() << endl;
-                        return false;
-                    }
+                    cerr << "Invalid facet " << string(b, e - b) << endl;
+                    return false;
                 }
+                data.section.last().f << indexTriple(idx[0], idx[1], idx[2], in.atEol());
             }
-            else if (cmd == "usemtl")
-            {
-                // Switch the material.
-                setMaterial(token[1]);
-            }
-            else if (cmd == "mtllib")
-            {
-                // Load a materials file
-                loadMaterialFile(token[1]);
-            }
-            // add handing for more commands here.  For now, anything not handled above  will just be ignored
         }
-    }
-    else
-    {
-        cerr << "Cannot open file " << filename.toStdString() << endl;
-        return false;
+        else if (objTokenizer::is(b, e, "usemtl"))
+        {
+            // Switch the material.
+            block++;
+            if (in.word(b, e) && setMaterial(QString::fromUtf8(b, int(e - b))))
+                data.section.last().f.reserve(corners.value(block));
+        }
+        else if (objTokenizer::is(b, e, "mtllib"))
+        {
+            // Load a materials file
+            if (in.word(b, e))
+                loadMaterialFile(QString::fromUtf8(b, int(e - b)));
+        }
+        // add handing for more commands here.  For now, anything not handled above  will just be ignored
     }
     return true;
 }
@@ -129,122 +354,91 @@ bool wavefrontObj::setMaterial(QString name)
     return false;
 }
 
+// Read three floats for a color, if that is what's on the rest of the line
+static bool readColor(objTokenizer &in, QVector4D &color)
+{
+    if (in.countWords() != 3)
+        return false;
+    color.setX(in.toFloat());
+    color.setY(in.toFloat());
+    color.setZ(in.toFloat());
+    return true;
+}
+
 // Parse a material definition (mtl) file into memory
 bool wavefrontObj::loadMaterialFile(QString filename)
 {
-    QString fn(":/obj/" + filename);
-    QFile infile(QString(":/obj/") + filename);
-    if (infile.open(QFile::ReadOnly | QFile::Text))
+    QString fn(dir + filename);
+    QFile infile(fn);
+    if (!infile.open(QFile::ReadOnly))
     {
-        QTextStream in(&infile);
-        QString line;
-        while (in.readLineInto(&line))
-        {
-            if (line.isEmpty())
-            {
-                continue; // skip blank lines else token[0] will segfault
-            }
-
-            QStringList token = line.split(' ', QString::SkipEmptyParts);
-
-            QString cmd = token[0]; // First token on a line is the command
-            if (cmd == "newmtl")
-            {
-                // New Material - start a materialData struct
-                if (token.size() == 2)
-                {
-                    materialData md;
-                    md.name = token[1];
+        cerr << "Cannot open materials file " << filename.toStdString() << endl
+             << endl;
+        return false;
+    }
 
-                    material << md;
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed newmtl command" << endl;
-                }
-            }
-            else if (material.isEmpty())
-            {
-                // If no materials named yet, then skip this line
-            }
-            else if (cmd == "Ka")
-            {
-                // Three floats for the ambient color
-                if (token.size() == 4)
-                {
-                    material.last().Ka.setX(token[1].toFloat());
-                    material.last().Ka.setY(token[2].toFloat());
-                    material.last().Ka.setZ(token[3].toFloat());
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ka command" << endl;
-                }
-            }
-            else if (cmd == "Kd")
-            {
-                // Three floats for the ambient color
-                if (token.size() == 4)
-                {
-                    material.last().Kd.setX(token[1].toFloat());
-                    material.last().Kd.setY(token[2].toFloat());
-                    material.last().Kd.setZ(token[3].toFloat());
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Kd command" << endl;
-                }
-            }
-            else if (cmd == "Ks")
-            {
-                // Three floats for the ambient color
-                if (token.size() == 4)
-                {
-                    material.last().Ks.setX(token[1].toFloat());
-                    material.last().Ks.setY(token[2].toFloat());
-                    material.last().Ks.setZ(token[3].toFloat());
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ks command" << endl;
-                }
-            }
-            else if (cmd == "Ns")
-            {
-                // One float for the Material shininess
-                if (token.size() == 2)
-                {
-                    material.last().Ns = token[1].toFloat();
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ns command" << endl;
-                }
-            }
-            else if (cmd == "d")
+    QByteArray contents = infile.readAll(); // materials files are tiny
+    objTokenizer in(contents.constData(), contents.constData() + contents.size());
+    const char *b, *e;
+    while (in.nextLine())
+    {
+        in.word(b, e); // First word on a line is the command
+        if (objTokenizer::is(b, e, "newmtl"))
+        {
+            // New Material - start a materialData struct
+            if (in.countWords() == 1)
             {
-                // One float for the dissolve factor
-                if (token.size() == 2)
-                {
-                    material.last().d = token[1].toFloat();
-                }
-                else
-                {
-                    cerr << "Warning while parsing " << filename.toStdString() << ": malformed d command" << endl;
-                }
+                in.word(b, e);
+                material << materialData(QString::fromUtf8(b, int(e - b)));
             }
-            else if (cmd == "map_Kd")
+            else
             {
-                // Texture.  Everything after the command is the filename
-                material.last().map_d_filename = ":/obj/" + line.right(line.size() - token[0].size()).trimmed();
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed newmtl command" << endl;
             }
         }
-    }
-    else
-    {
-        cerr << "Cannot open materials file " << filename.toStdString() << endl
-             << endl;
-        return false;
+        else if (material.isEmpty())
+        {
+            // If no materials named yet, then skip this line
+        }
+        else if (objTokenizer::is(b, e, "Ka"))
+        {
+            // Three floats for the ambient color
+            if (!readColor(in, material.last().Ka))
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ka command" << endl;
+        }
+        else if (objTokenizer::is(b, e, "Kd"))
+        {
+            // Three floats for the diffuse color
+            if (!readColor(in, material.last().Kd))
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed Kd command" << endl;
+        }
+        else if (objTokenizer::is(b, e, "Ks"))
+        {
+            // Three floats for the specular color
+            if (!readColor(in, material.last().Ks))
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ks command" << endl;
+        }
+        else if (objTokenizer::is(b, e, "Ns"))
+        {
+            // One float for the Material shininess
+            if (in.countWords() == 1)
+                material.last().Ns = in.toFloat();
+            else
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed Ns command" << endl;
+        }
+        else if (objTokenizer::is(b, e, "d"))
+        {
+            // One float for the dissolve factor
+            if (in.countWords() == 1)
+                material.last().d = in.toFloat();
+            else
+                cerr << "Warning while parsing " << filename.toStdString() << ": malformed d command" << endl;
+        }
+        else if (objTokenizer::is(b, e, "map_Kd"))
+        {
+            // Texture.  Everything after the command is the filename
+            material.last().map_d_filename = in.rest();
+        }
     }
 
     return true;
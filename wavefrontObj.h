@@ -13,6 +13,7 @@
 
 #include <QString>
 #include <QVector>
+#include <QHash>
 #include <QVector2D>
 #include <QVector3D>
 #include <QVector4D>
@@ -20,13 +21,15 @@
 #include <QFile>
 #include <QTextStream>
 
+#define OBJ_RESOURCE_DIR ":/obj/" // where the application's obj files and their materials and textures live
+
 struct materialData
 {
     QString name;
     float Ns;               // Specular exponent
     QVector4D Ka, Kd, Ks;   // Ambient, Diffuse, and Specular colors
     float d;                // transparency [0..1]; 0.0 = fully transparent, 1.0 = fully opaque
-    QString map_d_filename; // Alpha texture map filename
+    QString map_d_filename; // Alpha texture map filename, relative to the directory of the obj file
 
     materialData(QString name = "") : name(name),
                                       Ns(0),
@@ -51,6 +54,22 @@ struct indexTriple
                                   edge(e) {}
 };
 
+// Two index triples refer to the same vertex when all three indices match.  The edge flag is facet bookkeeping and
+// does not take part in the comparison.
+inline bool operator==(const indexTriple &a, const indexTriple &b)
+{
+    return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+}
+
+inline uint qHash(const indexTriple &t, uint seed = 0)
+{
+    uint h = seed;
+    h = h * 31 + t.v;
+    h = h * 31 + t.vt;
+    h = h * 31 + t.vn;
+    return h;
+}
+
 struct objectSection
 {
     materialData mtl;       // the material for this section of an object
@@ -73,12 +92,13 @@ class wavefrontObj
 public:
     objectData data;                // Main storage
 
-    wavefrontObj(QString filename);
+    wavefrontObj(QString filename, QString dir = OBJ_RESOURCE_DIR);
     bool loadObj(QString filename);
     void debugDump(void);
 
 protected:
 private:
+    QString dir;                    // directory the obj file and its material files are read from
     QVector<materialData> material; // .mtl files are parsed and the materials are stored here
 
     bool setMaterial(QString name);
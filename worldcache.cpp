@@ -0,0 +1,86 @@
+/****************************************************************************
+**
+** On-disk cache of generated worlds.  See worldcache.h.
+**
+****************************************************************************/
+
+#include "worldcache.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <iostream>
+using namespace std;
+
+// The vertex arrays are written and mapped as raw floats
+static_assert(sizeof(QVector3D) == 3 * sizeof(float), "QVector3D must be 3 packed floats");
+static_assert(sizeof(QVector4D) == 4 * sizeof(float), "QVector4D must be 4 packed floats");
+
+// Total size of a cache file
+static qint64 cacheSize(int divs, int treeCount)
+{
+    return qint64(sizeof(worldCacheHeader)) + qint64(divs) * divs * (sizeof(float) + sizeof(QVector3D)) +
+           qint64(treeCount) * sizeof(QVector4D);
+}
+
+worldCache::worldCache(quint32 seed, quint64 params) : seed(seed), params(params), header(0)
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    file.setFileName(dir + QString("/world-%1-%2.bin").arg(seed).arg(params, 16, 16, QChar('0')));
+}
+
+worldCache::~worldCache()
+{
+    close();
+}
+
+bool worldCache::open(int divs)
+{
+    close();
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Check that the file is complete and was made with the same seed, parameters and layout before trusting it
+    const worldCacheHeader *h = 0;
+    if (file.size() >= qint64(sizeof(worldCacheHeader)))
+        h = (const worldCacheHeader *)file.map(0, file.size());
+    if (!h || h->magic != WORLD_CACHE_MAGIC || h->version != WORLD_CACHE_VERSION || h->seed != seed ||
+        h->params != params || h->divs != divs || h->treeCount < 0 || file.size() != cacheSize(divs, h->treeCount))
+    {
+        cerr << "Ignoring stale world cache " << file.fileName().toStdString() << endl;
+        file.close(); // also unmaps
+        return false;
+    }
+
+    header = h;
+    return true;
+}
+
+void worldCache::close(void)
+{
+    header = 0;
+    file.close();
+}
+
+bool worldCache::save(int divs, const worldInfo &info, const float *heights, const QVector3D *normals,
+                      const QVector4D *trees, int treeCount)
+{
+    close();
+    QDir().mkpath(QFileInfo(file).absolutePath());
+
+    // QSaveFile writes to a temporary and renames it into place, so a crash never leaves a half-written cache behind
+    QSaveFile out(file.fileName());
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        cerr << "Can't write world cache " << file.fileName().toStdString() << endl;
+        return false;
+    }
+
+    worldCacheHeader h = {WORLD_CACHE_MAGIC, WORLD_CACHE_VERSION, seed, 0, params, divs, treeCount, info};
+    out.write((const char *)&h, sizeof(h));
+    out.write((const char *)heights, qint64(divs) * divs * sizeof(float));
+    out.write((const char *)normals, qint64(divs) * divs * sizeof(QVector3D));
+    out.write((const char *)trees, qint64(treeCount) * sizeof(QVector4D));
+    return out.commit();
+}
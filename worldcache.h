@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** On-disk cache of generated worlds.  A world is identified by the seed it
+** was requested with and a hash of the parameters that went into generating
+** it, so changing any generation constant invalidates the old files.  Cached
+** worlds are memory-mapped rather than read, so loading one costs little
+** more than copying the arrays out of the page cache.
+**
+****************************************************************************/
+
+#ifndef WORLDCACHE_H
+#define WORLDCACHE_H
+
+#include <QFile>
+#include <QString>
+#include <QVector3D>
+#include <QVector4D>
+
+#define WORLD_CACHE_MAGIC 0x4357444d // "MDWC"
+#define WORLD_CACHE_VERSION 1
+
+// Everything about a generated world besides the bulk arrays
+struct worldInfo
+{
+    quint32 seed;     // seed the world was actually generated from (the requested seed, or a later one after lake retries)
+    float landAvg;    // average terrain elevation
+    float waterLevel; // elevation of the water surface
+    float startX, startY, startZ; // where the viewer starts
+};
+
+// Layout of the start of a cache file.  The file continues with divs*divs heights, divs*divs normals (3 floats
+// each), and treeCount tree spots (4 floats each).
+struct worldCacheHeader
+{
+    quint32 magic, version;
+    quint32 seed;   // requested seed
+    quint32 pad;
+    quint64 params; // hash of the generation parameters
+    qint32 divs, treeCount;
+    worldInfo info;
+};
+
+class worldCache
+{
+public:
+    worldCache(quint32 seed, quint64 params);
+    ~worldCache();
+
+    bool open(int divs); // Map the cache file for this world.  Returns false if there is none or it is unusable.
+    void close(void);
+    bool save(int divs, const worldInfo &info, const float *heights, const QVector3D *normals,
+              const QVector4D *trees, int treeCount);
+
+    const worldInfo &info(void) const { return header->info; }
+    const float *heights(void) const { return (const float *)(header + 1); }
+    const QVector3D *normals(void) const { return (const QVector3D *)(heights() + header->divs * header->divs); }
+    const QVector4D *trees(void) const { return (const QVector4D *)(normals() + header->divs * header->divs); }
+    int treeCount(void) const { return header->treeCount; }
+    QString fileName(void) const { return file.fileName(); }
+
+private:
+    quint32 seed;
+    quint64 params;
+    QFile file;
+    const worldCacheHeader *header; // start of the mapped file, or null if not open
+};
+
+#endif // WORLDCACHE_H
@@ -0,0 +1,298 @@
+/****************************************************************************
+**
+** Pages of an endless world, made on demand around the viewer.  See
+** worldpager.h.
+**
+****************************************************************************/
+
+#include "worldpager.h"
+#include "geometryengine.h"
+#include <QtConcurrent>
+#include <algorithm> // for std::sort()
+#include <float.h>   // for FLT_MAX
+#include <math.h>    // for floor(), sqrt(), ceil()
+
+#define PAGE_SPACING (WORLD_DIM * 2.0f / (LAND_DIVS - 1)) // Distance between grid points, the same as the fixed size world
+#define PAGE_SIZE (PAGE_SPACING * (TILE_DIVS - 1))        // Width and depth of a page
+
+// Random value in -1..1 for a lattice point.  The coordinates are mixed with the finalizer of MurmurHash3, which is
+// cheap and has no visible pattern.
+static float latticeValue(qint32 x, qint32 z, quint32 seed)
+{
+    quint32 h = seed ^ (quint32(x) * 0x8da6b343u) ^ (quint32(z) * 0xd8163841u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h * (2.0f / 4294967295.0f) - 1.0f;
+}
+
+// Value noise:  the lattice values at the corners of the cell around (x, z), blended with a smooth step so that there
+// are no creases along the lattice lines
+static float valueNoise(float x, float z, quint32 seed)
+{
+    float fx = floorf(x), fz = floorf(z);
+    qint32 ix = qint32(fx), iz = qint32(fz);
+    float tx = x - fx, tz = z - fz;
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+
+    float a = latticeValue(ix, iz, seed), b = latticeValue(ix + 1, iz, seed);
+    float c = latticeValue(ix, iz + 1, seed), d = latticeValue(ix + 1, iz + 1, seed);
+    float top = a + (b - a) * tx, bottom = c + (d - c) * tx;
+    return top + (bottom - top) * tz;
+}
+
+// Sum of octaves of value noise, each twice the frequency and half the amplitude of the one before, scaled back to
+// -1..1.  Every octave has a lattice of its own, so their lattice lines don't pile up.
+static float fractalNoise(float x, float z, int octaves, quint32 seed)
+{
+    float sum = 0.0f, amplitude = 1.0f, total = 0.0f;
+    for (int o = 0; o < octaves; o++)
+    {
+        sum += valueNoise(x, z, seed + o) * amplitude;
+        total += amplitude;
+        amplitude *= 0.5f;
+        x *= 2.0f;
+        z *= 2.0f;
+    }
+    return sum / total;
+}
+
+worldPager::worldPager(quint32 seed, float waterLevel, const QVector3D &treeMin, const QVector3D &treeMax)
+    : seed(seed),
+      waterLevel(waterLevel),
+      treeMin(treeMin),
+      treeMax(treeMax),
+      offsetRadius(-1.0f),
+      bytes(0),
+      updates(0)
+{
+}
+
+worldPager::~worldPager()
+{
+    // The workers use this object, so let them finish
+    for (auto i = pending.constBegin(); i != pending.constEnd(); ++i)
+    {
+        QFuture<QSharedPointer<worldPage>> f = i.value();
+        f.waitForFinished();
+    }
+}
+
+float worldPager::height(float x, float z) const
+{
+    return STREAM_RELIEF * fractalNoise(x / STREAM_FEATURE, z / STREAM_FEATURE, STREAM_OCTAVES, seed);
+}
+
+// Relative density of trees at a point, from 0 to 1.  As in the fixed size world they keep out of the water, thin out
+// towards the tree line and on steep slopes, and on top of that they gather into patches of forest.
+float worldPager::treeDensity(float x, float z) const
+{
+    float above = height(x, z) - waterLevel;
+    if (above < 0.0f)
+        return 0.0f;
+
+    // Rise over run, from the heights a grid spacing either side
+    float dx = (height(x + PAGE_SPACING, z) - height(x - PAGE_SPACING, z)) / (2.0f * PAGE_SPACING);
+    float dz = (height(x, z + PAGE_SPACING) - height(x, z - PAGE_SPACING)) / (2.0f * PAGE_SPACING);
+    float slope = sqrt(dx * dx + dz * dz);
+
+    float heightFactor = MAX(1.0f - above / TREE_LINE, 0.0f);
+    float slopeFactor = MAX(1.0f - slope / TREE_SLOPE_MAX, 0.0f);
+    float forest = qBound(0.0f, 0.5f + 2.0f * fractalNoise(x / STREAM_FOREST, z / STREAM_FOREST, 3, seed + STREAM_OCTAVES),
+                          1.0f);
+    return heightFactor * slopeFactor * forest;
+}
+
+// Place the trees on a page.  Each cell of a STREAM_TREE_CELL grid gets one candidate site, kept away from the cell's
+// sides so that no two trees are ever closer than TREE_MIN_PROX, even across the edge of a page, and kept with a
+// chance of the density there.  The random numbers come from a stream of the page's own, so a page always gets the
+// same trees no matter which pages were made before it.
+void worldPager::placeTrees(worldPage &page) const
+{
+    rngStream rng(seed ^ key(page.px, page.pz), RNG_PAGE_TREES);
+    const int cells = int(PAGE_SIZE / STREAM_TREE_CELL + 0.5f);
+    const float margin = TREE_MIN_PROX / 2.0f;
+    float x0 = -WORLD_DIM + page.px * PAGE_SIZE, z0 = -WORLD_DIM + page.pz * PAGE_SIZE;
+
+    for (int cz = 0; cz < cells; cz++)
+    {
+        for (int cx = 0; cx < cells; cx++)
+        {
+            // Draw every number for every cell, so that one cell's draws don't depend on whether the last was kept
+            float x = x0 + cx * STREAM_TREE_CELL + margin + rng.uniform(STREAM_TREE_CELL - 2.0f * margin);
+            float z = z0 + cz * STREAM_TREE_CELL + margin + rng.uniform(STREAM_TREE_CELL - 2.0f * margin);
+            float chance = rng.uniform(1.0f);
+            float scale = TREE_RANGE_L + rng.uniform(TREE_RANGE_H - TREE_RANGE_L);
+            if (chance < treeDensity(x, z))
+                page.trees << QVector4D(x, height(x, z) - TREE_SINK, z, scale);
+        }
+    }
+}
+
+// Make one page.  Runs on the thread pool.
+QSharedPointer<worldPage> worldPager::generate(int px, int pz) const
+{
+    QSharedPointer<worldPage> page(new worldPage);
+    page->px = px;
+    page->pz = pz;
+    page->lastUsed = 0;
+    page->resident = false;
+    page->lod = 0;
+
+    float x0 = -WORLD_DIM + px * PAGE_SIZE, z0 = -WORLD_DIM + pz * PAGE_SIZE;
+    float minY = FLT_MAX, maxY = -FLT_MAX;
+    page->height.resize(TILE_DIVS * TILE_DIVS);
+    for (int lz = 0; lz < TILE_DIVS; lz++)
+    {
+        for (int lx = 0; lx < TILE_DIVS; lx++)
+        {
+            float y = height(x0 + lx * PAGE_SPACING, z0 + lz * PAGE_SPACING);
+            page->height[lz * TILE_DIVS + lx] = y;
+            minY = MIN(minY, y);
+            maxY = MAX(maxY, y);
+        }
+    }
+    page->landMin = QVector3D(x0, minY, z0);
+    page->landMax = QVector3D(x0 + PAGE_SIZE, maxY, z0 + PAGE_SIZE);
+
+    // The trees can reach over the edge of the page, so they get a box of their own
+    placeTrees(*page);
+    page->boxMin = page->landMin;
+    page->boxMax = page->landMax;
+    for (int i = 0; i < page->trees.size(); i++)
+    {
+        QVector3D lo = page->trees[i].toVector3D() + treeMin * page->trees[i].w();
+        QVector3D hi = page->trees[i].toVector3D() + treeMax * page->trees[i].w();
+        page->boxMin = QVector3D(MIN(page->boxMin.x(), lo.x()), MIN(page->boxMin.y(), lo.y()), MIN(page->boxMin.z(), lo.z()));
+        page->boxMax = QVector3D(MAX(page->boxMax.x(), hi.x()), MAX(page->boxMax.y(), hi.y()), MAX(page->boxMax.z(), hi.z()));
+    }
+    return page;
+}
+
+// Work out which pages, relative to the viewer's, are in range from anywhere on the viewer's page
+void worldPager::setOffsets(float radius)
+{
+    offsetRadius = radius;
+    offsets.resize(0);
+    int n = int(ceil(radius / PAGE_SIZE + 1.5f));
+    for (int dz = -n; dz <= n; dz++)
+        for (int dx = -n; dx <= n; dx++)
+            if (sqrt(float(dx * dx + dz * dz)) * PAGE_SIZE <= radius + PAGE_SIZE * 1.5f)
+                offsets << QPoint(dx, dz);
+    std::sort(offsets.begin(), offsets.end(), [](const QPoint &a, const QPoint &b) {
+        return a.x() * a.x() + a.y() * a.y() < b.x() * b.x() + b.y() * b.y();
+    });
+}
+
+void worldPager::preload(float x, float z, float radius)
+{
+    if (radius != offsetRadius)
+        setOffsets(radius);
+
+    int cx = pageOf(x), cz = pageOf(z);
+    QVector<QPoint> missing;
+    for (int i = 0; i < offsets.size(); i++)
+        if (!cache.contains(key(cx + offsets[i].x(), cz + offsets[i].y())))
+            missing << QPoint(cx + offsets[i].x(), cz + offsets[i].y());
+
+    auto make = [this](const QPoint &p) { return generate(p.x(), p.y()); };
+    QVector<QSharedPointer<worldPage>> made =
+        QtConcurrent::blockingMapped<QVector<QSharedPointer<worldPage>>>(missing, make);
+    for (int i = 0; i < made.size(); i++)
+        insert(made[i]);
+}
+
+void worldPager::update(float x, float z, float radius)
+{
+    updates++;
+    if (radius != offsetRadius)
+        setOffsets(radius);
+
+    // Take in the pages that are ready
+    QVector<quint64> done;
+    for (auto i = pending.constBegin(); i != pending.constEnd(); ++i)
+        if (i.value().isFinished())
+            done << i.key();
+    for (int i = 0; i < done.size(); i++)
+        insert(pending.take(done[i]).result());
+
+    // Gather the pages in range, and ask for the nearest of the missing ones.  Only a few are made at a time, so the
+    // pages nearest the viewer (which the viewer is heading into, or needs most) are never stuck behind a backlog.
+    int cx = pageOf(x), cz = pageOf(z);
+    range.resize(0);
+    for (int i = 0; i < offsets.size(); i++)
+    {
+        int px = cx + offsets[i].x(), pz = cz + offsets[i].y();
+        quint64 k = key(px, pz);
+        worldPage *page = cache.value(k).data();
+        if (page)
+        {
+            page->lastUsed = updates;
+            range << page;
+        }
+        else if (pending.size() < STREAM_IN_FLIGHT && !pending.contains(k))
+            pending.insert(k, QtConcurrent::run([this, px, pz]() { return generate(px, pz); }));
+    }
+
+    // Over budget?  Drop the pages that have been out of range the longest.
+    const qint64 budget = qint64(STREAM_CACHE_MB) * 1024 * 1024;
+    if (bytes <= budget)
+        return;
+    QVector<worldPage *> old;
+    for (auto i = cache.constBegin(); i != cache.constEnd(); ++i)
+        if (i.value()->lastUsed != updates)
+            old << i.value().data();
+    std::sort(old.begin(), old.end(), [](const worldPage *a, const worldPage *b) { return a->lastUsed < b->lastUsed; });
+    for (int i = 0; i < old.size() && bytes > budget; i++)
+    {
+        bytes -= pageBytes(*old[i]);
+        cache.remove(key(old[i]->px, old[i]->pz));
+    }
+}
+
+worldPage *worldPager::find(int px, int pz) const
+{
+    return cache.value(key(px, pz)).data();
+}
+
+// Whether any tree on the loaded pages is within radius of (x, z)
+bool worldPager::anyTreeWithin(float x, float z, float radius) const
+{
+    for (int pz = pageOf(z - radius); pz <= pageOf(z + radius); pz++)
+    {
+        for (int px = pageOf(x - radius); px <= pageOf(x + radius); px++)
+        {
+            const worldPage *page = find(px, pz);
+            if (!page)
+                continue;
+            for (int i = 0; i < page->trees.size(); i++)
+            {
+                float dx = page->trees[i].x() - x, dz = page->trees[i].z() - z;
+                if (dx * dx + dz * dz < radius * radius)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void worldPager::insert(const QSharedPointer<worldPage> &page)
+{
+    page->lastUsed = updates;
+    bytes += pageBytes(*page);
+    cache.insert(key(page->px, page->pz), page);
+}
+
+// The page a world x or z coordinate falls in
+int worldPager::pageOf(float w) const
+{
+    return int(floorf((w + WORLD_DIM) / PAGE_SIZE));
+}
+
+qint64 worldPager::pageBytes(const worldPage &page)
+{
+    return sizeof(worldPage) + page.height.size() * sizeof(float) + page.trees.size() * sizeof(QVector4D);
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Pages of an endless world, made on demand around the viewer.  The land
+** is a seeded fractal value noise (sums of octaves of smoothly interpolated
+** random values on a lattice), so any point of it can be worked out on its
+** own, in any order, on any thread, and always comes out the same for the
+** same seed.  A page is one land tile's worth of grid points plus the trees
+** on it; each is generated on the thread pool, and the pages nobody has
+** been near for a while are dropped once the cache is over its memory
+** budget, least recently used first.
+**
+** Based on: Ken Perlin, "An Image Synthesizer", SIGGRAPH 1985, and
+** F. Kenton Musgrave, "Texturing and Modeling: A Procedural Approach",
+** chapter 16, 1994.
+**
+****************************************************************************/
+
+#ifndef WORLDPAGER_H
+#define WORLDPAGER_H
+
+#include <QFuture>
+#include <QHash>
+#include <QPoint>
+#include <QSharedPointer>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+
+#define STREAM_RELIEF 10.0f     // Height from the deepest lake bed to the highest hilltop, roughly
+#define STREAM_FEATURE 30.0f    // Width of the largest hills and lakes
+#define STREAM_OCTAVES 6        // Layers of noise; each one is half the size and half the height of the one before
+#define STREAM_FOREST 20.0f     // Width of the patches of forest and open meadow
+#define STREAM_TREE_CELL 1.25f  // Trees are placed one candidate per cell of this size, so at most one per cell.  Must divide the page size
+#define STREAM_CACHE_MB 16      // Memory budget for the pages, in megabytes.  Pages in view are kept even if it's exceeded
+#define STREAM_IN_FLIGHT 8      // Most pages being generated at once
+
+// One page of the world:  TILE_DIVS x TILE_DIVS grid points, starting at grid point (px, pz) * (TILE_DIVS - 1), so
+// that neighboring pages share their edge points.  Page (0, 0) is the first tile of the fixed size world.
+struct worldPage
+{
+    int px, pz;
+    QVector<float> height;         // Heights of the grid points, row by row
+    QVector<QVector4D> trees;      // The trees on the page, as GeometryEngine::treeSpot
+    QVector3D landMin, landMax;    // Bounding box of the ground
+    QVector3D boxMin, boxMax;      // Bounding box of the ground and the trees
+    quint32 lastUsed;              // worldPager::update() call that last found the page in range
+    bool resident;                 // The page's heights are in GeometryEngine's height texture
+    int lod;                       // Level of detail GeometryEngine chose for the page this frame
+};
+
+class worldPager
+{
+public:
+    // treeMin and treeMax are the bounds of the tree model, for the pages' bounding boxes.  Trees grow on dry land
+    // only, above waterLevel.
+    worldPager(quint32 seed, float waterLevel, const QVector3D &treeMin, const QVector3D &treeMax);
+    ~worldPager(); // waits for the pages being generated
+
+    // Height of the ground anywhere in the world.  Safe to call from any thread.
+    float height(float x, float z) const;
+
+    // Generate every page within radius of (x, z) before returning, spread over the thread pool
+    void preload(float x, float z, float radius);
+
+    // Collect the pages that have finished generating, start on the missing ones within radius of (x, z), nearest
+    // first, and drop the least recently used pages if the cache is over budget.  Call once a frame.
+    void update(float x, float z, float radius);
+
+    // The loaded pages within the radius given to update(), nearest first.  Valid until the next update().
+    const QVector<worldPage *> &inRange(void) const { return range; }
+    worldPage *find(int px, int pz) const;
+    bool anyTreeWithin(float x, float z, float radius) const;
+
+    int pageCount(void) const { return cache.size(); }
+
+private:
+    QSharedPointer<worldPage> generate(int px, int pz) const;
+    void placeTrees(worldPage &page) const;
+    float treeDensity(float x, float z) const;
+    void setOffsets(float radius);
+    void insert(const QSharedPointer<worldPage> &page);
+    int pageOf(float w) const;
+    static quint64 key(int px, int pz) { return quint64(quint32(px)) << 32 | quint32(pz); }
+    static qint64 pageBytes(const worldPage &page);
+
+    quint32 seed;
+    float waterLevel;
+    QVector3D treeMin, treeMax;
+
+    QHash<quint64, QSharedPointer<worldPage>> cache;       // Every loaded page
+    QHash<quint64, QFuture<QSharedPointer<worldPage>>> pending; // Pages being generated
+    QVector<worldPage *> range;     // Loaded pages in range, nearest first
+    QVector<QPoint> offsets;        // Pages in range relative to the viewer's page, nearest first
+    float offsetRadius;             // radius offsets were worked out for
+    qint64 bytes;                   // memory used by the cached pages
+    quint32 updates;                // number of update() calls, for the LRU
+};
+
+#endif // WORLDPAGER_H